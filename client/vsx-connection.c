@@ -88,6 +88,23 @@ G_DEFINE_TYPE (VsxConnection, vsx_connection, G_TYPE_OBJECT);
    message (2.5 minutes) */
 #define VSX_CONNECTION_KEEP_ALIVE_TIME 150
 
+/* Types of the events in the binary encoding. See doc/protocol.txt */
+typedef enum
+{
+  VSX_CONNECTION_BINARY_HEADER,
+  VSX_CONNECTION_BINARY_N_TILES,
+  VSX_CONNECTION_BINARY_PLAYER_NAME,
+  VSX_CONNECTION_BINARY_PLAYER,
+  VSX_CONNECTION_BINARY_TILE,
+  VSX_CONNECTION_BINARY_MESSAGE,
+  VSX_CONNECTION_BINARY_SHOUT,
+  VSX_CONNECTION_BINARY_KEEP_ALIVE,
+  VSX_CONNECTION_BINARY_SYNC,
+  VSX_CONNECTION_BINARY_END,
+  VSX_CONNECTION_BINARY_VERSION,
+  VSX_CONNECTION_BINARY_MESSAGES_TRUNCATED
+} VsxConnectionBinaryType;
+
 typedef enum
 {
   VSX_CONNECTION_RUNNING_STATE_DISCONNECTED,
@@ -103,6 +120,9 @@ struct _VsxConnectionPrivate
   SoupSession *soup_session;
   SoupMessage *message;
   GString *line_buffer;
+  /* Whether the server is sending the events in the binary encoding
+     instead of as lines of JSON */
+  gboolean binary_stream;
   gboolean has_disconnected;
   JsonParser *json_parser;
   guint reconnect_timeout;
@@ -114,6 +134,10 @@ struct _VsxConnectionPrivate
   gboolean typing;
   gboolean sent_typing_state;
   int next_message_num;
+  /* The last version of the game state that the server reported. This
+     is sent back when reconnecting so that only later changes are
+     resent */
+  int state_version;
   GQueue command_queue;
   SoupMessage *command_message;
 
@@ -336,6 +360,95 @@ vsx_connection_maybe_send_keep_alive (VsxConnection *connection)
     }
 }
 
+static gboolean
+vsx_connection_is_batch_command (GList *node)
+{
+  VsxConnectionCommand *cmd;
+
+  if (node == NULL)
+    return FALSE;
+
+  cmd = node->data;
+
+  switch (cmd->type)
+    {
+    case VSX_CONNECTION_COMMAND_SHOUT:
+    case VSX_CONNECTION_COMMAND_TURN:
+    case VSX_CONNECTION_COMMAND_MOVE_TILE:
+      return TRUE;
+
+    case VSX_CONNECTION_COMMAND_MESSAGE:
+    case VSX_CONNECTION_COMMAND_LEAVE:
+      return FALSE;
+    }
+
+  g_assert_not_reached ();
+
+  return FALSE;
+}
+
+/* Takes all of the commands from the front of the queue that can be
+   batched and makes a single /batch request for them */
+static SoupMessage *
+vsx_connection_make_batch_message (VsxConnection *connection)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+  SoupMessage *msg;
+  GString *body;
+
+  body = g_string_new (NULL);
+
+  while (vsx_connection_is_batch_command (priv->command_queue.head))
+    {
+      VsxConnectionCommand *cmd = vsx_connection_pop_command (connection);
+
+      switch (cmd->type)
+        {
+        case VSX_CONNECTION_COMMAND_SHOUT:
+          g_string_append (body, "shout\n");
+          break;
+
+        case VSX_CONNECTION_COMMAND_TURN:
+          g_string_append (body, "turn\n");
+          break;
+
+        case VSX_CONNECTION_COMMAND_MOVE_TILE:
+          {
+            VsxConnectionMoveTileCommand *move_cmd =
+              (VsxConnectionMoveTileCommand *) cmd;
+
+            g_string_append_printf (body,
+                                    "move_tile&%i&%i&%i\n",
+                                    move_cmd->tile_num,
+                                    move_cmd->x,
+                                    move_cmd->y);
+          }
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+
+      vsx_connection_command_free (cmd);
+    }
+
+  msg = vsx_connection_make_message (connection,
+                                     "POST",
+                                     "batch",
+                                     "s",
+                                     priv->person_id);
+
+  soup_message_set_request (msg,
+                            "text/plain",
+                            SOUP_MEMORY_TAKE,
+                            body->str,
+                            body->len);
+
+  g_string_free (body, FALSE);
+
+  return msg;
+}
+
 static void
 vsx_connection_maybe_send_command (VsxConnection *connection)
 {
@@ -375,6 +488,20 @@ vsx_connection_maybe_send_command (VsxConnection *connection)
       else
         vsx_connection_maybe_send_keep_alive (connection);
     }
+  else if (vsx_connection_is_batch_command (priv->command_queue.head) &&
+           vsx_connection_is_batch_command (priv->command_queue.head->next))
+    {
+      /* If more than one command has built up while waiting for the
+         last one to finish then they are all sent in one request */
+      priv->command_message = vsx_connection_make_batch_message (connection);
+
+      vsx_connection_queue_keep_alive (connection);
+
+      soup_session_queue_message (priv->soup_session,
+                                  priv->command_message,
+                                  command_message_complete_cb,
+                                  connection);
+    }
   else
     {
       VsxConnectionCommand *cmd = vsx_connection_pop_command (connection);
@@ -712,6 +839,117 @@ get_or_create_player (VsxConnection *connection,
   return player;
 }
 
+/* These apply the events once they have been decoded from either
+ * of the encodings */
+
+static void
+set_player_name (VsxConnection *connection,
+                 int num,
+                 const char *name)
+{
+  VsxPlayer *player = get_or_create_player (connection, num);
+
+  g_free (player->name);
+  player->name = g_strdup (name);
+
+  g_signal_emit (connection,
+                 signals[SIGNAL_PLAYER_CHANGED],
+                 0, /* detail */
+                 player);
+}
+
+static void
+set_player_flags (VsxConnection *connection,
+                  int num,
+                  int flags)
+{
+  VsxPlayer *player = get_or_create_player (connection, num);
+
+  player->flags = flags;
+
+  g_signal_emit (connection,
+                 signals[SIGNAL_PLAYER_CHANGED],
+                 0, /* detail */
+                 player);
+}
+
+static void
+set_tile (VsxConnection *connection,
+          int num,
+          int x,
+          int y,
+          gunichar letter)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+  VsxTile *tile;
+  gboolean is_new = FALSE;
+
+  tile = g_hash_table_lookup (priv->tiles, GINT_TO_POINTER (num));
+
+  if (tile == NULL)
+    {
+      tile = g_slice_new0 (VsxTile);
+      tile->num = num;
+
+      g_hash_table_insert (priv->tiles, GINT_TO_POINTER (num), tile);
+      is_new = TRUE;
+    }
+
+  tile->x = x;
+  tile->y = y;
+  tile->letter = letter;
+
+  g_signal_emit (connection,
+                 signals[SIGNAL_TILE_CHANGED],
+                 0, /* detail */
+                 is_new,
+                 tile);
+}
+
+static void
+player_shouted (VsxConnection *connection,
+                int num)
+{
+  VsxPlayer *player = get_or_create_player (connection, num);
+
+  g_signal_emit (connection,
+                 signals[SIGNAL_PLAYER_SHOUTED],
+                 0, /* detail */
+                 player);
+}
+
+static void
+got_header (VsxConnection *connection,
+            int self_num,
+            const char *person_id)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+
+  priv->self = get_or_create_player (connection, self_num);
+
+  g_free (priv->person_id);
+  priv->person_id = g_strdup (person_id);
+
+  if (priv->state == VSX_CONNECTION_STATE_AWAITING_HEADER)
+    vsx_connection_set_state (connection, VSX_CONNECTION_STATE_IN_PROGRESS);
+}
+
+static void
+got_message (VsxConnection *connection,
+             int num,
+             const char *text)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+
+  g_signal_emit (connection,
+                 signals[SIGNAL_MESSAGE],
+                 0, /* detail */
+                 get_or_create_player (connection, num),
+                 text);
+
+  priv->next_message_num++;
+}
+
 static gboolean
 handle_player_name (VsxConnection *connection,
                     JsonArray *array)
@@ -720,7 +958,6 @@ handle_player_name (VsxConnection *connection,
   JsonObject *message_object;
   gint64 num;
   const char *text;
-  VsxPlayer *player;
 
   if (json_array_get_length (array) < 2)
     return FALSE;
@@ -737,15 +974,7 @@ handle_player_name (VsxConnection *connection,
       !get_object_string_member (message_object, "name", &text))
     return FALSE;
 
-  player = get_or_create_player (connection, num);
-
-  g_free (player->name);
-  player->name = g_strdup (text);
-
-  g_signal_emit (connection,
-                 signals[SIGNAL_PLAYER_CHANGED],
-                 0, /* detail */
-                 player);
+  set_player_name (connection, num, text);
 
   return TRUE;
 }
@@ -757,7 +986,6 @@ handle_player (VsxConnection *connection,
   JsonNode *message_node;
   JsonObject *message_object;
   gint64 num, flags;
-  VsxPlayer *player;
 
   if (json_array_get_length (array) < 2)
     return FALSE;
@@ -775,14 +1003,7 @@ handle_player (VsxConnection *connection,
       flags < 0 || flags > G_MAXINT)
     return FALSE;
 
-  player = get_or_create_player (connection, num);
-
-  player->flags = flags;
-
-  g_signal_emit (connection,
-                 signals[SIGNAL_PLAYER_CHANGED],
-                 0, /* detail */
-                 player);
+  set_player_flags (connection, num, flags);
 
   return TRUE;
 }
@@ -791,13 +1012,10 @@ static gboolean
 handle_tile (VsxConnection *connection,
              JsonArray *array)
 {
-  VsxConnectionPrivate *priv = connection->priv;
   JsonNode *message_node;
   JsonObject *message_object;
   gint64 num, x, y;
   const char *letter;
-  VsxTile *tile;
-  gboolean is_new = FALSE;
 
   if (json_array_get_length (array) < 2)
     return FALSE;
@@ -819,37 +1037,69 @@ handle_tile (VsxConnection *connection,
       g_utf8_strlen (letter, -1) != 1)
     return FALSE;
 
-  tile = g_hash_table_lookup (priv->tiles, GINT_TO_POINTER ((int) num));
+  set_tile (connection, num, x, y, g_utf8_get_char (letter));
 
-  if (tile == NULL)
-    {
-      tile = g_slice_new0 (VsxTile);
-      tile->num = num;
+  return TRUE;
+}
 
-      g_hash_table_insert (priv->tiles, GINT_TO_POINTER ((int) num), tile);
-      is_new = TRUE;
-    }
+static gboolean
+handle_shout (VsxConnection *connection,
+              JsonArray *array)
+{
+  JsonNode *num_node;
+  gint64 num;
 
-  tile->x = x;
-  tile->y = y;
-  tile->letter = g_utf8_get_char (letter);
+  if (json_array_get_length (array) < 2)
+    return FALSE;
 
-  g_signal_emit (connection,
-                 signals[SIGNAL_TILE_CHANGED],
-                 0, /* detail */
-                 is_new,
-                 tile);
+  num_node = json_array_get_element (array, 1);
+
+  if (json_node_get_node_type (num_node) != JSON_NODE_VALUE)
+    return FALSE;
+
+  num = json_node_get_int (num_node);
+
+  if (num < 0 || num > G_MAXINT)
+    return FALSE;
+
+  player_shouted (connection, num);
 
   return TRUE;
 }
 
 static gboolean
-handle_shout (VsxConnection *connection,
-              JsonArray *array)
+handle_version (VsxConnection *connection,
+                JsonArray *array)
 {
+  VsxConnectionPrivate *priv = connection->priv;
+  JsonNode *version_node;
+  gint64 version;
+
+  if (json_array_get_length (array) < 2)
+    return FALSE;
+
+  version_node = json_array_get_element (array, 1);
+
+  if (json_node_get_node_type (version_node) != JSON_NODE_VALUE)
+    return FALSE;
+
+  version = json_node_get_int (version_node);
+
+  if (version < 0 || version > G_MAXINT)
+    return FALSE;
+
+  priv->state_version = version;
+
+  return TRUE;
+}
+
+static gboolean
+handle_messages_truncated (VsxConnection *connection,
+                           JsonArray *array)
+{
+  VsxConnectionPrivate *priv = connection->priv;
   JsonNode *num_node;
   gint64 num;
-  VsxPlayer *player;
 
   if (json_array_get_length (array) < 2)
     return FALSE;
@@ -864,12 +1114,9 @@ handle_shout (VsxConnection *connection,
   if (num < 0 || num > G_MAXINT)
     return FALSE;
 
-  player = get_or_create_player (connection, num);
-
-  g_signal_emit (connection,
-                 signals[SIGNAL_PLAYER_SHOUTED],
-                 0, /* detail */
-                 player);
+  /* The server discarded some messages before we received them so
+   * we carry on counting from the next one it will send */
+  priv->next_message_num = num;
 
   return TRUE;
 }
@@ -879,7 +1126,6 @@ handle_message (VsxConnection *connection,
                 JsonNode *object,
                 GError **error)
 {
-  VsxConnectionPrivate *priv = connection->priv;
   JsonArray *array;
   JsonNode *method_node;
   const char *method_string;
@@ -915,13 +1161,7 @@ handle_message (VsxConnection *connection,
           || !get_object_string_member (header_object, "id", &person_id))
         goto bad_data;
 
-      priv->self = get_or_create_player (connection, self_num);
-
-      g_free (priv->person_id);
-      priv->person_id = g_strdup (person_id);
-
-      if (priv->state == VSX_CONNECTION_STATE_AWAITING_HEADER)
-        vsx_connection_set_state (connection, VSX_CONNECTION_STATE_IN_PROGRESS);
+      got_header (connection, self_num, person_id);
     }
   else if (!strcmp (method_string, "message"))
     {
@@ -945,13 +1185,7 @@ handle_message (VsxConnection *connection,
           !get_object_string_member (message_object, "text", &text))
         goto bad_data;
 
-      g_signal_emit (connection,
-                     signals[SIGNAL_MESSAGE],
-                     0, /* detail */
-                     get_or_create_player (connection, num),
-                     text);
-
-      priv->next_message_num++;
+      got_message (connection, num, text);
     }
   else if (!strcmp (method_string, "tile"))
     {
@@ -975,6 +1209,16 @@ handle_message (VsxConnection *connection,
       if (!handle_player (connection, array))
         goto bad_data;
     }
+  else if (!strcmp (method_string, "version"))
+    {
+      if (!handle_version (connection, array))
+        goto bad_data;
+    }
+  else if (!strcmp (method_string, "messages-truncated"))
+    {
+      if (!handle_messages_truncated (connection, array))
+        goto bad_data;
+    }
 
   return TRUE;
 
@@ -986,6 +1230,19 @@ handle_message (VsxConnection *connection,
   return FALSE;
 }
 
+static void
+vsx_connection_abort_stream (VsxConnection *connection,
+                             GError *error)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+
+  soup_session_cancel_message (priv->soup_session,
+                               priv->message,
+                               SOUP_STATUS_CANCELLED);
+
+  vsx_connection_signal_error (connection, error);
+}
+
 static void
 vsx_connection_process_lines (VsxConnection *connection)
 {
@@ -1024,12 +1281,7 @@ vsx_connection_process_lines (VsxConnection *connection)
             {
               /* If the stream is giving us invalid JSON data then we'll
                  just reconnect as if it was an error */
-
-              soup_session_cancel_message (priv->soup_session,
-                                           priv->message,
-                                           SOUP_STATUS_CANCELLED);
-
-              vsx_connection_signal_error (connection, error);
+              vsx_connection_abort_stream (connection, error);
 
               g_clear_error (&error);
 
@@ -1052,6 +1304,239 @@ vsx_connection_process_lines (VsxConnection *connection)
   g_object_unref (connection);
 }
 
+static char *
+get_binary_string (const guint8 *data,
+                   gsize length)
+{
+  char *str = g_strndup ((const char *) data, length);
+
+  if (strlen (str) != length || !g_utf8_validate (str, -1, NULL))
+    {
+      g_free (str);
+      return NULL;
+    }
+
+  return str;
+}
+
+static gboolean
+handle_binary_event (VsxConnection *connection,
+                     int type,
+                     const guint8 *payload,
+                     gsize length)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+
+  /* All of the multi-byte numbers are little-endian */
+  switch (type)
+    {
+    case VSX_CONNECTION_BINARY_HEADER:
+      {
+        char person_id[8 * 2 + 1];
+        int i;
+
+        if (length < 9)
+          return FALSE;
+
+        for (i = 0; i < 8; i++)
+          g_snprintf (person_id + i * 2, 3, "%02X", payload[8 - i]);
+
+        got_header (connection, payload[0], person_id);
+      }
+      break;
+
+    case VSX_CONNECTION_BINARY_PLAYER_NAME:
+    case VSX_CONNECTION_BINARY_MESSAGE:
+      {
+        char *text;
+
+        if (length < 1 ||
+            (text = get_binary_string (payload + 1, length - 1)) == NULL)
+          return FALSE;
+
+        if (type == VSX_CONNECTION_BINARY_PLAYER_NAME)
+          set_player_name (connection, payload[0], text);
+        else
+          got_message (connection, payload[0], text);
+
+        g_free (text);
+      }
+      break;
+
+    case VSX_CONNECTION_BINARY_PLAYER:
+      if (length < 2)
+        return FALSE;
+      set_player_flags (connection, payload[0], payload[1]);
+      break;
+
+    case VSX_CONNECTION_BINARY_TILE:
+      if (length < 9)
+        return FALSE;
+      set_tile (connection,
+                payload[0],
+                (gint16) (payload[1] | (payload[2] << 8)),
+                (gint16) (payload[3] | (payload[4] << 8)),
+                payload[6] | (payload[7] << 8) | (payload[8] << 16));
+      break;
+
+    case VSX_CONNECTION_BINARY_SHOUT:
+      if (length < 1)
+        return FALSE;
+      player_shouted (connection, payload[0]);
+      break;
+
+    case VSX_CONNECTION_BINARY_END:
+      vsx_connection_set_state (connection, VSX_CONNECTION_STATE_DONE);
+      break;
+
+    case VSX_CONNECTION_BINARY_VERSION:
+      {
+        guint32 version;
+
+        if (length < 4)
+          return FALSE;
+
+        version = (payload[0] |
+                   (payload[1] << 8) |
+                   (payload[2] << 16) |
+                   ((guint32) payload[3] << 24));
+
+        if (version > G_MAXINT)
+          return FALSE;
+
+        priv->state_version = version;
+      }
+      break;
+
+    case VSX_CONNECTION_BINARY_MESSAGES_TRUNCATED:
+      {
+        guint32 num;
+
+        if (length < 4)
+          return FALSE;
+
+        num = (payload[0] |
+               (payload[1] << 8) |
+               (payload[2] << 16) |
+               ((guint32) payload[3] << 24));
+
+        if (num > G_MAXINT)
+          return FALSE;
+
+        priv->next_message_num = num;
+      }
+      break;
+
+    default:
+      /* Ignore any events that we don't understand */
+      break;
+    }
+
+  return TRUE;
+}
+
+/* Reads the type and payload length at the start of a binary event.
+ * Returns the number of bytes used, zero if the buffer doesn't
+ * contain all of them yet or -1 if they are invalid */
+static int
+read_binary_event_start (const guint8 *buf,
+                         gsize length,
+                         int *type_out,
+                         gsize *payload_length_out)
+{
+  gsize payload_length = 0;
+  int pos = 1;
+  int shift = 0;
+
+  if (length < 1)
+    return 0;
+
+  /* The length is stored 7 bits at a time with the top bit set on
+   * every byte except the last */
+  while (TRUE)
+    {
+      if (pos >= length)
+        return 0;
+
+      if (shift > 28)
+        return -1;
+
+      payload_length |= (gsize) (buf[pos] & 0x7f) << shift;
+      shift += 7;
+
+      if ((buf[pos++] & 0x80) == 0)
+        break;
+    }
+
+  *type_out = buf[0];
+  *payload_length_out = payload_length;
+
+  return pos;
+}
+
+static void
+vsx_connection_process_binary_events (VsxConnection *connection)
+{
+  VsxConnectionPrivate *priv = connection->priv;
+  const guint8 *buf_pos;
+  gsize len;
+
+  g_object_ref (connection);
+
+  /* Mark that we're still connected so that we can detect if one of
+     the signal emissions ends up disconnecting the stream. In that
+     case we'd want to stop further processing */
+  priv->has_disconnected = FALSE;
+
+  buf_pos = (const guint8 *) priv->line_buffer->str;
+  len = priv->line_buffer->len;
+
+  while (!priv->has_disconnected)
+    {
+      int type;
+      gsize payload_length;
+      int start_length = read_binary_event_start (buf_pos,
+                                                  len,
+                                                  &type,
+                                                  &payload_length);
+
+      if (start_length >= 0 &&
+          (start_length == 0 || start_length + payload_length > len))
+        break;
+
+      if (start_length < 0 ||
+          !handle_binary_event (connection,
+                                type,
+                                buf_pos + start_length,
+                                payload_length))
+        {
+          GError *error = g_error_new (VSX_CONNECTION_ERROR,
+                                       VSX_CONNECTION_ERROR_BAD_DATA,
+                                       "Bad data received from the server");
+
+          /* Reconnect as if it was an error */
+          vsx_connection_abort_stream (connection, error);
+
+          g_error_free (error);
+
+          break;
+        }
+
+      buf_pos += start_length + payload_length;
+      len -= start_length + payload_length;
+    }
+
+  /* Move the unprocessed data to the beginning of the buffer in case
+     the chunk contained an incomplete event */
+  if (buf_pos != (const guint8 *) priv->line_buffer->str)
+    {
+      memmove (priv->line_buffer->str, buf_pos, len);
+      g_string_set_size (priv->line_buffer, len);
+    }
+
+  g_object_unref (connection);
+}
+
 static void
 vsx_connection_got_chunk_cb (SoupMessage *message,
                              SoupBuffer *chunk,
@@ -1073,7 +1558,10 @@ vsx_connection_got_chunk_cb (SoupMessage *message,
 
       /* This may cause the message to be cancelled if the data is
          invalid or if the signal emission disconnects the stream */
-      vsx_connection_process_lines (connection);
+      if (priv->binary_stream)
+        vsx_connection_process_binary_events (connection);
+      else
+        vsx_connection_process_lines (connection);
     }
 }
 
@@ -1087,8 +1575,18 @@ vsx_connection_got_headers_cb (SoupMessage *message,
      reconnect timeout */
   if (message->status_code == SOUP_STATUS_OK)
     {
+      const char *content_type =
+        soup_message_headers_get_content_type (message->response_headers,
+                                               NULL);
+
       priv->reconnect_timeout = VSX_CONNECTION_INITIAL_TIMEOUT;
 
+      /* We always ask for the binary encoding but we can still read
+         the JSON lines in case the server doesn't send it */
+      priv->binary_stream =
+        (content_type &&
+         !g_ascii_strcasecmp (content_type, "application/octet-stream"));
+
       g_string_set_size (priv->line_buffer, 0);
     }
 }
@@ -1170,16 +1668,19 @@ vsx_connection_queue_message (VsxConnection *connection)
     priv->message = vsx_connection_make_message (connection,
                                                  "GET",
                                                  "watch_person",
-                                                 "si",
+                                                 "siis",
                                                  priv->person_id,
-                                                 priv->next_message_num);
+                                                 priv->next_message_num,
+                                                 priv->state_version,
+                                                 "binary");
   else
     priv->message = vsx_connection_make_message (connection,
                                                  "GET",
                                                  "new_person",
-                                                 "ss",
+                                                 "sss",
                                                  priv->room,
-                                                 priv->player_name);
+                                                 priv->player_name,
+                                                 "binary");
 
 
   g_signal_connect (priv->message, "got-headers",
@@ -1454,6 +1955,7 @@ vsx_connection_init (VsxConnection *self)
 
   priv->line_buffer = g_string_new (NULL);
   priv->next_message_num = 0;
+  priv->state_version = 0;
   g_queue_init (&priv->command_queue);
 
   priv->keep_alive_time = g_timer_new ();
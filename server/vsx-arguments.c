@@ -222,7 +222,7 @@ vsx_arguments_parse (const char *template,
           break;
 
         case 'p':
-          va_arg (ap, VsxPersonId *);
+          va_arg (ap_copy, VsxPersonId *);
           break;
 
         case 'n':
@@ -0,0 +1,448 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+#include "vsx-batch-handler.h"
+#include "vsx-string-response.h"
+#include "vsx-parse-content-type.h"
+#include "vsx-arguments.h"
+
+/* The body of the request is a list of commands, one per line. Each
+ * command is the name of one of the simple per-person requests
+ * followed by its arguments separated by ampersands, the same as in
+ * the query string of the request but without the person id. */
+
+static const struct
+{
+  const char *name;
+  VsxBatchCommandType type;
+  int n_args;
+}
+commands[] =
+  {
+    { "move_tile", VSX_BATCH_COMMAND_MOVE_TILE, 3 },
+    { "turn", VSX_BATCH_COMMAND_TURN, 0 },
+    { "shout", VSX_BATCH_COMMAND_SHOUT, 0 },
+    { "set_n_tiles", VSX_BATCH_COMMAND_SET_N_TILES, 1 },
+    { "start_typing", VSX_BATCH_COMMAND_START_TYPING, 0 },
+    { "stop_typing", VSX_BATCH_COMMAND_STOP_TYPING, 0 },
+    { "keep_alive", VSX_BATCH_COMMAND_KEEP_ALIVE, 0 }
+  };
+
+static void
+real_free (void *object)
+{
+  VsxBatchHandler *handler = (VsxBatchHandler *) object;
+
+  if (handler->person)
+    vsx_object_unref (handler->person);
+
+  if (handler->response)
+    vsx_object_unref (handler->response);
+
+  vsx_request_handler_get_class ()->parent_class.free (object);
+}
+
+static void
+set_error (VsxBatchHandler *self,
+           VsxStringResponseType type)
+{
+  if (self->person)
+    {
+      vsx_object_unref (self->person);
+      self->person = NULL;
+    }
+
+  if (self->response == NULL)
+    self->response = vsx_string_response_get (type);
+}
+
+static void
+real_request_line_received (VsxRequestHandler *handler,
+                            VsxRequestMethod method,
+                            const char *query_string)
+{
+  VsxBatchHandler *self = (VsxBatchHandler *) handler;
+  VsxPersonId id;
+
+  if ((method == VSX_REQUEST_METHOD_POST
+       || method == VSX_REQUEST_METHOD_OPTIONS)
+      && vsx_arguments_parse ("p", query_string, &id))
+    {
+      VsxPerson *person;
+
+      /* This is the only person lookup for all of the commands */
+      person = vsx_person_set_activate_person (handler->person_set, id);
+
+      if (person == NULL)
+        set_error (self, VSX_STRING_RESPONSE_NOT_FOUND);
+      else if (method == VSX_REQUEST_METHOD_OPTIONS)
+        self->is_options_request = TRUE;
+      else
+        self->person = vsx_object_ref (person);
+    }
+  else
+    set_error (self, VSX_STRING_RESPONSE_BAD_REQUEST);
+}
+
+static gboolean
+handle_content_type_cb (const char *content_type,
+                        void *user_data)
+{
+  VsxBatchHandler *self = user_data;
+
+  /* The content must be text/plain. Any charset is accepted because
+   * the commands only use ASCII */
+  if (g_ascii_strcasecmp ("text/plain", content_type))
+    {
+      set_error (self, VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+handle_parameter_cb (const char *name,
+                     const char *value,
+                     void *user_data)
+{
+  return TRUE;
+}
+
+static void
+real_header_received (VsxRequestHandler *handler,
+                      const char *field_name,
+                      const char *value)
+{
+  VsxBatchHandler *self = (VsxBatchHandler *) handler;
+
+  /* Ignore the header if we've already encountered some error */
+  if (self->response == NULL)
+    {
+      if (!g_ascii_strcasecmp (field_name, "content-type"))
+        {
+          if (!vsx_parse_content_type (value,
+                                       handle_content_type_cb,
+                                       handle_parameter_cb,
+                                       handler))
+            set_error (self, VSX_STRING_RESPONSE_BAD_REQUEST);
+        }
+      else if (!g_ascii_strcasecmp (field_name,
+                                    "Access-Control-Request-Method"))
+        {
+          if (!self->is_options_request
+              || self->had_request_method
+              || strcmp (value, "POST"))
+            set_error (self, VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST);
+          else
+            self->had_request_method = TRUE;
+        }
+    }
+}
+
+static gboolean
+parse_int (const char *p,
+           const char *end,
+           int *value_out)
+{
+  gboolean negative = FALSE;
+  int value = 0;
+
+  if (p < end && *p == '-')
+    {
+      negative = TRUE;
+      p++;
+    }
+
+  if (p >= end)
+    return FALSE;
+
+  for (; p < end; p++)
+    {
+      if (!g_ascii_isdigit (*p) || value > (G_MAXINT - 9) / 10)
+        return FALSE;
+
+      value = value * 10 + *p - '0';
+    }
+
+  *value_out = negative ? -value : value;
+
+  return TRUE;
+}
+
+static gboolean
+validate_command (const VsxBatchCommand *command)
+{
+  switch (command->type)
+    {
+    case VSX_BATCH_COMMAND_MOVE_TILE:
+      return (command->args[0] >= 0
+              && command->args[0] < VSX_TILE_DATA_N_TILES
+              && command->args[1] >= G_MININT16
+              && command->args[1] <= G_MAXINT16
+              && command->args[2] >= G_MININT16
+              && command->args[2] <= G_MAXINT16);
+
+    case VSX_BATCH_COMMAND_TURN:
+    case VSX_BATCH_COMMAND_SHOUT:
+    case VSX_BATCH_COMMAND_SET_N_TILES:
+    case VSX_BATCH_COMMAND_START_TYPING:
+    case VSX_BATCH_COMMAND_STOP_TYPING:
+    case VSX_BATCH_COMMAND_KEEP_ALIVE:
+      return TRUE;
+    }
+
+  g_warn_if_reached ();
+
+  return FALSE;
+}
+
+static gboolean
+parse_command (VsxBatchHandler *self,
+               const char *line,
+               unsigned int length)
+{
+  const char *line_end = line + length;
+  const char *name_end;
+  VsxBatchCommand *command;
+  int i, arg;
+
+  /* Allow CRLF line endings */
+  if (line_end > line && line_end[-1] == '\r')
+    line_end--;
+
+  /* Ignore empty lines */
+  if (line_end <= line)
+    return TRUE;
+
+  if (self->n_commands >= VSX_BATCH_HANDLER_MAX_COMMANDS)
+    return FALSE;
+
+  name_end = memchr (line, '&', line_end - line);
+
+  if (name_end == NULL)
+    name_end = line_end;
+
+  for (i = 0; i < G_N_ELEMENTS (commands); i++)
+    if (strlen (commands[i].name) == name_end - line
+        && !memcmp (commands[i].name, line, name_end - line))
+      goto found_command;
+
+  return FALSE;
+
+ found_command:
+  command = self->commands + self->n_commands;
+  command->type = commands[i].type;
+
+  for (arg = 0; arg < commands[i].n_args; arg++)
+    {
+      const char *arg_start, *arg_end;
+
+      if (name_end >= line_end)
+        return FALSE;
+
+      arg_start = name_end + 1;
+      arg_end = memchr (arg_start, '&', line_end - arg_start);
+
+      if (arg_end == NULL)
+        arg_end = line_end;
+
+      if (!parse_int (arg_start, arg_end, command->args + arg))
+        return FALSE;
+
+      name_end = arg_end;
+    }
+
+  /* There shouldn't be any extra arguments */
+  if (name_end < line_end || !validate_command (command))
+    return FALSE;
+
+  self->n_commands++;
+
+  return TRUE;
+}
+
+static void
+real_data_received (VsxRequestHandler *handler,
+                    const guint8 *data,
+                    unsigned int length)
+{
+  VsxBatchHandler *self = (VsxBatchHandler *) handler;
+  const guint8 *end = data + length;
+
+  /* Ignore the data if we've already encountered some error */
+  if (self->person == NULL)
+    return;
+
+  while (data < end)
+    {
+      const guint8 *line_end = memchr (data, '\n', end - data);
+      unsigned int line_part_length;
+
+      if (line_end == NULL)
+        line_part_length = end - data;
+      else
+        line_part_length = line_end - data;
+
+      if (self->line_length + line_part_length > sizeof self->line_buffer)
+        {
+          set_error (self, VSX_STRING_RESPONSE_BAD_REQUEST);
+          return;
+        }
+
+      memcpy (self->line_buffer + self->line_length, data, line_part_length);
+      self->line_length += line_part_length;
+
+      if (line_end == NULL)
+        break;
+
+      if (!parse_command (self, self->line_buffer, self->line_length))
+        {
+          set_error (self, VSX_STRING_RESPONSE_BAD_REQUEST);
+          return;
+        }
+
+      self->line_length = 0;
+      data = line_end + 1;
+    }
+}
+
+static void
+apply_command (VsxBatchHandler *self,
+               const VsxBatchCommand *command)
+{
+  VsxConversation *conversation = self->person->conversation;
+  unsigned int player_num = self->person->player->num;
+
+  switch (command->type)
+    {
+    case VSX_BATCH_COMMAND_MOVE_TILE:
+      /* An earlier turn in the same batch might have added the
+       * tile so this can only be checked now. Moves for tiles that
+       * aren't in play are ignored */
+      if (command->args[0] < conversation->n_tiles_in_play)
+        vsx_conversation_move_tile (conversation,
+                                    player_num,
+                                    command->args[0],
+                                    command->args[1],
+                                    command->args[2]);
+      break;
+
+    case VSX_BATCH_COMMAND_TURN:
+      vsx_conversation_turn (conversation, player_num);
+      break;
+
+    case VSX_BATCH_COMMAND_SHOUT:
+      vsx_conversation_shout (conversation, player_num);
+      break;
+
+    case VSX_BATCH_COMMAND_SET_N_TILES:
+      vsx_conversation_set_n_tiles (conversation,
+                                    player_num,
+                                    command->args[0]);
+      break;
+
+    case VSX_BATCH_COMMAND_START_TYPING:
+      vsx_conversation_set_typing (conversation, player_num, TRUE);
+      break;
+
+    case VSX_BATCH_COMMAND_STOP_TYPING:
+      vsx_conversation_set_typing (conversation, player_num, FALSE);
+      break;
+
+    case VSX_BATCH_COMMAND_KEEP_ALIVE:
+      break;
+    }
+}
+
+static VsxResponse *
+real_request_finished (VsxRequestHandler *handler)
+{
+  VsxBatchHandler *self = (VsxBatchHandler *) handler;
+  int i;
+
+  if (self->response)
+    return vsx_object_ref (self->response);
+  else if (self->is_options_request)
+    {
+      if (self->had_request_method)
+        return vsx_string_response_get (VSX_STRING_RESPONSE_PREFLIGHT_POST_OK);
+      else
+        return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
+    }
+  else if (self->person)
+    {
+      /* The last line doesn't need a terminator */
+      if (!parse_command (self, self->line_buffer, self->line_length)
+          || self->person->conversation == NULL)
+        return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
+
+      for (i = 0; i < self->n_commands; i++)
+        apply_command (self, self->commands + i);
+
+      return vsx_string_response_get (VSX_STRING_RESPONSE_OK);
+    }
+  else
+    {
+      g_warn_if_reached ();
+
+      return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
+    }
+}
+
+static const VsxRequestHandlerClass *
+vsx_batch_handler_get_class (void)
+{
+  static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      klass = *vsx_request_handler_get_class ();
+      klass.parent_class.instance_size = sizeof (VsxBatchHandler);
+      klass.parent_class.name = "VsxBatchHandler";
+      klass.parent_class.free = real_free;
+
+      klass.request_line_received = real_request_line_received;
+      klass.header_received = real_header_received;
+      klass.data_received = real_data_received;
+      klass.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return &klass;
+}
+
+VsxRequestHandler *
+vsx_batch_handler_new (void)
+{
+  VsxBatchHandler *handler =
+    vsx_object_allocate (vsx_batch_handler_get_class ());
+
+  vsx_request_handler_init (handler);
+
+  return (VsxRequestHandler *) handler;
+}
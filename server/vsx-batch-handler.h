@@ -0,0 +1,81 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_BATCH_HANDLER_H__
+#define __VSX_BATCH_HANDLER_H__
+
+#include <glib.h>
+
+#include "vsx-request-handler.h"
+#include "vsx-person.h"
+
+G_BEGIN_DECLS
+
+/* Maximum number of commands in a single batch */
+#define VSX_BATCH_HANDLER_MAX_COMMANDS 256
+/* Maximum length of a command line. This is enough for the longest
+   valid command */
+#define VSX_BATCH_HANDLER_MAX_LINE_LENGTH 64
+/* Maximum number of integer arguments to a command */
+#define VSX_BATCH_HANDLER_MAX_ARGS 3
+
+typedef enum
+{
+  VSX_BATCH_COMMAND_MOVE_TILE,
+  VSX_BATCH_COMMAND_TURN,
+  VSX_BATCH_COMMAND_SHOUT,
+  VSX_BATCH_COMMAND_SET_N_TILES,
+  VSX_BATCH_COMMAND_START_TYPING,
+  VSX_BATCH_COMMAND_STOP_TYPING,
+  /* Does nothing. Making any request for the person keeps it alive */
+  VSX_BATCH_COMMAND_KEEP_ALIVE
+} VsxBatchCommandType;
+
+typedef struct
+{
+  VsxBatchCommandType type;
+  int args[VSX_BATCH_HANDLER_MAX_ARGS];
+} VsxBatchCommand;
+
+typedef struct
+{
+  VsxRequestHandler parent;
+
+  gboolean is_options_request;
+  gboolean had_request_method;
+
+  VsxPerson *person;
+
+  VsxResponse *response;
+
+  /* The commands are all parsed as the data arrives and are only
+     applied once the whole request has been received without any
+     errors */
+  char line_buffer[VSX_BATCH_HANDLER_MAX_LINE_LENGTH];
+  unsigned int line_length;
+
+  unsigned int n_commands;
+  VsxBatchCommand commands[VSX_BATCH_HANDLER_MAX_COMMANDS];
+} VsxBatchHandler;
+
+VsxRequestHandler *
+vsx_batch_handler_new (void);
+
+G_END_DECLS
+
+#endif /* __VSX_BATCH_HANDLER_H__ */
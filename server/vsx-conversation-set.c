@@ -101,12 +101,16 @@ static const VsxObjectClass *
 vsx_conversation_set_get_class (void)
 {
   static VsxObjectClass klass;
+  static gsize initialized = 0;
 
-  if (klass.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_object_get_class ();
       klass.instance_size = sizeof (VsxConversationSet);
+      klass.name = "VsxConversationSet";
       klass.free = vsx_conversation_set_free;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
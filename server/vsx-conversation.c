@@ -25,13 +25,29 @@
 #include <string.h>
 
 #include "vsx-conversation.h"
+#include "vsx-format.h"
 #include "vsx-main-context.h"
 #include "vsx-log.h"
 
 #define VSX_CONVERSATION_CENTER_X (600 / 2 - VSX_TILE_SIZE / 2)
 #define VSX_CONVERSATION_CENTER_Y (360 / 2 - VSX_TILE_SIZE / 2)
 
-static guint16 next_id = 0;
+/* This is shared between all of the server workers so it is updated
+   atomically */
+static volatile gint next_id = 0;
+
+/* These are set once at startup before any of the workers are
+   started */
+static unsigned int default_flush_window = 0;
+static unsigned int max_history_messages = 256;
+/* Size of the history buffer for each encoding */
+static unsigned int history_buffer_size =
+  64 * 1024 / VSX_FORMAT_N_ENCODINGS;
+
+/* Enough space to log a change to everything at once */
+#define VSX_CONVERSATION_MAX_FLUSH_LENGTH                       \
+  ((1 + VSX_CONVERSATION_MAX_PLAYERS + VSX_TILE_DATA_N_TILES) *   \
+   VSX_FORMAT_MAX_EVENT_LENGTH)
 
 static void
 vsx_conversation_free (void *object)
@@ -41,18 +57,19 @@ vsx_conversation_free (void *object)
 
   vsx_log ("Game %i destroyed", self->id);
 
-  for (i = 0; i < self->messages->len; i++)
-    {
-      VsxConversationMessage *message = &g_array_index (self->messages,
-                                                        VsxConversationMessage,
-                                                        i);
-      g_free (message->text);
-    }
-
   for (i = 0; i < self->n_players; i++)
     vsx_player_free (self->players[i]);
 
-  g_array_free (self->messages, TRUE);
+  g_free (self->messages);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    g_free (self->history_buffers[i].data);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    g_byte_array_free (self->logs[i].data, TRUE);
+
+  if (self->flush_source)
+    vsx_main_context_remove_source (self->flush_source);
 
   vsx_object_get_class ()->free (object);
 }
@@ -61,17 +78,105 @@ static const VsxObjectClass *
 vsx_conversation_get_class (void)
 {
   static VsxObjectClass klass;
+  static gsize initialized = 0;
 
-  if (klass.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_object_get_class ();
       klass.instance_size = sizeof (VsxConversation);
+      klass.name = "VsxConversation";
       klass.free = vsx_conversation_free;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
 }
 
+static void
+compact_log (VsxConversationLog *log)
+{
+  guint64 log_end = log->start + log->data->len;
+  guint64 cut = log->start;
+  guint64 new_start = log_end;
+  VsxConversationLogReader *reader;
+
+  /* If the log has grown too big then the readers that are too far
+   * behind lose their place */
+  if (log->data->len >= VSX_CONVERSATION_MAX_LOG_SIZE)
+    cut = log_end - VSX_CONVERSATION_MAX_LOG_SIZE / 2;
+
+  vsx_list_for_each (reader, &log->readers, link)
+    {
+      if (reader->pos >= cut && reader->pos < new_start)
+        new_start = reader->pos;
+    }
+
+  /* Only move the data once at least half of it is unused so that
+   * the cost is amortised over the events */
+  if ((new_start - log->start) * 2 < log->data->len)
+    return;
+
+  g_byte_array_remove_range (log->data, 0, new_start - log->start);
+  log->start = new_start;
+}
+
+static gboolean
+has_log_readers (VsxConversation *conversation)
+{
+  int i;
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      if (!vsx_list_empty (&conversation->logs[i].readers))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Logs data that is already framed as a chunk */
+static void
+log_framed_chunk (VsxConversation *conversation,
+                  VsxFormatEncoding encoding,
+                  const char *data,
+                  unsigned int length)
+{
+  VsxConversationLog *log = conversation->logs + encoding;
+
+  if (vsx_list_empty (&log->readers))
+    return;
+
+  compact_log (log);
+
+  g_byte_array_append (log->data, (const guint8 *) data, length);
+}
+
+static void
+log_chunk (VsxConversation *conversation,
+           VsxFormatEncoding encoding,
+           const char *data,
+           unsigned int length)
+{
+  VsxConversationLog *log = conversation->logs + encoding;
+  char length_buf[VSX_FORMAT_MAX_CHUNK_HEADER_LENGTH];
+  char *length_end;
+
+  /* Nothing needs the events if no one is watching */
+  if (vsx_list_empty (&log->readers))
+    return;
+
+  compact_log (log);
+
+  length_end = vsx_format_chunk_header (length_buf, length);
+
+  g_byte_array_append (log->data,
+                       (const guint8 *) length_buf,
+                       length_end - length_buf);
+  g_byte_array_append (log->data, (const guint8 *) data, length);
+  g_byte_array_append (log->data, (const guint8 *) "\r\n", 2);
+}
+
 static void
 vsx_conversation_changed (VsxConversation *conversation,
                           VsxConversationChangedType type)
@@ -84,6 +189,121 @@ vsx_conversation_changed (VsxConversation *conversation,
   vsx_signal_emit (&conversation->changed_signal, &data);
 }
 
+/* Logs all of the pending changes in a single chunk in each encoding
+ * that has readers */
+static void
+log_pending_events (VsxConversation *conversation)
+{
+  char buf[VSX_CONVERSATION_MAX_FLUSH_LENGTH];
+  guint8 players[VSX_CONVERSATION_MAX_PLAYERS];
+  guint8 tiles[VSX_TILE_DATA_N_TILES];
+  int n_players = 0, n_tiles = 0;
+  gboolean n_tiles_changed = conversation->pending_n_tiles;
+  char *end;
+  int encoding, i;
+
+  /* The changes get a version even if no one is watching so that
+   * clients that reconnect later will still receive them */
+  if (n_tiles_changed)
+    {
+      conversation->n_tiles_version = ++conversation->version;
+      conversation->pending_n_tiles = FALSE;
+    }
+
+  while (VSX_SUMMARY_FLAGS_COUNT (conversation->pending_players) > 0)
+    {
+      int num =
+        VSX_SUMMARY_FLAGS_FIND_FIRST_BIT (conversation->pending_players);
+
+      VSX_SUMMARY_FLAGS_SET (conversation->pending_players, num, FALSE);
+      conversation->player_versions[num] = ++conversation->version;
+      players[n_players++] = num;
+    }
+
+  while (VSX_SUMMARY_FLAGS_COUNT (conversation->pending_tiles) > 0)
+    {
+      int num = VSX_SUMMARY_FLAGS_FIND_FIRST_BIT (conversation->pending_tiles);
+
+      VSX_SUMMARY_FLAGS_SET (conversation->pending_tiles, num, FALSE);
+      conversation->tile_versions[num] = ++conversation->version;
+      tiles[n_tiles++] = num;
+    }
+
+  for (encoding = 0; encoding < VSX_FORMAT_N_ENCODINGS; encoding++)
+    {
+      const VsxFormatEncoder *encoder = vsx_format_encoders + encoding;
+
+      if (vsx_list_empty (&conversation->logs[encoding].readers))
+        continue;
+
+      end = buf;
+
+      if (n_tiles_changed)
+        end = encoder->n_tiles_event (end, conversation->total_n_tiles);
+
+      for (i = 0; i < n_players; i++)
+        end = encoder->player_event (end,
+                                     players[i],
+                                     conversation->players[players[i]]->flags);
+
+      for (i = 0; i < n_tiles; i++)
+        {
+          const VsxTile *tile = conversation->tiles + tiles[i];
+
+          end = encoder->tile_event (end,
+                                     tiles[i],
+                                     tile->x,
+                                     tile->y,
+                                     tile->letter,
+                                     tile->last_player);
+        }
+
+      /* The clients split the events by line or by their length so
+       * they can all go in a single chunk */
+      if (end > buf)
+        log_chunk (conversation, encoding, buf, end - buf);
+    }
+}
+
+static void
+flush_pending_events (VsxConversation *conversation)
+{
+  log_pending_events (conversation);
+
+  vsx_conversation_changed (conversation, VSX_CONVERSATION_EVENTS_FLUSHED);
+}
+
+static void
+flush_timer_cb (VsxMainContextSource *source,
+                void *user_data)
+{
+  VsxConversation *conversation = user_data;
+
+  vsx_main_context_remove_source (source);
+  conversation->flush_source = NULL;
+
+  flush_pending_events (conversation);
+}
+
+/* Returns TRUE if the change should be collected until the flush
+ * window closes instead of being logged now */
+static gboolean
+defer_change (VsxConversation *conversation)
+{
+  if (conversation->flush_window <= 0 ||
+      !has_log_readers (conversation))
+    return FALSE;
+
+  if (conversation->flush_source == NULL)
+    conversation->flush_source =
+      vsx_main_context_add_timer (NULL, /* default context */
+                                  conversation->flush_window,
+                                  flush_timer_cb,
+                                  conversation);
+
+  return TRUE;
+}
+
 static void
 vsx_conversation_player_changed (VsxConversation *conversation,
                                  VsxPlayer *player)
@@ -94,6 +314,11 @@ vsx_conversation_player_changed (VsxConversation *conversation,
   data.type = VSX_CONVERSATION_PLAYER_CHANGED;
   data.num = player->num;
 
+  VSX_SUMMARY_FLAGS_SET (conversation->pending_players, player->num, TRUE);
+
+  if (!defer_change (conversation))
+    log_pending_events (conversation);
+
   vsx_signal_emit (&conversation->changed_signal, &data);
 }
 
@@ -107,6 +332,11 @@ vsx_conversation_tile_changed (VsxConversation *conversation,
   data.type = VSX_CONVERSATION_TILE_CHANGED;
   data.num = tile - conversation->tiles;
 
+  VSX_SUMMARY_FLAGS_SET (conversation->pending_tiles, data.num, TRUE);
+
+  if (!defer_change (conversation))
+    log_pending_events (conversation);
+
   vsx_signal_emit (&conversation->changed_signal, &data);
 }
 
@@ -126,26 +356,12 @@ vsx_conversation_start (VsxConversation *conversation)
     }
 }
 
-void
-vsx_conversation_add_message (VsxConversation *conversation,
-                              unsigned int player_num,
-                              const char *buffer,
-                              unsigned int length)
+static GString *
+make_json_message (unsigned int player_num,
+                   const char *buffer,
+                   unsigned int length)
 {
-  VsxConversationMessage *message;
-  GString *message_str;
-
-  /* Ignore attempts to add messages for a player that has left */
-  if (!vsx_player_is_connected (conversation->players[player_num]))
-    return;
-
-  g_array_set_size (conversation->messages,
-                    conversation->messages->len + 1);
-  message = &g_array_index (conversation->messages,
-                            VsxConversationMessage,
-                            conversation->messages->len - 1);
-
-  message_str = g_string_sized_new (length + 32);
+  GString *message_str = g_string_sized_new (length + 32);
 
   g_string_append_printf (message_str,
                           "[\"message\", {\"person\": %u, "
@@ -169,8 +385,188 @@ vsx_conversation_add_message (VsxConversation *conversation,
     }
   g_string_append (message_str, "\"}]\r\n");
 
-  message->length = message_str->len;
-  message->text = g_string_free (message_str, FALSE);
+  return message_str;
+}
+
+static GString *
+make_binary_message (unsigned int player_num,
+                     const char *buffer,
+                     unsigned int length)
+{
+  GString *message_str = g_string_sized_new (length + 16);
+  char start_buf[VSX_FORMAT_MAX_BINARY_EVENT_START_LENGTH];
+  char *start_end;
+
+  start_end = vsx_format_binary_event_start (start_buf,
+                                             VSX_FORMAT_BINARY_MESSAGE,
+                                             length + 1);
+  g_string_append_len (message_str, start_buf, start_end - start_buf);
+  g_string_append_c (message_str, player_num);
+
+  while (length-- > 0)
+    {
+      /* Replace any control characters or spaces with a space */
+      if ((guint8) *buffer <= ' ')
+        g_string_append_c (message_str, ' ');
+      else
+        g_string_append_c (message_str, *buffer);
+
+      buffer++;
+    }
+
+  return message_str;
+}
+
+static VsxConversationMessage *
+get_history_message (VsxConversation *conversation,
+                     unsigned int num)
+{
+  return conversation->messages + num % max_history_messages;
+}
+
+/* Returns the position where an event of the given length would be
+ * added to the history buffer so that it doesn't wrap around */
+static guint64
+get_history_pos (const VsxConversationHistoryBuffer *buffer,
+                 unsigned int length)
+{
+  unsigned int offset = buffer->end % history_buffer_size;
+
+  if (offset + length > history_buffer_size)
+    return buffer->end + history_buffer_size - offset;
+  else
+    return buffer->end;
+}
+
+static gboolean
+history_has_space (VsxConversation *conversation,
+                   GString **events)
+{
+  const VsxConversationMessage *first;
+  int i;
+
+  if (conversation->n_messages - conversation->first_message >=
+      max_history_messages)
+    return FALSE;
+
+  /* If the history is empty then any event will fit */
+  if (conversation->n_messages <= conversation->first_message)
+    return TRUE;
+
+  first = get_history_message (conversation, conversation->first_message);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      const VsxConversationHistoryBuffer *buffer =
+        conversation->history_buffers + i;
+      guint64 end = get_history_pos (buffer, events[i]->len) + events[i]->len;
+
+      if (end - first->encoded[i].pos > history_buffer_size)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+add_to_history (VsxConversation *conversation,
+                GString **events)
+{
+  VsxConversationMessage *message;
+  int i;
+
+  if (conversation->messages == NULL)
+    {
+      conversation->messages = g_new (VsxConversationMessage,
+                                      max_history_messages);
+
+      for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+        conversation->history_buffers[i].data =
+          g_malloc (history_buffer_size);
+    }
+
+  /* Discard the oldest messages until there is room for the new
+   * one. Any watchers that haven't sent them yet will get a
+   * "messages-truncated" event instead */
+  while (!history_has_space (conversation, events))
+    conversation->first_message++;
+
+  message = get_history_message (conversation, conversation->n_messages);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      VsxConversationHistoryBuffer *buffer =
+        conversation->history_buffers + i;
+      guint64 pos = get_history_pos (buffer, events[i]->len);
+
+      memcpy (buffer->data + pos % history_buffer_size,
+              events[i]->str,
+              events[i]->len);
+
+      message->encoded[i].pos = pos;
+      message->encoded[i].length = events[i]->len;
+      buffer->end = pos + events[i]->len;
+    }
+
+  conversation->n_messages++;
+}
+
+void
+vsx_conversation_get_message (VsxConversation *conversation,
+                              unsigned int num,
+                              VsxFormatEncoding encoding,
+                              const guint8 **data,
+                              unsigned int *length)
+{
+  const VsxConversationMessage *message;
+
+  g_return_if_fail (num >= conversation->first_message &&
+                    num < conversation->n_messages);
+
+  message = get_history_message (conversation, num);
+
+  *data = (conversation->history_buffers[encoding].data +
+           message->encoded[encoding].pos % history_buffer_size);
+  *length = message->encoded[encoding].length;
+}
+
+void
+vsx_conversation_add_message (VsxConversation *conversation,
+                              unsigned int player_num,
+                              const char *buffer,
+                              unsigned int length)
+{
+  GString *events[VSX_FORMAT_N_ENCODINGS];
+  int i;
+
+  /* Ignore attempts to add messages for a player that has left */
+  if (!vsx_player_is_connected (conversation->players[player_num]))
+    return;
+
+  /* Cut long messages short without splitting a character so that
+   * any message will fit in the history */
+  if (length > VSX_CONVERSATION_MAX_MESSAGE_LENGTH)
+    {
+      length = VSX_CONVERSATION_MAX_MESSAGE_LENGTH;
+
+      while (length > 0 && ((guint8) buffer[length] & 0xc0) == 0x80)
+        length--;
+    }
+
+  events[VSX_FORMAT_ENCODING_JSON] =
+    make_json_message (player_num, buffer, length);
+  events[VSX_FORMAT_ENCODING_BINARY] =
+    make_binary_message (player_num, buffer, length);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    /* Add the chunk framing so that the message can be sent to each
+     * watcher with a single copy */
+    vsx_format_frame_chunk (events[i]);
+
+  add_to_history (conversation, events);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    g_string_free (events[i], TRUE);
 
   vsx_conversation_changed (conversation,
                             VSX_CONVERSATION_MESSAGE_ADDED);
@@ -285,6 +681,7 @@ vsx_conversation_add_player (VsxConversation *conversation,
                              const char *player_name)
 {
   VsxPlayer *player;
+  int i;
 
   g_assert_cmpint (conversation->n_players, <, VSX_CONVERSATION_MAX_PLAYERS);
 
@@ -294,6 +691,15 @@ vsx_conversation_add_player (VsxConversation *conversation,
   conversation->n_players++;
   conversation->n_connected_players++;
 
+  /* The name has to be logged before the player's flags so that
+   * clients know who the player is */
+  conversation->player_name_versions[player->num] = ++conversation->version;
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    log_framed_chunk (conversation,
+                      i,
+                      player->name_message[i],
+                      player->name_message_len[i]);
+
   vsx_conversation_player_changed (conversation, player);
 
   /* If we've reached the maximum number of players then we'll
@@ -345,6 +751,23 @@ shuffle_tiles (VsxConversation *self)
     }
 }
 
+void
+vsx_conversation_set_default_flush_window (unsigned int milliseconds)
+{
+  default_flush_window = milliseconds;
+}
+
+void
+vsx_conversation_set_history_limits (unsigned int max_messages,
+                                     unsigned int budget)
+{
+  g_return_if_fail (max_messages >= 1);
+  g_return_if_fail (budget >= VSX_CONVERSATION_MIN_MESSAGE_BUDGET);
+
+  max_history_messages = max_messages;
+  history_buffer_size = budget / VSX_FORMAT_N_ENCODINGS;
+}
+
 VsxConversation *
 vsx_conversation_new (const char *room_name)
 {
@@ -355,16 +778,35 @@ vsx_conversation_new (const char *room_name)
 
   vsx_object_init (self);
 
-  self->id = next_id++;
+  self->id = (guint16) g_atomic_int_add (&next_id, 1);
   self->n_tiles_in_play = 0;
   self->total_n_tiles = VSX_TILE_DATA_N_TILES;
 
   vsx_signal_init (&self->changed_signal);
 
-  self->messages = g_array_new (FALSE, FALSE, sizeof (VsxConversationMessage));
+  self->n_messages = 0;
+  self->first_message = 0;
+  self->messages = NULL;
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      self->history_buffers[i].data = NULL;
+      self->history_buffers[i].end = 0;
+    }
+
+  self->flush_window = default_flush_window;
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      self->logs[i].data = g_byte_array_new ();
+      self->logs[i].start = 0;
+      vsx_list_init (&self->logs[i].readers);
+    }
 
   self->state = VSX_CONVERSATION_AWAITING_START;
 
+  vsx_tile_grid_init (&self->tile_grid);
+
   /* Initialise the tile data with the letters */
   t = tile_data->letters;
   for (i = 0; i < VSX_TILE_DATA_N_TILES; i++)
@@ -410,31 +852,14 @@ vsx_conversation_set_n_tiles (VsxConversation *conversation,
   if (n_tiles != conversation->total_n_tiles)
     {
       conversation->total_n_tiles = n_tiles;
-      vsx_conversation_changed (conversation,
-                                VSX_CONVERSATION_N_TILES_CHANGED);
-    }
-}
-
-static gboolean
-try_location (VsxConversation *conversation,
-              int x,
-              int y)
-{
-  int i;
+      conversation->pending_n_tiles = TRUE;
 
-  /* Check if this position would overlap any existing tiles */
-  for (i = 0; i < conversation->n_tiles_in_play; i++)
-    {
-      const VsxTile *tile = conversation->tiles + i;
+      if (!defer_change (conversation))
+        log_pending_events (conversation);
 
-      if (x + VSX_TILE_SIZE > tile->x &&
-          x < tile->x + VSX_TILE_SIZE &&
-          y + VSX_TILE_SIZE > tile->y &&
-          y < tile->y + VSX_TILE_SIZE)
-        return FALSE;
+      vsx_conversation_changed (conversation,
+                                VSX_CONVERSATION_N_TILES_CHANGED);
     }
-
-  return TRUE;
 }
 
 static void
@@ -457,7 +882,10 @@ find_free_location (VsxConversation *conversation,
               int try_y = (y * sign_y * (VSX_TILE_SIZE + VSX_TILE_GAP) +
                            VSX_CONVERSATION_CENTER_Y);
 
-              if (try_location (conversation, try_x, try_y))
+              if (vsx_tile_grid_is_free (&conversation->tile_grid,
+                                         conversation->tiles,
+                                         try_x,
+                                         try_y))
                 {
                   *x_out = try_x;
                   *y_out = try_y;
@@ -505,6 +933,10 @@ vsx_conversation_turn (VsxConversation *conversation,
 
   find_free_location (conversation, &tile->x, &tile->y);
 
+  vsx_tile_grid_add (&conversation->tile_grid,
+                     conversation->tiles,
+                     conversation->n_tiles_in_play);
+
   conversation->n_tiles_in_play++;
 
   /* Once the first tile is flipped the game is considered to be
@@ -538,6 +970,9 @@ vsx_conversation_move_tile (VsxConversation *conversation,
       tile->x = x;
       tile->y = y;
       tile->last_player = player_num;
+      vsx_tile_grid_update (&conversation->tile_grid,
+                            conversation->tiles,
+                            tile_num);
       vsx_conversation_tile_changed (conversation, tile);
     }
 }
@@ -548,6 +983,9 @@ vsx_conversation_shout (VsxConversation *conversation,
 {
   VsxPlayer *player = conversation->players[player_num];
   VsxConversationChangedData data;
+  char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
+  char *end;
+  int i;
 
   /* Ignore attempts to shout for a player that has left */
   if (!vsx_player_is_connected (player))
@@ -563,5 +1001,110 @@ vsx_conversation_shout (VsxConversation *conversation,
   data.type = VSX_CONVERSATION_SHOUTED;
   data.num = player_num;
 
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    {
+      if (vsx_list_empty (&conversation->logs[i].readers))
+        continue;
+
+      end = vsx_format_encoders[i].shout_event (buf, player_num);
+      log_chunk (conversation, i, buf, end - buf);
+    }
+
   vsx_signal_emit (&conversation->changed_signal, &data);
 }
+
+void
+vsx_conversation_add_log_reader (VsxConversation *conversation,
+                                 VsxConversationLogReader *reader)
+{
+  VsxConversationLog *log = conversation->logs + reader->encoding;
+
+  /* Readers only see events logged after they are added. Any state
+   * from before that has to be sent separately */
+  reader->pos = log->start + log->data->len;
+  vsx_list_insert (&log->readers, &reader->link);
+}
+
+void
+vsx_conversation_remove_log_reader (VsxConversation *conversation,
+                                    VsxConversationLogReader *reader)
+{
+  VsxConversationLog *log = conversation->logs + reader->encoding;
+
+  vsx_list_remove (&reader->link);
+
+  if (vsx_list_empty (&log->readers))
+    {
+      log->start += log->data->len;
+      g_byte_array_set_size (log->data, 0);
+    }
+}
+
+/* Moves a reader that has lost its place to the end of the log */
+void
+vsx_conversation_reset_log_reader (VsxConversation *conversation,
+                                   VsxConversationLogReader *reader)
+{
+  VsxConversationLog *log = conversation->logs + reader->encoding;
+
+  reader->pos = log->start + log->data->len;
+}
+
+static unsigned int
+get_event_length (const guint8 *data)
+{
+  char *end;
+  unsigned int length;
+
+  /* Each event is an HTTP chunk so it begins with its length in hex
+   * followed by \r\n and the data is followed by another \r\n */
+  length = g_ascii_strtoull ((const char *) data, &end, 16);
+
+  return end - (const char *) data + 2 + length + 2;
+}
+
+/* Gets the events after the reader's position. Only whole events are
+ * returned, up to max_length bytes, so that the reader always stays
+ * at the start of an event. If the first event is bigger than
+ * max_length then it is returned on its own anyway so that the
+ * reader can always make progress. Returns FALSE if the reader has
+ * lost its place because it fell too far behind. */
+gboolean
+vsx_conversation_read_log (VsxConversation *conversation,
+                           const VsxConversationLogReader *reader,
+                           unsigned int max_length,
+                           const guint8 **data_out,
+                           unsigned int *length_out)
+{
+  const VsxConversationLog *log = conversation->logs + reader->encoding;
+  const guint8 *data;
+  unsigned int available, length;
+
+  if (reader->pos < log->start)
+    return FALSE;
+
+  data = log->data->data + (reader->pos - log->start);
+  available = log->data->len - (reader->pos - log->start);
+
+  if (available <= max_length)
+    length = available;
+  else
+    {
+      length = 0;
+
+      while (length < available)
+        {
+          unsigned int event_length = get_event_length (data + length);
+
+          if (length > 0 && length + event_length > max_length)
+            break;
+
+          length += event_length;
+        }
+    }
+
+  *data_out = data;
+  *length_out = length;
+
+  return TRUE;
+}
@@ -25,6 +25,10 @@
 #include "vsx-signal.h"
 #include "vsx-object.h"
 #include "vsx-tile-data.h"
+#include "vsx-tile-grid.h"
+#include "vsx-flags.h"
+#include "vsx-main-context.h"
+#include "vsx-format.h"
 
 G_BEGIN_DECLS
 
@@ -34,6 +38,70 @@ G_BEGIN_DECLS
  * to shout again */
 #define VSX_CONVERSATION_SHOUT_TIME (10 * G_USEC_PER_SEC)
 
+/* Maximum number of bytes of the event log to keep for readers that
+ * are lagging behind. Readers that fall further behind than this lose
+ * their position and have to send the whole state again */
+#define VSX_CONVERSATION_MAX_LOG_SIZE (64 * 1024)
+
+/* Maximum number of bytes of text in a chat message. Longer messages
+ * are cut short */
+#define VSX_CONVERSATION_MAX_MESSAGE_LENGTH 1000
+/* Maximum size of a framed "message" event in any encoding. In the
+ * worst case every character of the text is escaped in JSON */
+#define VSX_CONVERSATION_MAX_MESSAGE_EVENT_LENGTH       \
+  (VSX_CONVERSATION_MAX_MESSAGE_LENGTH * 2 + 64)
+/* The smallest message budget that can hold at least one message */
+#define VSX_CONVERSATION_MIN_MESSAGE_BUDGET             \
+  (VSX_CONVERSATION_MAX_MESSAGE_EVENT_LENGTH * VSX_FORMAT_N_ENCODINGS)
+
+typedef struct
+{
+  /* Position of the "message" event for each encoding in the
+   * corresponding history buffer and its length. The events are
+   * already wrapped in an HTTP chunk so that they can be sent to
+   * clients without any further formatting */
+  struct
+  {
+    guint64 pos;
+    unsigned int length;
+  } encoded[VSX_FORMAT_N_ENCODINGS];
+} VsxConversationMessage;
+
+typedef struct
+{
+  /* Ring buffer of message events. Each event is contiguous so if one
+     doesn't fit before the end of the buffer it is put at the start
+     instead. This is allocated when the first message is added */
+  guint8 *data;
+  /* Absolute position after the end of the last event */
+  guint64 end;
+} VsxConversationHistoryBuffer;
+
+typedef struct
+{
+  VsxList link;
+
+  /* Which of the conversation's logs to read. This must be set
+     before the reader is added */
+  VsxFormatEncoding encoding;
+
+  /* Position in the event log counted from the first event that was
+     ever logged in the conversation. This is always at the start of
+     an event */
+  guint64 pos;
+} VsxConversationLogReader;
+
+typedef struct
+{
+  /* Serialized chunks for every change since the position of the
+     slowest reader */
+  GByteArray *data;
+  /* Absolute position of the first byte of data */
+  guint64 start;
+  /* List of VsxConversationLogReaders */
+  VsxList readers;
+} VsxConversationLog;
+
 typedef struct
 {
   VsxObject parent;
@@ -46,7 +114,18 @@ typedef struct
     VSX_CONVERSATION_IN_PROGRESS
   } state;
 
-  GArray *messages;
+  /* Only the most recent messages are kept so that the memory used
+     by a room is bounded. The messages are numbered from the start
+     of the conversation. n_messages is the number that have ever
+     been added and first_message is the number of the oldest message
+     that is still kept */
+  unsigned int n_messages;
+  unsigned int first_message;
+  /* Ring of the kept messages. Message n is stored at index n modulo
+     the maximum number of messages. This is allocated along with the
+     history buffers */
+  VsxConversationMessage *messages;
+  VsxConversationHistoryBuffer history_buffers[VSX_FORMAT_N_ENCODINGS];
 
   int n_players;
   int n_connected_players;
@@ -57,18 +136,44 @@ typedef struct
   /* Total number of tiles that will be used */
   int total_n_tiles;
   VsxTile tiles[VSX_TILE_DATA_N_TILES];
+  /* Index of the positions of the tiles in play so that finding a
+     free place for a new tile doesn't have to check every tile */
+  VsxTileGrid tile_grid;
 
   gint64 last_shout_time;
 
+  /* Version number of the state of the players and tiles. This is
+     incremented every time a change to them is logged so that a
+     client that reconnects can ask for only what changed after the
+     last version it saw */
+  unsigned int version;
+  /* Version of the last change to each part of the state. Tiles that
+     aren't in play yet have version zero */
+  unsigned int n_tiles_version;
+  unsigned int player_name_versions[VSX_CONVERSATION_MAX_PLAYERS];
+  unsigned int player_versions[VSX_CONVERSATION_MAX_PLAYERS];
+  unsigned int tile_versions[VSX_TILE_DATA_N_TILES];
+
+  /* An event log for each encoding. These are shared by all of the
+     watchers so that each event is only formatted once per encoding.
+     Nothing is logged in an encoding that no one is reading */
+  VsxConversationLog logs[VSX_FORMAT_N_ENCODINGS];
+
+  /* Time in milliseconds to collect changes to the players and tiles
+     before logging them. If this is zero they are logged
+     immediately */
+  unsigned int flush_window;
+  /* Changes that haven't been logged yet because the flush window is
+     open. Multiple changes to the same thing are only logged once
+     and they all go in one chunk */
+  gboolean pending_n_tiles;
+  VSX_SUMMARY_FLAGS (VSX_CONVERSATION_MAX_PLAYERS) pending_players;
+  VSX_SUMMARY_FLAGS (VSX_TILE_DATA_N_TILES) pending_tiles;
+  VsxMainContextSource *flush_source;
+
   int id;
 } VsxConversation;
 
-typedef struct
-{
-  unsigned int length;
-  char *text;
-} VsxConversationMessage;
-
 typedef enum
 {
   VSX_CONVERSATION_STATE_CHANGED,
@@ -76,7 +181,9 @@ typedef enum
   VSX_CONVERSATION_MESSAGE_ADDED,
   VSX_CONVERSATION_PLAYER_CHANGED,
   VSX_CONVERSATION_TILE_CHANGED,
-  VSX_CONVERSATION_SHOUTED
+  VSX_CONVERSATION_SHOUTED,
+  /* Changes collected during the flush window have been logged */
+  VSX_CONVERSATION_EVENTS_FLUSHED
 } VsxConversationChangedType;
 
 typedef struct
@@ -86,6 +193,17 @@ typedef struct
   int num;
 } VsxConversationChangedData;
 
+void
+vsx_conversation_set_default_flush_window (unsigned int milliseconds);
+
+/* Sets how much of the message history each conversation keeps. The
+   budget is the number of bytes to use for all of the encodings and
+   must be at least VSX_CONVERSATION_MIN_MESSAGE_BUDGET. This must be
+   called before any conversations are created */
+void
+vsx_conversation_set_history_limits (unsigned int max_messages,
+                                     unsigned int budget);
+
 VsxConversation *
 vsx_conversation_new (const char *room_name);
 
@@ -103,6 +221,17 @@ vsx_conversation_add_message (VsxConversation *conversation,
                               const char *buffer,
                               unsigned int length);
 
+/* Gets the framed "message" event for a message that is still in the
+   history. num must be at least first_message and less than
+   n_messages. The data is only valid until the next message is
+   added */
+void
+vsx_conversation_get_message (VsxConversation *conversation,
+                              unsigned int num,
+                              VsxFormatEncoding encoding,
+                              const guint8 **data,
+                              unsigned int *length);
+
 void
 vsx_conversation_set_typing (VsxConversation *conversation,
                              unsigned int player_num,
@@ -131,6 +260,34 @@ void
 vsx_conversation_turn (VsxConversation *conversation,
                        unsigned int player_num);
 
+void
+vsx_conversation_add_log_reader (VsxConversation *conversation,
+                                 VsxConversationLogReader *reader);
+
+void
+vsx_conversation_remove_log_reader (VsxConversation *conversation,
+                                    VsxConversationLogReader *reader);
+
+void
+vsx_conversation_reset_log_reader (VsxConversation *conversation,
+                                   VsxConversationLogReader *reader);
+
+static inline gboolean
+vsx_conversation_log_has_data (const VsxConversation *conversation,
+                               const VsxConversationLogReader *reader)
+{
+  const VsxConversationLog *log = conversation->logs + reader->encoding;
+
+  return reader->pos < log->start + log->data->len;
+}
+
+gboolean
+vsx_conversation_read_log (VsxConversation *conversation,
+                           const VsxConversationLogReader *reader,
+                           unsigned int max_length,
+                           const guint8 **data_out,
+                           unsigned int *length_out);
+
 G_END_DECLS
 
 #endif /* __VSX_CONVERSATION_H__ */
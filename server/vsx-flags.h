@@ -139,6 +139,88 @@ vsx_flags_find_first_bit (const unsigned long *array)
 #define VSX_FLAGS_FOREACH_END                   \
   } } } G_STMT_END
 
+/* A fixed-size array of bits with a summary so that checking whether
+ * any bit is set and finding the first set bit take constant time
+ * regardless of the size. Bit n of the summary word is set whenever
+ * long n of the array is non-zero, so the array can be at most
+ * VSX_SUMMARY_FLAGS_MAX_SIZE bits long. The bits should only be
+ * modified with the functions below so that the summary stays
+ * correct. It should be declared like this:
+ *
+ * VSX_SUMMARY_FLAGS (N_FEATURES) feature_flags;
+ *
+ * and must be zero-initialised.
+ */
+
+#define VSX_SUMMARY_FLAGS_MAX_SIZE                      \
+  (sizeof (unsigned long) * 8 * sizeof (unsigned long) * 8)
+
+typedef struct
+{
+  unsigned long mask;
+  /* Total number of bits that are set */
+  unsigned int n_set;
+} VsxSummaryFlags;
+
+#define VSX_SUMMARY_FLAGS(size)                                 \
+  struct                                                        \
+  {                                                             \
+    VsxSummaryFlags summary;                                    \
+    unsigned long bits[VSX_FLAGS_N_LONGS_FOR_SIZE (size)];      \
+  }
+
+static inline void
+vsx_summary_flags_set (VsxSummaryFlags *summary,
+                       unsigned long *array,
+                       int flag,
+                       gboolean value)
+{
+  int index = VSX_FLAGS_GET_INDEX (flag);
+  unsigned long old_bits = array[index];
+  unsigned long new_bits;
+
+  if (value)
+    new_bits = old_bits | VSX_FLAGS_GET_MASK (flag);
+  else
+    new_bits = old_bits & ~VSX_FLAGS_GET_MASK (flag);
+
+  array[index] = new_bits;
+
+  summary->n_set += (__builtin_popcountl (new_bits) -
+                     __builtin_popcountl (old_bits));
+
+  if (new_bits)
+    summary->mask |= 1UL << index;
+  else
+    summary->mask &= ~(1UL << index);
+}
+
+/* There must be at least one bit set */
+static inline int
+vsx_summary_flags_find_first_bit (const VsxSummaryFlags *summary,
+                                  const unsigned long *array)
+{
+  int index = __builtin_ctzl (summary->mask);
+
+  return (index * sizeof (unsigned long) * 8 +
+          __builtin_ctzl (array[index]));
+}
+
+#define VSX_SUMMARY_FLAGS_GET(flags, flag)      \
+  VSX_FLAGS_GET ((flags).bits, (flag))
+
+#define VSX_SUMMARY_FLAGS_SET(flags, flag, value)       \
+  vsx_summary_flags_set (&(flags).summary,              \
+                         (flags).bits,                  \
+                         (flag),                        \
+                         (value))
+
+#define VSX_SUMMARY_FLAGS_COUNT(flags)          \
+  ((flags).summary.n_set)
+
+#define VSX_SUMMARY_FLAGS_FIND_FIRST_BIT(flags)                 \
+  vsx_summary_flags_find_first_bit (&(flags).summary, (flags).bits)
+
 G_END_DECLS
 
 #endif /* __VSX_FLAGS_H */
@@ -0,0 +1,416 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+#include "vsx-format.h"
+
+static const char
+digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const char
+lower_hex_digits[] = "0123456789abcdef";
+
+static const char
+upper_hex_digits[] = "0123456789ABCDEF";
+
+static int
+count_digits (unsigned int value)
+{
+  /* The first entry is zero so that zero counts as one digit */
+  static const unsigned int powers_of_ten[] =
+    {
+      0, 10, 100, 1000, 10000, 100000, 1000000,
+      10000000, 100000000, 1000000000
+    };
+  int n_bits = 32 - __builtin_clz (value | 1);
+  /* 1233/4096 is slightly more than log10(2) so this gives either the
+   * number of digits or one less */
+  int guess = (n_bits * 1233) >> 12;
+
+  return guess + 1 - (value < powers_of_ten[guess]);
+}
+
+char *
+vsx_format_uint (char *buf,
+                 unsigned int value)
+{
+  char *end = buf + count_digits (value);
+  char *p = end;
+
+  /* Write two digits at a time from the end to halve the number of
+   * divisions */
+  while (value >= 100)
+    {
+      const char *pair = digit_pairs + (value % 100) * 2;
+
+      value /= 100;
+      *(--p) = pair[1];
+      *(--p) = pair[0];
+    }
+
+  if (value >= 10)
+    {
+      const char *pair = digit_pairs + value * 2;
+
+      *(--p) = pair[1];
+      *(--p) = pair[0];
+    }
+  else
+    *(--p) = '0' + value;
+
+  return end;
+}
+
+char *
+vsx_format_int (char *buf,
+                int value)
+{
+  if (value < 0)
+    {
+      *(buf++) = '-';
+      /* Negate as unsigned so that G_MININT works */
+      return vsx_format_uint (buf, 0U - (unsigned int) value);
+    }
+
+  return vsx_format_uint (buf, value);
+}
+
+char *
+vsx_format_hex (char *buf,
+                unsigned int value)
+{
+  int n_bits = 32 - __builtin_clz (value | 1);
+  char *end = buf + (n_bits + 3) / 4;
+  char *p = end;
+
+  do
+    {
+      *(--p) = lower_hex_digits[value & 0xf];
+      value >>= 4;
+    }
+  while (p > buf);
+
+  return end;
+}
+
+char *
+vsx_format_hex64_padded (char *buf,
+                         guint64 value)
+{
+  int i;
+
+  for (i = 15; i >= 0; i--)
+    {
+      buf[i] = upper_hex_digits[value & 0xf];
+      value >>= 4;
+    }
+
+  return buf + 16;
+}
+
+char *
+vsx_format_chunk_header (char *buf,
+                         unsigned int length)
+{
+  buf = vsx_format_hex (buf, length);
+
+  return vsx_format_literal (buf, "\r\n");
+}
+
+void
+vsx_format_frame_chunk (GString *buf)
+{
+  char length_buf[VSX_FORMAT_MAX_CHUNK_HEADER_LENGTH];
+  char *length_end;
+
+  length_end = vsx_format_chunk_header (length_buf, buf->len);
+  g_string_prepend_len (buf, length_buf, length_end - length_buf);
+  g_string_append (buf, "\r\n");
+}
+
+gboolean
+vsx_format_parse_encoding (const char *name,
+                           VsxFormatEncoding *encoding_out)
+{
+  if (!strcmp (name, "json"))
+    *encoding_out = VSX_FORMAT_ENCODING_JSON;
+  else if (!strcmp (name, "binary"))
+    *encoding_out = VSX_FORMAT_ENCODING_BINARY;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+char *
+vsx_format_header_event (char *buf,
+                         unsigned int player_num,
+                         guint64 person_id)
+{
+  buf = vsx_format_literal (buf, "[\"header\", {\"num\": ");
+  buf = vsx_format_uint (buf, player_num);
+  buf = vsx_format_literal (buf, ", \"id\": \"");
+  buf = vsx_format_hex64_padded (buf, person_id);
+
+  return vsx_format_literal (buf, "\"}]\r\n");
+}
+
+char *
+vsx_format_n_tiles_event (char *buf,
+                          int n_tiles)
+{
+  buf = vsx_format_literal (buf, "[\"n-tiles\", ");
+  buf = vsx_format_int (buf, n_tiles);
+
+  return vsx_format_literal (buf, "]\r\n");
+}
+
+char *
+vsx_format_player_event (char *buf,
+                         unsigned int player_num,
+                         int flags)
+{
+  buf = vsx_format_literal (buf, "[\"player\", {\"num\": ");
+  buf = vsx_format_uint (buf, player_num);
+  buf = vsx_format_literal (buf, ", \"flags\": ");
+  buf = vsx_format_int (buf, flags);
+
+  return vsx_format_literal (buf, "}]\r\n");
+}
+
+char *
+vsx_format_shout_event (char *buf,
+                        unsigned int player_num)
+{
+  buf = vsx_format_literal (buf, "[\"shout\", ");
+  buf = vsx_format_uint (buf, player_num);
+
+  return vsx_format_literal (buf, "]\r\n");
+}
+
+char *
+vsx_format_tile_event (char *buf,
+                       unsigned int tile_num,
+                       int x,
+                       int y,
+                       const char *letter,
+                       int player_num)
+{
+  buf = vsx_format_literal (buf, "[\"tile\", {\"num\": ");
+  buf = vsx_format_uint (buf, tile_num);
+  buf = vsx_format_literal (buf, ", \"x\": ");
+  buf = vsx_format_int (buf, x);
+  buf = vsx_format_literal (buf, ", \"y\": ");
+  buf = vsx_format_int (buf, y);
+  buf = vsx_format_literal (buf, ", \"letter\": \"");
+  buf = vsx_format_string (buf, letter, strlen (letter));
+  buf = vsx_format_literal (buf, "\", \"player\": ");
+  buf = vsx_format_int (buf, player_num);
+
+  return vsx_format_literal (buf, "}]\r\n");
+}
+
+char *
+vsx_format_version_event (char *buf,
+                          unsigned int version)
+{
+  buf = vsx_format_literal (buf, "[\"version\", ");
+  buf = vsx_format_uint (buf, version);
+
+  return vsx_format_literal (buf, "]\r\n");
+}
+
+char *
+vsx_format_messages_truncated_event (char *buf,
+                                     unsigned int next_message)
+{
+  buf = vsx_format_literal (buf, "[\"messages-truncated\", ");
+  buf = vsx_format_uint (buf, next_message);
+
+  return vsx_format_literal (buf, "]\r\n");
+}
+
+/* Binary events. All multi-byte numbers are little-endian */
+
+static char *
+write_uint16 (char *buf,
+              unsigned int value)
+{
+  *(buf++) = value & 0xff;
+  *(buf++) = (value >> 8) & 0xff;
+
+  return buf;
+}
+
+static char *
+write_uint32 (char *buf,
+              guint32 value)
+{
+  buf = write_uint16 (buf, value & 0xffff);
+
+  return write_uint16 (buf, value >> 16);
+}
+
+char *
+vsx_format_binary_event_start (char *buf,
+                               VsxFormatBinaryType type,
+                               unsigned int payload_length)
+{
+  *(buf++) = type;
+
+  /* The length is stored 7 bits at a time with the top bit set on
+   * every byte except the last */
+  while (payload_length >= 0x80)
+    {
+      *(buf++) = (payload_length & 0x7f) | 0x80;
+      payload_length >>= 7;
+    }
+
+  *(buf++) = payload_length;
+
+  return buf;
+}
+
+static char *
+binary_header_event (char *buf,
+                     unsigned int player_num,
+                     guint64 person_id)
+{
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_HEADER, 9);
+  *(buf++) = player_num;
+  buf = write_uint32 (buf, person_id & G_MAXUINT32);
+
+  return write_uint32 (buf, person_id >> 32);
+}
+
+static char *
+binary_n_tiles_event (char *buf,
+                      int n_tiles)
+{
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_N_TILES, 1);
+  *(buf++) = n_tiles;
+
+  return buf;
+}
+
+static char *
+binary_player_event (char *buf,
+                     unsigned int player_num,
+                     int flags)
+{
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_PLAYER, 2);
+  *(buf++) = player_num;
+  *(buf++) = flags;
+
+  return buf;
+}
+
+static char *
+binary_shout_event (char *buf,
+                    unsigned int player_num)
+{
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_SHOUT, 1);
+  *(buf++) = player_num;
+
+  return buf;
+}
+
+static char *
+binary_tile_event (char *buf,
+                   unsigned int tile_num,
+                   int x,
+                   int y,
+                   const char *letter,
+                   int player_num)
+{
+  gunichar ch = g_utf8_get_char (letter);
+
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_TILE, 9);
+  *(buf++) = tile_num;
+  buf = write_uint16 (buf, x);
+  buf = write_uint16 (buf, y);
+  /* -1 is sent as 0xff */
+  *(buf++) = player_num;
+  /* Any unicode character fits in 3 bytes */
+  *(buf++) = ch & 0xff;
+  *(buf++) = (ch >> 8) & 0xff;
+  *(buf++) = ch >> 16;
+
+  return buf;
+}
+
+static char *
+binary_version_event (char *buf,
+                      unsigned int version)
+{
+  buf = vsx_format_binary_event_start (buf, VSX_FORMAT_BINARY_VERSION, 4);
+
+  return write_uint32 (buf, version);
+}
+
+static char *
+binary_messages_truncated_event (char *buf,
+                                 unsigned int next_message)
+{
+  buf = vsx_format_binary_event_start (buf,
+                                       VSX_FORMAT_BINARY_MESSAGES_TRUNCATED,
+                                       4);
+
+  return write_uint32 (buf, next_message);
+}
+
+const VsxFormatEncoder
+vsx_format_encoders[VSX_FORMAT_N_ENCODINGS] =
+  {
+    [VSX_FORMAT_ENCODING_JSON] =
+    {
+      .header_event = vsx_format_header_event,
+      .n_tiles_event = vsx_format_n_tiles_event,
+      .player_event = vsx_format_player_event,
+      .shout_event = vsx_format_shout_event,
+      .tile_event = vsx_format_tile_event,
+      .version_event = vsx_format_version_event,
+      .messages_truncated_event = vsx_format_messages_truncated_event
+    },
+    [VSX_FORMAT_ENCODING_BINARY] =
+    {
+      .header_event = binary_header_event,
+      .n_tiles_event = binary_n_tiles_event,
+      .player_event = binary_player_event,
+      .shout_event = binary_shout_event,
+      .tile_event = binary_tile_event,
+      .version_event = binary_version_event,
+      .messages_truncated_event = binary_messages_truncated_event
+    }
+  };
@@ -0,0 +1,197 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_FORMAT_H__
+#define __VSX_FORMAT_H__
+
+#include <glib.h>
+#include <string.h>
+
+#include "vsx-tile.h"
+
+G_BEGIN_DECLS
+
+/* Functions to format the events sent to the clients without going
+   through stdio. Each function writes into a buffer that the caller
+   guarantees is big enough and returns a pointer to the end of what
+   it wrote, so they can be chained. Nothing is nul-terminated. */
+
+typedef enum
+{
+  /* One JSON array per line */
+  VSX_FORMAT_ENCODING_JSON,
+  /* Each event is a byte for the type, the length of the payload as
+   * a variable-length integer and then the payload. See
+   * doc/protocol.txt */
+  VSX_FORMAT_ENCODING_BINARY
+} VsxFormatEncoding;
+
+#define VSX_FORMAT_N_ENCODINGS 2
+
+typedef enum
+{
+  VSX_FORMAT_BINARY_HEADER,
+  VSX_FORMAT_BINARY_N_TILES,
+  VSX_FORMAT_BINARY_PLAYER_NAME,
+  VSX_FORMAT_BINARY_PLAYER,
+  VSX_FORMAT_BINARY_TILE,
+  VSX_FORMAT_BINARY_MESSAGE,
+  VSX_FORMAT_BINARY_SHOUT,
+  VSX_FORMAT_BINARY_KEEP_ALIVE,
+  VSX_FORMAT_BINARY_SYNC,
+  VSX_FORMAT_BINARY_END,
+  VSX_FORMAT_BINARY_VERSION,
+  VSX_FORMAT_BINARY_MESSAGES_TRUNCATED
+} VsxFormatBinaryType;
+
+/* Maximum length of the text of a number */
+#define VSX_FORMAT_MAX_INT_LENGTH 11
+/* Maximum length of the hex length and \r\n that start a chunk */
+#define VSX_FORMAT_MAX_CHUNK_HEADER_LENGTH (8 + 2)
+/* Maximum length of the type and payload length at the start of a
+   binary event */
+#define VSX_FORMAT_MAX_BINARY_EVENT_START_LENGTH (1 + 5)
+/* Maximum length of any of the events below in either encoding,
+   including the \r\n at the end of JSON events but not the chunk
+   framing */
+#define VSX_FORMAT_MAX_EVENT_LENGTH (110 + VSX_TILE_MAX_LETTER_BYTES)
+
+char *
+vsx_format_uint (char *buf,
+                 unsigned int value);
+
+char *
+vsx_format_int (char *buf,
+                int value);
+
+char *
+vsx_format_hex (char *buf,
+                unsigned int value);
+
+char *
+vsx_format_hex64_padded (char *buf,
+                         guint64 value);
+
+static inline char *
+vsx_format_string (char *buf,
+                   const char *str,
+                   unsigned int length)
+{
+  memcpy (buf, str, length);
+
+  return buf + length;
+}
+
+#define vsx_format_literal(buf, str)                    \
+  vsx_format_string ((buf), (str), sizeof (str) - 1)
+
+char *
+vsx_format_chunk_header (char *buf,
+                         unsigned int length);
+
+/* Wraps the whole contents of the string in an HTTP chunk */
+void
+vsx_format_frame_chunk (GString *buf);
+
+gboolean
+vsx_format_parse_encoding (const char *name,
+                           VsxFormatEncoding *encoding_out);
+
+char *
+vsx_format_binary_event_start (char *buf,
+                               VsxFormatBinaryType type,
+                               unsigned int payload_length);
+
+char *
+vsx_format_header_event (char *buf,
+                         unsigned int player_num,
+                         guint64 person_id);
+
+char *
+vsx_format_n_tiles_event (char *buf,
+                          int n_tiles);
+
+char *
+vsx_format_player_event (char *buf,
+                         unsigned int player_num,
+                         int flags);
+
+char *
+vsx_format_shout_event (char *buf,
+                        unsigned int player_num);
+
+char *
+vsx_format_tile_event (char *buf,
+                       unsigned int tile_num,
+                       int x,
+                       int y,
+                       const char *letter,
+                       int player_num);
+
+char *
+vsx_format_version_event (char *buf,
+                          unsigned int version);
+
+char *
+vsx_format_messages_truncated_event (char *buf,
+                                     unsigned int next_message);
+
+/* The functions to format each event in one of the encodings */
+typedef struct
+{
+  char *
+  (* header_event) (char *buf,
+                    unsigned int player_num,
+                    guint64 person_id);
+
+  char *
+  (* n_tiles_event) (char *buf,
+                     int n_tiles);
+
+  char *
+  (* player_event) (char *buf,
+                    unsigned int player_num,
+                    int flags);
+
+  char *
+  (* shout_event) (char *buf,
+                   unsigned int player_num);
+
+  char *
+  (* tile_event) (char *buf,
+                  unsigned int tile_num,
+                  int x,
+                  int y,
+                  const char *letter,
+                  int player_num);
+
+  char *
+  (* version_event) (char *buf,
+                     unsigned int version);
+
+  char *
+  (* messages_truncated_event) (char *buf,
+                                unsigned int next_message);
+} VsxFormatEncoder;
+
+extern const VsxFormatEncoder
+vsx_format_encoders[VSX_FORMAT_N_ENCODINGS];
+
+G_END_DECLS
+
+#endif /* __VSX_FORMAT_H__ */
@@ -0,0 +1,91 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+#include "vsx-histogram.h"
+
+void
+vsx_histogram_reset (VsxHistogram *histogram)
+{
+  memset (histogram, 0, sizeof (*histogram));
+}
+
+static guint64
+get_bucket_highest_value (int bucket)
+{
+  int group = bucket / VSX_HISTOGRAM_SUB_BUCKETS;
+  int sub_bucket = bucket % VSX_HISTOGRAM_SUB_BUCKETS;
+  int shift;
+
+  if (group == 0)
+    return sub_bucket;
+
+  shift = group - 1;
+
+  return (((guint64) (VSX_HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << shift)
+          - 1);
+}
+
+guint64
+vsx_histogram_get_percentile (const VsxHistogram *histogram,
+                              double percentile)
+{
+  guint64 target, total = 0;
+  int i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  target = histogram->count * CLAMP (percentile, 0.0, 100.0) / 100.0;
+
+  if (target < 1)
+    target = 1;
+
+  for (i = 0; i < VSX_HISTOGRAM_N_BUCKETS; i++)
+    {
+      total += histogram->buckets[i];
+
+      if (total >= target)
+        return MIN (get_bucket_highest_value (i), histogram->max);
+    }
+
+  return histogram->max;
+}
+
+void
+vsx_histogram_append_summary (const VsxHistogram *histogram,
+                              GString *buf)
+{
+  g_string_append_printf (buf,
+                          "n=%" G_GUINT64_FORMAT
+                          " p50=%" G_GUINT64_FORMAT
+                          " p90=%" G_GUINT64_FORMAT
+                          " p99=%" G_GUINT64_FORMAT
+                          " max=%" G_GUINT64_FORMAT,
+                          histogram->count,
+                          vsx_histogram_get_percentile (histogram, 50.0),
+                          vsx_histogram_get_percentile (histogram, 90.0),
+                          vsx_histogram_get_percentile (histogram, 99.0),
+                          histogram->max);
+}
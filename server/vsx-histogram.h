@@ -0,0 +1,93 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_HISTOGRAM_H__
+#define __VSX_HISTOGRAM_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A histogram of unsigned values in the style of HdrHistogram. Each
+   power of two is split into VSX_HISTOGRAM_SUB_BUCKETS linear buckets
+   so that any value can be recorded with a relative error of at most
+   1/VSX_HISTOGRAM_SUB_BUCKETS using only a few bit operations and
+   without any allocations */
+
+#define VSX_HISTOGRAM_SUB_BUCKET_BITS 3
+#define VSX_HISTOGRAM_SUB_BUCKETS (1 << VSX_HISTOGRAM_SUB_BUCKET_BITS)
+#define VSX_HISTOGRAM_N_BUCKETS                                 \
+  ((64 - VSX_HISTOGRAM_SUB_BUCKET_BITS + 1) * VSX_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+  guint64 count;
+  guint64 max;
+  guint64 buckets[VSX_HISTOGRAM_N_BUCKETS];
+} VsxHistogram;
+
+static inline int
+vsx_histogram_get_bucket (guint64 value)
+{
+  int magnitude;
+
+  /* The smallest values each have their own bucket */
+  if (value < VSX_HISTOGRAM_SUB_BUCKETS)
+    return value;
+
+  magnitude = 63 - __builtin_clzll (value);
+
+  return ((magnitude - VSX_HISTOGRAM_SUB_BUCKET_BITS + 1) *
+          VSX_HISTOGRAM_SUB_BUCKETS +
+          ((value >> (magnitude - VSX_HISTOGRAM_SUB_BUCKET_BITS)) &
+           (VSX_HISTOGRAM_SUB_BUCKETS - 1)));
+}
+
+static inline void
+vsx_histogram_record (VsxHistogram *histogram,
+                      gint64 value)
+{
+  /* Negative values can only come from clock glitches so they are
+     counted as zero */
+  if (value < 0)
+    value = 0;
+
+  histogram->buckets[vsx_histogram_get_bucket (value)]++;
+  histogram->count++;
+
+  if (value > histogram->max)
+    histogram->max = value;
+}
+
+void
+vsx_histogram_reset (VsxHistogram *histogram);
+
+/* Returns the highest value that is equivalent to the value at the
+   given percentile (0-100). Returns 0 if nothing has been recorded */
+guint64
+vsx_histogram_get_percentile (const VsxHistogram *histogram,
+                              double percentile);
+
+/* Appends a short summary of the histogram suitable for the log */
+void
+vsx_histogram_append_summary (const VsxHistogram *histogram,
+                              GString *buf);
+
+G_END_DECLS
+
+#endif /* __VSX_HISTOGRAM_H__ */
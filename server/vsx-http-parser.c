@@ -26,6 +26,14 @@
 #include <stdlib.h>
 
 #include "vsx-http-parser.h"
+#include "vsx-slab.h"
+
+static VsxSlab
+vsx_http_parser_buffer_slab =
+  {
+    .name = "VsxHttpParserBuffer",
+    .size = VSX_HTTP_PARSER_MAX_LINE_LENGTH
+  };
 
 void
 vsx_http_parser_init (VsxHttpParser *parser,
@@ -34,6 +42,8 @@ vsx_http_parser_init (VsxHttpParser *parser,
 
 {
   parser->buf_len = 0;
+  parser->buf = NULL;
+  parser->n_unparsed = 0;
   parser->state = VSX_HTTP_PARSER_READING_REQUEST_LINE;
   parser->vtable = vtable;
   parser->user_data = user_data;
@@ -95,6 +105,9 @@ add_bytes_to_buffer (VsxHttpParser *parser,
     }
   else
     {
+      if (parser->buf == NULL)
+        parser->buf = vsx_slab_alloc (&vsx_http_parser_buffer_slab);
+
       memcpy (parser->buf + parser->buf_len,
               data,
               length);
@@ -278,11 +291,11 @@ process_request_finished (VsxHttpParser *parser,
   return TRUE;
 }
 
-gboolean
-vsx_http_parser_parse_data (VsxHttpParser *parser,
-                            const guint8 *data,
-                            unsigned int length,
-                            GError **error)
+static gboolean
+parse_data (VsxHttpParser *parser,
+            const guint8 *data,
+            unsigned int length,
+            GError **error)
 {
   const guint8 *terminator;
 
@@ -329,7 +342,11 @@ vsx_http_parser_parse_data (VsxHttpParser *parser,
                                              parser->buf,
                                              parser->buf_len,
                                              error))
-                    return FALSE;
+                    {
+                      /* Everything after the \n is left unparsed */
+                      parser->n_unparsed = length - 1;
+                      return FALSE;
+                    }
 
                   parser->buf_len = 0;
                   /* Start processing headers */
@@ -690,6 +707,68 @@ vsx_http_parser_parser_eof (VsxHttpParser *parser,
   g_assert_not_reached ();
 }
 
+VsxHttpParserPhase
+vsx_http_parser_get_phase (const VsxHttpParser *parser)
+{
+  switch (parser->state)
+    {
+    case VSX_HTTP_PARSER_READING_REQUEST_LINE:
+    case VSX_HTTP_PARSER_TERMINATING_REQUEST_LINE:
+      /* Empty lines before the request line are ignored so they
+         don't count as the start of a request */
+      if (parser->buf_len == 0)
+        return VSX_HTTP_PARSER_PHASE_IDLE;
+
+      /* flow through */
+    case VSX_HTTP_PARSER_READING_HEADER:
+    case VSX_HTTP_PARSER_TERMINATING_HEADER:
+    case VSX_HTTP_PARSER_CHECKING_HEADER_CONTINUATION:
+      return VSX_HTTP_PARSER_PHASE_HEADERS;
+
+    case VSX_HTTP_PARSER_READING_DATA_WITH_LENGTH:
+    case VSX_HTTP_PARSER_READING_CHUNK_LENGTH:
+    case VSX_HTTP_PARSER_TERMINATING_CHUNK_LENGTH:
+    case VSX_HTTP_PARSER_IGNORING_CHUNK_EXTENSION:
+    case VSX_HTTP_PARSER_TERMINATING_CHUNK_EXTENSION:
+    case VSX_HTTP_PARSER_IGNORING_CHUNK_TRAILER:
+    case VSX_HTTP_PARSER_TERMINATING_CHUNK_TRAILER:
+    case VSX_HTTP_PARSER_READING_CHUNK:
+    case VSX_HTTP_PARSER_READING_CHUNK_TERMINATOR1:
+    case VSX_HTTP_PARSER_READING_CHUNK_TERMINATOR2:
+      return VSX_HTTP_PARSER_PHASE_BODY;
+    }
+
+  g_assert_not_reached ();
+}
+
+gboolean
+vsx_http_parser_parse_data (VsxHttpParser *parser,
+                            const guint8 *data,
+                            unsigned int length,
+                            GError **error)
+{
+  gboolean ret = parse_data (parser, data, length, error);
+
+  /* Give the buffer back unless part of a line is waiting for more
+     data */
+  if (parser->buf_len == 0)
+    vsx_http_parser_release_buffer (parser);
+
+  return ret;
+}
+
+void
+vsx_http_parser_release_buffer (VsxHttpParser *parser)
+{
+  if (parser->buf)
+    {
+      vsx_slab_free (&vsx_http_parser_buffer_slab, parser->buf);
+      parser->buf = NULL;
+    }
+
+  parser->buf_len = 0;
+}
+
 GQuark
 vsx_http_parser_error_quark (void)
 {
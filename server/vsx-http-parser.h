@@ -32,6 +32,19 @@ typedef enum
   VSX_HTTP_PARSER_ERROR_CANCELLED
 } VsxHttpParserError;
 
+/* The part of a request that the parser is waiting for */
+typedef enum
+{
+  /* Nothing of the next request has been received yet */
+  VSX_HTTP_PARSER_PHASE_IDLE,
+  /* Reading the request line or the headers */
+  VSX_HTTP_PARSER_PHASE_HEADERS,
+  /* Reading the body of the request */
+  VSX_HTTP_PARSER_PHASE_BODY
+} VsxHttpParserPhase;
+
+#define VSX_HTTP_PARSER_N_PHASES 3
+
 typedef struct
 {
   gboolean (* request_line_received) (const char *method,
@@ -48,8 +61,11 @@ typedef struct
 
 typedef struct
 {
+  /* Buffer for the line being parsed. This is only attached while
+     there is part of a line waiting for the rest so that idle
+     connections don't need one */
   unsigned int buf_len;
-  guint8 buf[VSX_HTTP_PARSER_MAX_LINE_LENGTH];
+  guint8 *buf;
 
   enum
   {
@@ -81,6 +97,12 @@ typedef struct
   } transfer_encoding;
 
   unsigned int content_length;
+
+  /* If the request_line_received callback cancels parsing then this
+     is set to the number of bytes at the end of the data passed to
+     vsx_http_parser_parse_data that weren't consumed. The caller can
+     use this to resume the request somewhere else */
+  unsigned int n_unparsed;
 } VsxHttpParser;
 
 #define VSX_HTTP_PARSER_ERROR (vsx_http_parser_error_quark ())
@@ -100,6 +122,18 @@ gboolean
 vsx_http_parser_parser_eof (VsxHttpParser *parser,
                             GError **error);
 
+/* Gives the line buffer back to the shared pool. This isn't a
+   destructor. The parser doesn't own any other resources so there is
+   nothing else to free, and it can still be used afterwards. Any
+   partial line that was waiting for more data is discarded, so it
+   should only be called when the parser is idle or about to be
+   initialised again */
+void
+vsx_http_parser_release_buffer (VsxHttpParser *parser);
+
+VsxHttpParserPhase
+vsx_http_parser_get_phase (const VsxHttpParser *parser);
+
 GQuark
 vsx_http_parser_error_quark (void);
 
@@ -28,6 +28,11 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
 
 #include "vsx-main-context.h"
 #include "vsx-list.h"
@@ -36,13 +41,106 @@
    epoll. The hope is that it will scale to more connections easily
    because it doesn't use poll which needs to upload the set of file
    descriptors every time it blocks and it doesn't have to walk the
-   list of file descriptors to find out which object it belongs to */
+   list of file descriptors to find out which object it belongs to.
+
+   If io_uring support is enabled at build time and the kernel
+   supports it then an io_uring is used instead. Listening sockets
+   are serviced with a multishot accept and connected sockets with a
+   multishot receive into a ring of buffers provided by the context,
+   so accepting a connection or receiving data doesn't need a system
+   call of its own. Any other file descriptors are watched with
+   multishot poll requests. All of the requests made during an
+   iteration are submitted in the same system call that waits for
+   the next completions */
+
+/* The timers are stored in a hierarchical timing wheel. Each level
+   has 64 slots. A slot in the lowest level covers one millisecond and
+   each higher level covers 64 times as much time as the level below
+   it. When the wheel turns past the start of a slot in a higher level
+   the timers in it are moved down into the lower levels. This makes
+   adding and removing a timer O(1) and only the timers that are
+   actually due get touched when the clock advances */
+#define VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS 6
+#define VSX_MAIN_CONTEXT_TIMER_LEVEL_SIZE \
+  (1 << VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS)
+#define VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK \
+  (VSX_MAIN_CONTEXT_TIMER_LEVEL_SIZE - 1)
+#define VSX_MAIN_CONTEXT_TIMER_N_LEVELS 5
+/* The furthest time in the future in milliseconds that can be
+   represented by the wheel (about 12 days). Timers further than this
+   are stored at the end of the wheel and get reinserted when it is
+   reached */
+#define VSX_MAIN_CONTEXT_TIMER_MAX_DELTA                        \
+  (((gint64) 1 << (VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS *          \
+                   VSX_MAIN_CONTEXT_TIMER_N_LEVELS)) - 1)
+
+typedef struct
+{
+  /* Bitmask of the slots that contain at least one timer */
+  guint64 occupied;
+  VsxList slots[VSX_MAIN_CONTEXT_TIMER_LEVEL_SIZE];
+} VsxMainContextTimerLevel;
+
+#ifdef USE_IO_URING
+
+#define VSX_MAIN_CONTEXT_IO_URING_ENTRIES 256
+
+/* The poll requests are level-triggered to match the behaviour of
+   epoll unless the source asks otherwise and they stay active until
+   they are explicitly removed */
+#define VSX_MAIN_CONTEXT_IO_URING_POLL_FLAGS \
+  (IORING_POLL_ADD_MULTI | IORING_POLL_ADD_LEVEL)
+#define VSX_MAIN_CONTEXT_IO_URING_EDGE_POLL_FLAGS IORING_POLL_ADD_MULTI
+
+/* Received data is written into a ring of buffers shared by all of
+   the sockets on the context. Each buffer is given back to the
+   kernel as soon as the data in it has been passed to the callback
+   so the ring only has to be big enough for the data that arrives
+   during one iteration */
+#define VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS 256
+#define VSX_MAIN_CONTEXT_IO_URING_BUFFER_GROUP 0
+
+/* The user data of a request is a pointer to the source with the
+   type of the request in the lowest bit */
+typedef enum
+{
+  VSX_MAIN_CONTEXT_REQUEST_MAIN,
+  VSX_MAIN_CONTEXT_REQUEST_WRITABLE
+} VsxMainContextRequestType;
 
-typedef struct _VsxMainContextBucket VsxMainContextBucket;
+#define VSX_MAIN_CONTEXT_REQUEST_TYPE_MASK 1
+
+#endif /* USE_IO_URING */
+
+/* Size of each buffer that received data is written into */
+#define VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE 2048
+
+/* Maximum number of connections to accept from a listening socket
+   before giving the other sources a chance to run when epoll is
+   used */
+#define VSX_MAIN_CONTEXT_MAX_ACCEPTS 64
 
 struct _VsxMainContext
 {
   int epoll_fd;
+
+#ifdef USE_IO_URING
+  /* If this is TRUE then the io_uring is used instead of epoll_fd */
+  gboolean use_io_uring;
+  struct io_uring ring;
+  struct io_uring_buf_ring *buf_ring;
+  guint8 *recv_buffers;
+#endif
+
+  /* Buffer to receive data into when epoll is used. This is
+     allocated when the first socket source is added */
+  guint8 *recv_buffer;
+
+  /* Sources that have been removed while events or completions might
+     still refer to them. They are freed at the end of an iteration
+     once nothing can refer to them anymore */
+  VsxList dead_sources;
+
   /* Number of sources that are currently attached. This is used so we
      can size the array passed to epoll_wait to ensure it's possible
      to process an event for every single source */
@@ -62,8 +160,20 @@ struct _VsxMainContext
   gboolean monotonic_time_valid;
   gint64 monotonic_time;
 
-  VsxList buckets;
-  gint64 last_timer_time;
+  VsxMainContextStats stats;
+  /* Time at which the last profiled step finished. This is read
+     directly from the clock instead of using the cached monotonic
+     time so that the time spent in each callback can be measured */
+  gint64 profile_time;
+  /* Time at which the last wait finished or 0 if there hasn't been
+     one yet */
+  gint64 wake_time;
+
+  VsxMainContextTimerLevel timer_levels[VSX_MAIN_CONTEXT_TIMER_N_LEVELS];
+  unsigned int n_timers;
+  /* The next tick of the wheel in milliseconds that hasn't been
+     processed yet */
+  gint64 timer_base;
 };
 
 struct _VsxMainContextSource
@@ -71,17 +181,34 @@ struct _VsxMainContextSource
   enum
   {
     VSX_MAIN_CONTEXT_POLL_SOURCE,
+    VSX_MAIN_CONTEXT_ACCEPT_SOURCE,
+    VSX_MAIN_CONTEXT_SOCKET_SOURCE,
     VSX_MAIN_CONTEXT_TIMER_SOURCE,
     VSX_MAIN_CONTEXT_QUIT_SOURCE
   } type;
 
   union
   {
-    /* Poll sources */
+    /* Poll, accept and socket sources */
     struct
     {
       int fd;
       VsxMainContextPollFlags current_flags;
+      /* For accept sources this is TRUE while connections should be
+         accepted. For socket sources it is TRUE until receiving
+         stops */
+      gboolean active;
+      /* For socket sources when epoll is used this is TRUE if the
+         next EPOLLOUT should be reported */
+      gboolean want_writable;
+      /* TRUE once the source has been removed. It is then in the
+         list of dead sources until it can be freed */
+      gboolean dead;
+      VsxList dead_link;
+#ifdef USE_IO_URING
+      /* Bitmask of the types of request that are in flight */
+      guint8 requests;
+#endif
     };
 
     /* Quit sources */
@@ -93,36 +220,51 @@ struct _VsxMainContextSource
     /* Timer sources */
     struct
     {
-      VsxMainContextBucket *bucket;
       VsxList timer_link;
+      /* Time in milliseconds at which the timer should next fire */
+      gint64 expiry;
+      /* Interval in milliseconds between each invocation */
+      int interval;
+      /* Position in the wheel. The level is -1 while the timer is
+         in the list of timers that are being emitted */
+      gint8 timer_level;
+      guint8 timer_slot;
     };
   };
 
   gpointer user_data;
   void *callback;
 
+  VsxMainContextCategory category;
+
   VsxMainContext *mc;
 };
 
-struct _VsxMainContextBucket
-{
-  VsxList link;
-  VsxList sources;
-  int minutes;
-  int minutes_passed;
-};
+/* Each thread gets its own default context so that the server
+   workers can each run their own loop without any locking */
+static GPrivate vsx_main_context_default = G_PRIVATE_INIT (NULL);
 
-static VsxMainContext *vsx_main_context_default = NULL;
+/* The context that owns the quit pipe. The signal handler can't use
+   the thread-local default context because the signal could be
+   delivered to any thread */
+static VsxMainContext *vsx_main_context_quit_context = NULL;
 
 VsxMainContext *
 vsx_main_context_get_default (GError **error)
 {
+  VsxMainContext *mc;
+
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  if (vsx_main_context_default == NULL)
-    vsx_main_context_default = vsx_main_context_new (error);
+  mc = g_private_get (&vsx_main_context_default);
+
+  if (mc == NULL)
+    {
+      mc = vsx_main_context_new (error);
+      g_private_set (&vsx_main_context_default, mc);
+    }
 
-  return vsx_main_context_default;
+  return mc;
 }
 
 static VsxMainContext *
@@ -144,367 +286,1335 @@ vsx_main_context_get_default_or_abort (void)
   return mc;
 }
 
-VsxMainContext *
-vsx_main_context_new (GError **error)
+#ifdef USE_IO_URING
+
+/* Level-triggered polls were added to io_uring later than multishot
+   polls so this checks that the kernel supports them by trying one
+   out on a pipe */
+static gboolean
+check_io_uring_poll (struct io_uring *ring)
 {
-  int fd;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  gboolean ret = FALSE;
+  int n_cqes;
+  int fds[2];
 
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  if (pipe (fds) == -1)
+    return FALSE;
 
-  fd = epoll_create (16);
+  sqe = io_uring_get_sqe (ring);
+  io_uring_prep_poll_add (sqe, fds[0], EPOLLIN);
+  sqe->len = VSX_MAIN_CONTEXT_IO_URING_POLL_FLAGS;
+  io_uring_sqe_set_data (sqe, ring);
 
-  if (fd == -1)
-    {
-      if (errno == EINVAL)
-        g_set_error (error,
-                     VSX_MAIN_CONTEXT_ERROR,
-                     VSX_MAIN_CONTEXT_ERROR_UNSUPPORTED,
-                     "epoll is unsupported on this system");
-      else
-        g_set_error (error,
-                     VSX_MAIN_CONTEXT_ERROR,
-                     VSX_MAIN_CONTEXT_ERROR_UNKNOWN,
-                     "failed to create an epoll descriptor: %s",
-                     strerror (errno));
+  sqe = io_uring_get_sqe (ring);
+  io_uring_prep_poll_remove (sqe, (uintptr_t) ring);
+  io_uring_sqe_set_data (sqe, NULL);
 
-      return NULL;
-    }
-  else
+  if (io_uring_submit_and_wait (ring, 2) == 2)
     {
-      VsxMainContext *mc = g_new (VsxMainContext, 1);
+      for (n_cqes = 0; n_cqes < 2; n_cqes++)
+        {
+          if (io_uring_wait_cqe (ring, &cqe) < 0)
+            break;
 
-      mc->epoll_fd = fd;
-      mc->n_sources = 0;
-      mc->events = g_array_new (FALSE, FALSE, sizeof (struct epoll_event));
-      mc->monotonic_time_valid = FALSE;
-      vsx_list_init (&mc->quit_sources);
-      mc->quit_pipe_source = NULL;
-      vsx_list_init (&mc->buckets);
-      mc->last_timer_time = vsx_main_context_get_monotonic_clock (mc);
+          if (io_uring_cqe_get_data (cqe) == ring)
+            ret = cqe->res != -EINVAL;
 
-      return mc;
+          io_uring_cqe_seen (ring, cqe);
+        }
     }
-}
-
-static uint32_t
-get_epoll_events (VsxMainContextPollFlags flags)
-{
-  uint32_t events = 0;
 
-  if (flags & VSX_MAIN_CONTEXT_POLL_IN)
-    events |= EPOLLIN | EPOLLRDHUP;
-  if (flags & VSX_MAIN_CONTEXT_POLL_OUT)
-    events |= EPOLLOUT;
+  close (fds[0]);
+  close (fds[1]);
 
-  return events;
+  return ret;
 }
 
-VsxMainContextSource *
-vsx_main_context_add_poll (VsxMainContext *mc,
-                           int fd,
-                           VsxMainContextPollFlags flags,
-                           VsxMainContextPollCallback callback,
-                           void *user_data)
+static void
+recycle_buffer (VsxMainContext *mc,
+                int buffer_id)
 {
-  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
-  struct epoll_event event;
-
-  if (mc == NULL)
-    mc = vsx_main_context_get_default_or_abort ();
-
-  source->mc = mc;
-  source->fd = fd;
-  source->callback = callback;
-  source->type = VSX_MAIN_CONTEXT_POLL_SOURCE;
-  source->user_data = user_data;
-
-  event.events = get_epoll_events (flags);
-  event.data.ptr = source;
-
-  if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
-    g_warning ("EPOLL_CTL_ADD failed: %s", strerror (errno));
-
-  source->current_flags = flags;
-
-  mc->n_sources++;
-
-  return source;
+  io_uring_buf_ring_add (mc->buf_ring,
+                         mc->recv_buffers +
+                         buffer_id * VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE,
+                         VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE,
+                         buffer_id,
+                         io_uring_buf_ring_mask
+                         (VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS),
+                         0 /* offset */);
+  io_uring_buf_ring_advance (mc->buf_ring, 1);
 }
 
-void
-vsx_main_context_modify_poll (VsxMainContextSource *source,
-                              VsxMainContextPollFlags flags)
+static gboolean
+init_buffer_ring (VsxMainContext *mc)
 {
-  struct epoll_event event;
+  int ret, i;
 
-  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_POLL_SOURCE);
+  mc->buf_ring =
+    io_uring_setup_buf_ring (&mc->ring,
+                             VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS,
+                             VSX_MAIN_CONTEXT_IO_URING_BUFFER_GROUP,
+                             0 /* flags */,
+                             &ret);
 
-  if (source->current_flags == flags)
-    return;
+  if (mc->buf_ring == NULL)
+    return FALSE;
 
-  event.events = get_epoll_events (flags);
-  event.data.ptr = source;
+  mc->recv_buffers = g_malloc (VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS *
+                               VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE);
 
-  if (epoll_ctl (source->mc->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) == -1)
-    g_warning ("EPOLL_CTL_MOD failed: %s", strerror (errno));
+  for (i = 0; i < VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS; i++)
+    recycle_buffer (mc, i);
 
-  source->current_flags = flags;
+  return TRUE;
 }
 
 static void
-vsx_main_context_quit_pipe_cb (VsxMainContextSource *source,
-                               int fd,
-                               VsxMainContextPollFlags flags,
-                               void *user_data)
+free_buffer_ring (VsxMainContext *mc)
 {
-  VsxMainContext *mc = user_data;
-  guint8 byte;
-
-  if (read (mc->quit_pipe[0], &byte, sizeof (byte)) == -1)
-    {
-      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
-        g_warning ("Read from quit pipe failed: %s", strerror (errno));
-    }
-  else
-    {
-      VsxMainContextSource *quit_source;
-
-      vsx_list_for_each (quit_source, &mc->quit_sources, quit_link)
-        {
-          VsxMainContextQuitCallback callback = quit_source->callback;
-
-          callback (quit_source, quit_source->user_data);
-        }
-    }
+  io_uring_free_buf_ring (&mc->ring,
+                          mc->buf_ring,
+                          VSX_MAIN_CONTEXT_IO_URING_N_BUFFERS,
+                          VSX_MAIN_CONTEXT_IO_URING_BUFFER_GROUP);
+  g_free (mc->recv_buffers);
 }
 
 static void
-vsx_main_context_quit_signal_cb (int signum)
+prep_recv (struct io_uring_sqe *sqe,
+           int fd)
 {
-  VsxMainContext *mc = vsx_main_context_get_default_or_abort ();
-  guint8 byte = 42;
-
-  while (write (mc->quit_pipe[1], &byte, 1) == -1
-         && errno == EINTR);
+  io_uring_prep_recv_multishot (sqe, fd, NULL, 0, 0 /* flags */);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = VSX_MAIN_CONTEXT_IO_URING_BUFFER_GROUP;
 }
 
-VsxMainContextSource *
-vsx_main_context_add_quit (VsxMainContext *mc,
-                           VsxMainContextQuitCallback callback,
-                           void *user_data)
+/* Multishot receives were added in a later kernel than the buffer
+   rings so this checks that they work by receiving a byte from a
+   socket pair */
+static gboolean
+check_io_uring_recv (VsxMainContext *mc)
 {
-  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
-
-  if (mc == NULL)
-    mc = vsx_main_context_get_default_or_abort ();
-
-  source->mc = mc;
-  source->callback = callback;
-  source->type = VSX_MAIN_CONTEXT_QUIT_SOURCE;
-  source->user_data = user_data;
-
-  vsx_list_insert (&mc->quit_sources, &source->quit_link);
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  gboolean ret = FALSE;
+  gboolean more = FALSE;
+  guint8 byte = 42;
+  int fds[2];
 
-  mc->n_sources++;
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    return FALSE;
 
-  if (mc->quit_pipe_source == NULL)
+  if (write (fds[1], &byte, 1) == 1)
     {
-      if (pipe (mc->quit_pipe) == -1)
-        g_warning ("Failed to create quit pipe: %s", strerror (errno));
-      else
+      sqe = io_uring_get_sqe (&mc->ring);
+      prep_recv (sqe, fds[0]);
+      io_uring_sqe_set_data (sqe, mc);
+
+      if (io_uring_submit_and_wait (&mc->ring, 1) == 1
+          && io_uring_wait_cqe (&mc->ring, &cqe) == 0)
         {
-          mc->quit_pipe_source
-            = vsx_main_context_add_poll (mc, mc->quit_pipe[0],
-                                         VSX_MAIN_CONTEXT_POLL_IN,
-                                         vsx_main_context_quit_pipe_cb,
-                                         mc);
+          more = !!(cqe->flags & IORING_CQE_F_MORE);
 
-          mc->old_int_handler =
-            signal (SIGINT, vsx_main_context_quit_signal_cb);
-          mc->old_term_handler =
-            signal (SIGTERM, vsx_main_context_quit_signal_cb);
+          if ((cqe->flags & IORING_CQE_F_BUFFER))
+            {
+              ret = cqe->res == 1;
+              recycle_buffer (mc, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+
+          io_uring_cqe_seen (&mc->ring, cqe);
         }
     }
 
-  return source;
-}
-
-static VsxMainContextBucket *
-get_bucket (VsxMainContext *mc,
-            int minutes)
-{
-  VsxMainContextBucket *bucket;
+  /* Closing the other end ends the request with an EOF */
+  close (fds[1]);
 
-  vsx_list_for_each (bucket, &mc->buckets, link)
+  while (more && io_uring_wait_cqe (&mc->ring, &cqe) == 0)
     {
-      if (bucket->minutes == minutes)
-        return bucket;
+      more = !!(cqe->flags & IORING_CQE_F_MORE);
+
+      if ((cqe->flags & IORING_CQE_F_BUFFER))
+        recycle_buffer (mc, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+      io_uring_cqe_seen (&mc->ring, cqe);
     }
 
-  bucket = g_slice_new (VsxMainContextBucket);
-  vsx_list_init (&bucket->sources);
-  bucket->minutes = minutes;
-  bucket->minutes_passed = 0;
-  vsx_list_insert (&mc->buckets, &bucket->link);
+  close (fds[0]);
 
-  return bucket;
+  return ret;
 }
 
-VsxMainContextSource *
-vsx_main_context_add_timer (VsxMainContext *mc,
-                            int minutes,
-                            VsxMainContextTimerCallback callback,
-                            void *user_data)
+static gboolean
+init_io_uring (VsxMainContext *mc)
 {
-  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
+  if (io_uring_queue_init (VSX_MAIN_CONTEXT_IO_URING_ENTRIES,
+                           &mc->ring,
+                           0 /* flags */) < 0)
+    return FALSE;
 
-  if (mc == NULL)
-    mc = vsx_main_context_get_default_or_abort ();
+  if (!check_io_uring_poll (&mc->ring))
+    goto error;
 
-  source->mc = mc;
-  source->bucket = get_bucket (mc, minutes);
-  source->callback = callback;
-  source->type = VSX_MAIN_CONTEXT_TIMER_SOURCE;
-  source->user_data = user_data;
+  if (!init_buffer_ring (mc))
+    goto error;
 
-  vsx_list_insert (&source->bucket->sources, &source->timer_link);
+  if (!check_io_uring_recv (mc))
+    {
+      free_buffer_ring (mc);
+      goto error;
+    }
 
-  mc->n_sources++;
+  return TRUE;
 
-  return source;
+ error:
+  io_uring_queue_exit (&mc->ring);
+  return FALSE;
 }
 
-void
-vsx_main_context_remove_source (VsxMainContextSource *source)
+#endif /* USE_IO_URING */
+
+VsxMainContext *
+vsx_main_context_new (GError **error)
 {
-  VsxMainContext *mc = source->mc;
-  struct epoll_event event;
+  VsxMainContext *mc;
+  int fd = -1;
+  int level, slot;
 
-  switch (source->type)
-    {
-    case VSX_MAIN_CONTEXT_POLL_SOURCE:
-      if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_DEL, source->fd, &event) == -1)
-        g_warning ("EPOLL_CTL_DEL failed: %s", strerror (errno));
-      break;
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-    case VSX_MAIN_CONTEXT_QUIT_SOURCE:
-      vsx_list_remove (&source->quit_link);
-      break;
+  mc = g_new (VsxMainContext, 1);
 
-    case VSX_MAIN_CONTEXT_TIMER_SOURCE:
-      {
-        VsxMainContextBucket *bucket = source->bucket;
+#ifdef USE_IO_URING
+  /* Fall back to epoll if the kernel doesn't support io_uring or
+     the features that we need */
+  mc->use_io_uring = init_io_uring (mc);
 
-        vsx_list_remove (&source->timer_link);
+  if (!mc->use_io_uring)
+#endif
+    {
+      fd = epoll_create (16);
 
-        if (vsx_list_empty (&bucket->sources))
-          {
-            vsx_list_remove (&bucket->link);
-            g_slice_free (VsxMainContextBucket, bucket);
-          }
-      }
-      break;
+      if (fd == -1)
+        {
+          if (errno == EINVAL)
+            g_set_error (error,
+                         VSX_MAIN_CONTEXT_ERROR,
+                         VSX_MAIN_CONTEXT_ERROR_UNSUPPORTED,
+                         "epoll is unsupported on this system");
+          else
+            g_set_error (error,
+                         VSX_MAIN_CONTEXT_ERROR,
+                         VSX_MAIN_CONTEXT_ERROR_UNKNOWN,
+                         "failed to create an epoll descriptor: %s",
+                         strerror (errno));
+
+          g_free (mc);
+
+          return NULL;
+        }
     }
 
-  g_slice_free (VsxMainContextSource, source);
+  mc->epoll_fd = fd;
+  mc->n_sources = 0;
+  mc->recv_buffer = NULL;
+  vsx_list_init (&mc->dead_sources);
+  mc->events = g_array_new (FALSE, FALSE, sizeof (struct epoll_event));
+  mc->monotonic_time_valid = FALSE;
+  vsx_list_init (&mc->quit_sources);
+  mc->quit_pipe_source = NULL;
 
-  mc->n_sources--;
+  for (level = 0; level < VSX_MAIN_CONTEXT_TIMER_N_LEVELS; level++)
+    {
+      mc->timer_levels[level].occupied = 0;
+      for (slot = 0; slot < VSX_MAIN_CONTEXT_TIMER_LEVEL_SIZE; slot++)
+        vsx_list_init (mc->timer_levels[level].slots + slot);
+    }
+  mc->n_timers = 0;
+  mc->timer_base = 0;
+
+  vsx_main_context_reset_stats (mc);
+  mc->profile_time = 0;
+  mc->wake_time = 0;
+
+  return mc;
 }
 
-static int
-get_timeout (VsxMainContext *mc)
+static uint32_t
+get_epoll_events (VsxMainContextPollFlags flags)
 {
-  VsxMainContextBucket *bucket;
-  int min_minutes;
-  gint64 elapsed, elapsed_minutes;
+  uint32_t events = 0;
 
-  if (vsx_list_empty (&mc->buckets))
-    return -1;
+  if (flags & VSX_MAIN_CONTEXT_POLL_IN)
+    events |= EPOLLIN | EPOLLRDHUP;
+  if (flags & VSX_MAIN_CONTEXT_POLL_OUT)
+    events |= EPOLLOUT;
+  if (flags & VSX_MAIN_CONTEXT_POLL_EDGE_TRIGGERED)
+    events |= EPOLLET;
 
-  min_minutes = G_MAXINT;
+  return events;
+}
 
-  vsx_list_for_each (bucket, &mc->buckets, link)
-    {
-      int minutes_to_wait = bucket->minutes - bucket->minutes_passed;
+#ifdef USE_IO_URING
 
-      if (minutes_to_wait < min_minutes)
-        min_minutes = minutes_to_wait;
-    }
+static unsigned int
+get_io_uring_poll_flags (VsxMainContextPollFlags flags)
+{
+  if (flags & VSX_MAIN_CONTEXT_POLL_EDGE_TRIGGERED)
+    return VSX_MAIN_CONTEXT_IO_URING_EDGE_POLL_FLAGS;
+  else
+    return VSX_MAIN_CONTEXT_IO_URING_POLL_FLAGS;
+}
 
-  elapsed = vsx_main_context_get_monotonic_clock (mc) - mc->last_timer_time;
-  elapsed_minutes = elapsed / 60000000;
+static struct io_uring_sqe *
+get_sqe (VsxMainContext *mc)
+{
+  struct io_uring_sqe *sqe;
 
-  /* If we've already waited enough time then don't wait any further time */
-  if (elapsed_minutes >= min_minutes)
-    return 0;
+  /* If the submission queue is full then flush it to the kernel to
+     make some space */
+  while ((sqe = io_uring_get_sqe (&mc->ring)) == NULL)
+    io_uring_submit (&mc->ring);
 
-  /* Subtract the number of minutes we've already waited */
-  min_minutes -= (int) elapsed_minutes;
+  return sqe;
+}
 
-  return (60000 - (elapsed / 1000 % 60000) + (min_minutes - 1) * 60000);
+static void *
+get_request_data (VsxMainContextSource *source,
+                  VsxMainContextRequestType type)
+{
+  return (void *) ((uintptr_t) source | type);
 }
 
 static void
-emit_bucket (VsxMainContextBucket *bucket)
+set_request_data (VsxMainContextSource *source,
+                  struct io_uring_sqe *sqe,
+                  VsxMainContextRequestType type)
 {
-  VsxMainContextSource *source, *tmp_source;
+  io_uring_sqe_set_data (sqe, get_request_data (source, type));
+  source->requests |= 1 << type;
+}
 
-  vsx_list_for_each_safe (source, tmp_source, &bucket->sources, timer_link)
-    {
-      VsxMainContextTimerCallback callback = source->callback;
+static void
+submit_poll_add (VsxMainContextSource *source)
+{
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
 
-      callback (source, source->user_data);
-    }
+  io_uring_prep_poll_add (sqe,
+                          source->fd,
+                          get_epoll_events (source->current_flags));
+  sqe->len = get_io_uring_poll_flags (source->current_flags);
+  set_request_data (source, sqe, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+}
 
-  bucket->minutes_passed = 0;
+static void
+submit_poll_update (VsxMainContextSource *source,
+                    VsxMainContextPollFlags flags)
+{
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
+
+  io_uring_prep_poll_update (sqe,
+                             (uintptr_t) source,
+                             (uintptr_t) source,
+                             get_epoll_events (flags),
+                             /* The kernel rejects the trigger mode
+                                flags on an update. The existing
+                                request keeps its mode anyway */
+                             IORING_POLL_UPDATE_EVENTS |
+                             IORING_POLL_ADD_MULTI);
+  /* The context is used as the data so that the completion can be
+     told apart from the poll events without referring to the source,
+     which might already have been freed by then */
+  io_uring_sqe_set_data (sqe, source->mc);
 }
 
 static void
-check_timer_sources (VsxMainContext *mc)
+submit_accept (VsxMainContextSource *source)
 {
-  VsxMainContextBucket *bucket, *tmp_bucket;
-  gint64 now;
-  gint64 elapsed_minutes;
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
+
+  /* The address isn't requested because every accept in a multishot
+     request would write to the same place */
+  io_uring_prep_multishot_accept (sqe,
+                                  source->fd,
+                                  NULL, /* addr */
+                                  NULL, /* addrlen */
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+  set_request_data (source, sqe, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+}
 
-  if (vsx_list_empty (&mc->buckets))
-    return;
+static void
+submit_recv (VsxMainContextSource *source)
+{
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
 
-  now = vsx_main_context_get_monotonic_clock (mc);
-  elapsed_minutes = (now - mc->last_timer_time) / 60000000;
-  mc->last_timer_time += elapsed_minutes * 60000000;
+  prep_recv (sqe, source->fd);
+  set_request_data (source, sqe, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+}
 
-  if (elapsed_minutes < 1)
-    return;
+static void
+submit_writable_poll (VsxMainContextSource *source)
+{
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
 
-  vsx_list_for_each_safe (bucket, tmp_bucket, &mc->buckets, link)
-    {
-      if (bucket->minutes_passed + elapsed_minutes >= bucket->minutes)
-        emit_bucket (bucket);
-      else
-        bucket->minutes_passed += elapsed_minutes;
-    }
+  /* This is a one-shot poll because the socket only needs to be
+     watched while a write is blocked */
+  io_uring_prep_poll_add (sqe, source->fd, EPOLLOUT);
+  set_request_data (source, sqe, VSX_MAIN_CONTEXT_REQUEST_WRITABLE);
 }
 
-void
-vsx_main_context_poll (VsxMainContext *mc)
+static void
+submit_cancel (VsxMainContextSource *source,
+               VsxMainContextRequestType type)
 {
-  int n_events;
+  struct io_uring_sqe *sqe = get_sqe (source->mc);
 
-  if (mc == NULL)
-    mc = vsx_main_context_get_default_or_abort ();
+  io_uring_prep_cancel64 (sqe,
+                          (uintptr_t) get_request_data (source, type),
+                          0 /* flags */);
+  io_uring_sqe_set_data (sqe, NULL);
+}
 
-  g_array_set_size (mc->events, mc->n_sources);
+static gboolean
+has_request (VsxMainContextSource *source,
+             VsxMainContextRequestType type)
+{
+  return !!(source->requests & (1 << type));
+}
 
-  n_events = epoll_wait (mc->epoll_fd,
-                         &g_array_index (mc->events,
-                                         struct epoll_event,
-                                         0),
-                         mc->n_sources,
-                         get_timeout (mc));
+#endif /* USE_IO_URING */
+
+static VsxMainContextSource *
+add_fd_source (VsxMainContext *mc,
+               int fd,
+               int type,
+               void *callback,
+               void *user_data)
+{
+  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
+
+  source->mc = mc;
+  source->fd = fd;
+  source->callback = callback;
+  source->type = type;
+  source->category = VSX_MAIN_CONTEXT_CATEGORY_OTHER;
+  source->user_data = user_data;
+  source->current_flags = 0;
+  source->active = TRUE;
+  source->want_writable = FALSE;
+  source->dead = FALSE;
+#ifdef USE_IO_URING
+  source->requests = 0;
+#endif
+
+  mc->n_sources++;
+
+  return source;
+}
+
+static void
+epoll_add (VsxMainContextSource *source,
+           uint32_t events)
+{
+  struct epoll_event event;
+
+  event.events = events;
+  event.data.ptr = source;
+
+  if (epoll_ctl (source->mc->epoll_fd,
+                 EPOLL_CTL_ADD,
+                 source->fd,
+                 &event) == -1)
+    g_warning ("EPOLL_CTL_ADD failed: %s", strerror (errno));
+}
+
+VsxMainContextSource *
+vsx_main_context_add_poll (VsxMainContext *mc,
+                           int fd,
+                           VsxMainContextPollFlags flags,
+                           VsxMainContextPollCallback callback,
+                           void *user_data)
+{
+  VsxMainContextSource *source;
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  source = add_fd_source (mc,
+                          fd,
+                          VSX_MAIN_CONTEXT_POLL_SOURCE,
+                          callback,
+                          user_data);
+  source->current_flags = flags;
+
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    submit_poll_add (source);
+  else
+#endif
+    epoll_add (source, get_epoll_events (flags));
+
+  return source;
+}
+
+void
+vsx_main_context_modify_poll (VsxMainContextSource *source,
+                              VsxMainContextPollFlags flags)
+{
+  struct epoll_event event;
+
+  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_POLL_SOURCE);
+  g_return_if_fail (((source->current_flags ^ flags)
+                     & VSX_MAIN_CONTEXT_POLL_EDGE_TRIGGERED) == 0);
+
+  if (source->current_flags == flags)
+    return;
+
+#ifdef USE_IO_URING
+  if (source->mc->use_io_uring)
+    submit_poll_update (source, flags);
+  else
+#endif
+    {
+      event.events = get_epoll_events (flags);
+      event.data.ptr = source;
+
+      if (epoll_ctl (source->mc->epoll_fd,
+                     EPOLL_CTL_MOD,
+                     source->fd,
+                     &event) == -1)
+        g_warning ("EPOLL_CTL_MOD failed: %s", strerror (errno));
+    }
+
+  source->current_flags = flags;
+}
+
+VsxMainContextSource *
+vsx_main_context_add_accept (VsxMainContext *mc,
+                             int fd,
+                             VsxMainContextAcceptCallback callback,
+                             void *user_data)
+{
+  VsxMainContextSource *source;
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  source = add_fd_source (mc,
+                          fd,
+                          VSX_MAIN_CONTEXT_ACCEPT_SOURCE,
+                          callback,
+                          user_data);
+
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    submit_accept (source);
+  else
+#endif
+    /* This is level-triggered so that any connections left over
+       after accepting the maximum number will be picked up on the
+       next iteration */
+    epoll_add (source, EPOLLIN);
+
+  return source;
+}
+
+void
+vsx_main_context_set_accepting (VsxMainContextSource *source,
+                                gboolean accepting)
+{
+  struct epoll_event event;
+
+  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_ACCEPT_SOURCE);
+
+  if (source->active == !!accepting)
+    return;
+
+  source->active = !!accepting;
+
+#ifdef USE_IO_URING
+  if (source->mc->use_io_uring)
+    {
+      /* If the request is being cancelled then it will be
+         resubmitted when the cancellation completes */
+      if (has_request (source, VSX_MAIN_CONTEXT_REQUEST_MAIN))
+        {
+          if (!accepting)
+            submit_cancel (source, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+        }
+      else if (accepting)
+        submit_accept (source);
+
+      return;
+    }
+#endif
+
+  event.events = accepting ? EPOLLIN : 0;
+  event.data.ptr = source;
+
+  if (epoll_ctl (source->mc->epoll_fd,
+                 EPOLL_CTL_MOD,
+                 source->fd,
+                 &event) == -1)
+    g_warning ("EPOLL_CTL_MOD failed: %s", strerror (errno));
+}
+
+VsxMainContextSource *
+vsx_main_context_add_socket (VsxMainContext *mc,
+                             int fd,
+                             VsxMainContextSocketCallback callback,
+                             void *user_data)
+{
+  VsxMainContextSource *source;
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  source = add_fd_source (mc,
+                          fd,
+                          VSX_MAIN_CONTEXT_SOCKET_SOURCE,
+                          callback,
+                          user_data);
+
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    submit_recv (source);
+  else
+#endif
+    {
+      if (mc->recv_buffer == NULL)
+        mc->recv_buffer = g_malloc (VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE);
+
+      /* The socket is edge-triggered so that the registration never
+         needs to be modified */
+      epoll_add (source, EPOLLIN | EPOLLRDHUP | EPOLLOUT | EPOLLET);
+    }
+
+  return source;
+}
+
+void
+vsx_main_context_stop_receiving (VsxMainContextSource *source)
+{
+  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_SOCKET_SOURCE);
+
+  if (!source->active)
+    return;
+
+  source->active = FALSE;
+
+#ifdef USE_IO_URING
+  if (source->mc->use_io_uring
+      && has_request (source, VSX_MAIN_CONTEXT_REQUEST_MAIN))
+    submit_cancel (source, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+#endif
+}
+
+gboolean
+vsx_main_context_is_receiving (VsxMainContextSource *source)
+{
+  g_return_val_if_fail (source->type == VSX_MAIN_CONTEXT_SOCKET_SOURCE,
+                        FALSE);
+
+#ifdef USE_IO_URING
+  /* The receive request can still complete with some data after it
+     has been cancelled */
+  if (has_request (source, VSX_MAIN_CONTEXT_REQUEST_MAIN))
+    return TRUE;
+#endif
+
+  return source->active;
+}
+
+void
+vsx_main_context_wait_writable (VsxMainContextSource *source)
+{
+  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_SOCKET_SOURCE);
+
+#ifdef USE_IO_URING
+  if (source->mc->use_io_uring)
+    {
+      if (!has_request (source, VSX_MAIN_CONTEXT_REQUEST_WRITABLE))
+        submit_writable_poll (source);
+      return;
+    }
+#endif
+
+  /* The socket is always being polled for writing in edge-triggered
+     mode so the next EPOLLOUT will be after the write blocked */
+  source->want_writable = TRUE;
+}
+
+static void
+vsx_main_context_quit_pipe_cb (VsxMainContextSource *source,
+                               int fd,
+                               VsxMainContextPollFlags flags,
+                               void *user_data)
+{
+  VsxMainContext *mc = user_data;
+  guint8 byte;
+
+  if (read (mc->quit_pipe[0], &byte, sizeof (byte)) == -1)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        g_warning ("Read from quit pipe failed: %s", strerror (errno));
+    }
+  else
+    {
+      VsxMainContextSource *quit_source;
+
+      vsx_list_for_each (quit_source, &mc->quit_sources, quit_link)
+        {
+          VsxMainContextQuitCallback callback = quit_source->callback;
+
+          callback (quit_source, quit_source->user_data);
+        }
+    }
+}
+
+static void
+vsx_main_context_quit_signal_cb (int signum)
+{
+  VsxMainContext *mc = vsx_main_context_quit_context;
+  guint8 byte = 42;
+
+  while (write (mc->quit_pipe[1], &byte, 1) == -1
+         && errno == EINTR);
+}
+
+VsxMainContextSource *
+vsx_main_context_add_quit (VsxMainContext *mc,
+                           VsxMainContextQuitCallback callback,
+                           void *user_data)
+{
+  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  source->mc = mc;
+  source->callback = callback;
+  source->type = VSX_MAIN_CONTEXT_QUIT_SOURCE;
+  source->category = VSX_MAIN_CONTEXT_CATEGORY_QUIT;
+  source->user_data = user_data;
+
+  vsx_list_insert (&mc->quit_sources, &source->quit_link);
+
+  mc->n_sources++;
+
+  if (mc->quit_pipe_source == NULL)
+    {
+      if (pipe (mc->quit_pipe) == -1)
+        g_warning ("Failed to create quit pipe: %s", strerror (errno));
+      else
+        {
+          mc->quit_pipe_source
+            = vsx_main_context_add_poll (mc, mc->quit_pipe[0],
+                                         VSX_MAIN_CONTEXT_POLL_IN,
+                                         vsx_main_context_quit_pipe_cb,
+                                         mc);
+          vsx_main_context_set_source_category (mc->quit_pipe_source,
+                                                VSX_MAIN_CONTEXT_CATEGORY_QUIT);
+
+          vsx_main_context_quit_context = mc;
+
+          mc->old_int_handler =
+            signal (SIGINT, vsx_main_context_quit_signal_cb);
+          mc->old_term_handler =
+            signal (SIGTERM, vsx_main_context_quit_signal_cb);
+        }
+    }
+
+  return source;
+}
+
+/* Records the time since the last profiled step in @histogram */
+static void
+profile_step (VsxMainContext *mc,
+              VsxHistogram *histogram)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  vsx_histogram_record (histogram, now - mc->profile_time);
+  mc->profile_time = now;
+}
+
+static void
+profile_begin_wait (VsxMainContext *mc)
+{
+  mc->profile_time = g_get_monotonic_time ();
+
+  if (mc->wake_time)
+    vsx_histogram_record (&mc->stats.busy_time,
+                          mc->profile_time - mc->wake_time);
+}
+
+static void
+profile_end_wait (VsxMainContext *mc,
+                  int n_events)
+{
+  profile_step (mc, &mc->stats.wait_time);
+  vsx_histogram_record (&mc->stats.n_events, MAX (n_events, 0));
+
+  mc->wake_time = mc->profile_time;
 
   /* Once we've polled we can assume that some time has passed so our
-     cached value of the monotonic clock is no longer valid */
-  mc->monotonic_time_valid = FALSE;
+     cached value of the monotonic clock is no longer valid. We've
+     just read the clock anyway so we can use that instead */
+  mc->monotonic_time = mc->profile_time;
+  mc->monotonic_time_valid = TRUE;
+}
+
+static gint64
+get_timer_ticks (VsxMainContext *mc)
+{
+  return vsx_main_context_get_monotonic_clock (mc) / 1000;
+}
+
+static void
+insert_timer (VsxMainContext *mc,
+              VsxMainContextSource *source)
+{
+  VsxMainContextTimerLevel *level;
+  gint64 expiry = source->expiry;
+  gint64 delta = expiry - mc->timer_base;
+  int level_num, slot;
+
+  if (delta < 0)
+    {
+      /* The timer is already due so put it in the next slot that
+         will be processed */
+      expiry = mc->timer_base;
+      delta = 0;
+    }
+  else if (delta > VSX_MAIN_CONTEXT_TIMER_MAX_DELTA)
+    {
+      delta = VSX_MAIN_CONTEXT_TIMER_MAX_DELTA;
+      expiry = mc->timer_base + delta;
+    }
+
+  for (level_num = 0;
+       delta >> (VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS * (level_num + 1));
+       level_num++);
+
+  slot = ((expiry >> (VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS * level_num)) &
+          VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK);
+  level = mc->timer_levels + level_num;
+
+  /* Add to the end of the list so that timers with the same expiry
+     fire in the order they were added */
+  vsx_list_insert (level->slots[slot].prev, &source->timer_link);
+  level->occupied |= (guint64) 1 << slot;
+
+  source->timer_level = level_num;
+  source->timer_slot = slot;
+}
+
+static void
+detach_timer (VsxMainContextSource *source)
+{
+  VsxMainContextTimerLevel *level;
+
+  vsx_list_remove (&source->timer_link);
+
+  if (source->timer_level == -1)
+    return;
+
+  level = source->mc->timer_levels + source->timer_level;
+
+  if (vsx_list_empty (level->slots + source->timer_slot))
+    level->occupied &= ~((guint64) 1 << source->timer_slot);
+}
+
+static void
+steal_slot (VsxMainContextTimerLevel *level,
+            int slot,
+            VsxList *list)
+{
+  vsx_list_init (list);
+  vsx_list_insert_list (list, level->slots + slot);
+  vsx_list_init (level->slots + slot);
+  level->occupied &= ~((guint64) 1 << slot);
+}
+
+VsxMainContextSource *
+vsx_main_context_add_timer (VsxMainContext *mc,
+                            int milliseconds,
+                            VsxMainContextTimerCallback callback,
+                            void *user_data)
+{
+  VsxMainContextSource *source = g_slice_new (VsxMainContextSource);
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  /* If there are no timers then the wheel might not have been turned
+     for a while so we can just move it to the current time */
+  if (mc->n_timers == 0)
+    mc->timer_base = get_timer_ticks (mc);
+
+  source->mc = mc;
+  source->callback = callback;
+  source->type = VSX_MAIN_CONTEXT_TIMER_SOURCE;
+  source->category = VSX_MAIN_CONTEXT_CATEGORY_TIMER;
+  source->user_data = user_data;
+  source->interval = MAX (milliseconds, 1);
+  source->expiry = get_timer_ticks (mc) + source->interval;
+
+  insert_timer (mc, source);
+
+  mc->n_timers++;
+  mc->n_sources++;
+
+  return source;
+}
+
+void
+vsx_main_context_reschedule_timer (VsxMainContextSource *source,
+                                   int milliseconds)
+{
+  VsxMainContext *mc = source->mc;
+
+  g_return_if_fail (source->type == VSX_MAIN_CONTEXT_TIMER_SOURCE);
+
+  detach_timer (source);
+  source->expiry = get_timer_ticks (mc) + MAX (milliseconds, 0);
+  insert_timer (mc, source);
+}
+
+static void
+remove_fd_source (VsxMainContextSource *source)
+{
+  VsxMainContext *mc = source->mc;
+  struct epoll_event event;
+
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    {
+      if (has_request (source, VSX_MAIN_CONTEXT_REQUEST_MAIN))
+        submit_cancel (source, VSX_MAIN_CONTEXT_REQUEST_MAIN);
+      if (has_request (source, VSX_MAIN_CONTEXT_REQUEST_WRITABLE))
+        submit_cancel (source, VSX_MAIN_CONTEXT_REQUEST_WRITABLE);
+    }
+  else
+#endif
+    {
+      if (epoll_ctl (mc->epoll_fd, EPOLL_CTL_DEL, source->fd, &event) == -1)
+        g_warning ("EPOLL_CTL_DEL failed: %s", strerror (errno));
+    }
+
+  /* Events that haven't been dispatched yet and completions for
+     requests that are still in flight can refer to the source so it
+     is only freed at the end of the iteration once they are all
+     gone */
+  source->dead = TRUE;
+  vsx_list_insert (&mc->dead_sources, &source->dead_link);
+}
+
+static void
+free_dead_sources (VsxMainContext *mc)
+{
+  VsxMainContextSource *source, *tmp_source;
+
+  vsx_list_for_each_safe (source, tmp_source, &mc->dead_sources, dead_link)
+    {
+#ifdef USE_IO_URING
+      if (source->requests)
+        continue;
+#endif
+
+      vsx_list_remove (&source->dead_link);
+      g_slice_free (VsxMainContextSource, source);
+    }
+}
+
+void
+vsx_main_context_remove_source (VsxMainContextSource *source)
+{
+  VsxMainContext *mc = source->mc;
+
+  switch (source->type)
+    {
+    case VSX_MAIN_CONTEXT_POLL_SOURCE:
+    case VSX_MAIN_CONTEXT_ACCEPT_SOURCE:
+    case VSX_MAIN_CONTEXT_SOCKET_SOURCE:
+      remove_fd_source (source);
+      mc->n_sources--;
+      return;
+
+    case VSX_MAIN_CONTEXT_QUIT_SOURCE:
+      vsx_list_remove (&source->quit_link);
+      break;
+
+    case VSX_MAIN_CONTEXT_TIMER_SOURCE:
+      detach_timer (source);
+      mc->n_timers--;
+      break;
+    }
+
+  g_slice_free (VsxMainContextSource, source);
+
+  mc->n_sources--;
+}
+
+/* Returns the offset of the first set bit in @mask starting from
+   @start and wrapping around to the beginning */
+static int
+find_next_slot (guint64 mask,
+                int start)
+{
+  guint64 rotated = mask >> start;
+
+  if (start > 0)
+    rotated |= mask << (VSX_MAIN_CONTEXT_TIMER_LEVEL_SIZE - start);
+
+  return __builtin_ctzll (rotated);
+}
+
+static int
+get_timeout (VsxMainContext *mc)
+{
+  gint64 next_tick = G_MAXINT64, now;
+  int level_num;
+
+  if (mc->n_timers == 0)
+    return -1;
+
+  for (level_num = 0; level_num < VSX_MAIN_CONTEXT_TIMER_N_LEVELS; level_num++)
+    {
+      VsxMainContextTimerLevel *level = mc->timer_levels + level_num;
+      int shift = VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS * level_num;
+      gint64 block, tick;
+
+      if (level->occupied == 0)
+        continue;
+
+      /* The lowest level is processed starting from the current
+         tick. The slots of the higher levels are cascaded when the
+         wheel reaches the start of their block so the earliest
+         one that can be reached is the block after the current one.
+         This may wake up before any timers are actually due but it
+         will never be later */
+      block = (mc->timer_base >> shift) + (level_num > 0);
+      block += find_next_slot (level->occupied,
+                               block & VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK);
+      tick = block << shift;
+
+      if (tick < next_tick)
+        next_tick = tick;
+    }
+
+  now = get_timer_ticks (mc);
+
+  if (next_tick <= now)
+    return 0;
+  else if (next_tick - now > G_MAXINT)
+    return G_MAXINT;
+  else
+    return next_tick - now;
+}
+
+/* Moves the timers in the current slot of the given level down to
+   the lower levels. Returns TRUE if the slot was the first one in
+   the level so that the next level should be cascaded as well */
+static gboolean
+cascade_timers (VsxMainContext *mc,
+                int level_num)
+{
+  VsxMainContextTimerLevel *level = mc->timer_levels + level_num;
+  int shift = VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS * level_num;
+  int slot = (mc->timer_base >> shift) & VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK;
+  VsxMainContextSource *source, *tmp_source;
+  VsxList list;
+
+  if ((level->occupied & ((guint64) 1 << slot)))
+    {
+      steal_slot (level, slot, &list);
+
+      vsx_list_for_each_safe (source, tmp_source, &list, timer_link)
+        insert_timer (mc, source);
+    }
+
+  return slot == 0;
+}
+
+static void
+emit_timers (VsxMainContext *mc)
+{
+  VsxMainContextTimerLevel *level = mc->timer_levels;
+  int slot = mc->timer_base & VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK;
+  VsxMainContextSource *source;
+  VsxList expired;
+
+  if (!(level->occupied & ((guint64) 1 << slot)))
+    return;
+
+  /* The timers are moved to a separate list so that the callbacks
+     can freely add and remove other timers */
+  steal_slot (level, slot, &expired);
+
+  vsx_list_for_each (source, &expired, timer_link)
+    source->timer_level = -1;
+
+  while (!vsx_list_empty (&expired))
+    {
+      VsxMainContextTimerCallback callback;
+      VsxMainContextCategory category;
+
+      source = vsx_container_of (expired.next, source, timer_link);
+      callback = source->callback;
+      category = source->category;
+
+      vsx_histogram_record (&mc->stats.timer_lag,
+                            mc->profile_time - source->expiry * 1000);
+
+      /* Schedule the next invocation before calling the callback so
+         that it can remove or reschedule the timer */
+      vsx_list_remove (&source->timer_link);
+      source->expiry = get_timer_ticks (mc) + source->interval;
+      insert_timer (mc, source);
+
+      callback (source, source->user_data);
+
+      profile_step (mc, mc->stats.callback_time + category);
+    }
+}
+
+static void
+check_timer_sources (VsxMainContext *mc)
+{
+  gint64 now;
+
+  if (mc->n_timers == 0)
+    return;
+
+  now = get_timer_ticks (mc);
+
+  while (mc->timer_base <= now && mc->n_timers > 0)
+    {
+      int level_num;
+      gint64 level_mask;
+
+      /* If the lower levels are empty then there is nothing to do
+         until the next time one of the higher levels would be
+         cascaded so we can skip straight there */
+      for (level_num = 0;
+           level_num < VSX_MAIN_CONTEXT_TIMER_N_LEVELS &&
+             mc->timer_levels[level_num].occupied == 0;
+           level_num++);
+
+      level_mask =
+        ((gint64) 1 << (VSX_MAIN_CONTEXT_TIMER_LEVEL_BITS * level_num)) - 1;
+
+      if ((mc->timer_base & level_mask))
+        {
+          mc->timer_base = MIN ((mc->timer_base | level_mask) + 1, now + 1);
+          continue;
+        }
+
+      if ((mc->timer_base & VSX_MAIN_CONTEXT_TIMER_LEVEL_MASK) == 0)
+        {
+          for (level_num = 1;
+               level_num < VSX_MAIN_CONTEXT_TIMER_N_LEVELS &&
+                 cascade_timers (mc, level_num);
+               level_num++);
+        }
+
+      emit_timers (mc);
+
+      mc->timer_base++;
+    }
+}
+
+static void
+emit_poll_source (VsxMainContextSource *source,
+                  uint32_t events)
+{
+  VsxMainContextPollCallback callback = source->callback;
+  VsxMainContextCategory category = source->category;
+  VsxMainContext *mc = source->mc;
+  VsxMainContextPollFlags flags = 0;
+
+  if (events & EPOLLOUT)
+    flags |= VSX_MAIN_CONTEXT_POLL_OUT;
+  if (events & (EPOLLIN | EPOLLRDHUP))
+    flags |= VSX_MAIN_CONTEXT_POLL_IN;
+  if (events & EPOLLHUP)
+    {
+      /* If the source is polling for read then we'll just mark it
+       * as ready for reading so that any error or EOF will be
+       * handled by the read call instead of immediately aborting */
+      if (source->current_flags & VSX_MAIN_CONTEXT_POLL_IN)
+        flags |= VSX_MAIN_CONTEXT_POLL_IN;
+      else
+        flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
+    }
+  if (events & EPOLLERR)
+    flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
+
+  callback (source, source->fd, flags, source->user_data);
+
+  /* The source might have been removed by the callback so it can't
+     be used anymore */
+  profile_step (mc, mc->stats.callback_time + category);
+}
+
+static void
+emit_accepted_connection (VsxMainContextSource *source,
+                          int fd,
+                          const struct sockaddr *address,
+                          socklen_t address_length,
+                          int error)
+{
+  VsxMainContextAcceptCallback callback = source->callback;
+  VsxMainContext *mc = source->mc;
+
+  callback (source, fd, address, address_length, error, source->user_data);
+
+  profile_step (mc, mc->stats.callback_time + source->category);
+}
+
+/* These errors are caused by the client giving up on its connection
+   so they are just skipped */
+static gboolean
+is_transient_accept_error (int error)
+{
+  return (error == EINTR
+          || error == ECONNABORTED
+          || error == EPROTO);
+}
+
+static void
+emit_accept_source (VsxMainContextSource *source)
+{
+  struct sockaddr_storage address;
+  socklen_t address_length;
+  int n_accepted = 0;
+  int fd;
+
+  /* The callback might stop accepting or remove the source */
+  while (n_accepted < VSX_MAIN_CONTEXT_MAX_ACCEPTS
+         && source->active
+         && !source->dead)
+    {
+      address_length = sizeof (address);
+
+      fd = accept4 (source->fd,
+                    (struct sockaddr *) &address,
+                    &address_length,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (fd == -1)
+        {
+          /* EAGAIN means the queue is empty. This will also happen
+             if another context sharing the same socket accepted the
+             connection first */
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+          if (!is_transient_accept_error (errno))
+            {
+              emit_accepted_connection (source, -1, NULL, 0, errno);
+              break;
+            }
+        }
+      else
+        {
+          emit_accepted_connection (source,
+                                    fd,
+                                    (struct sockaddr *) &address,
+                                    address_length,
+                                    0 /* error */);
+        }
+
+      n_accepted++;
+    }
+}
+
+static void
+emit_socket_event (VsxMainContextSource *source,
+                   const VsxMainContextSocketEvent *event)
+{
+  VsxMainContextSocketCallback callback = source->callback;
+  VsxMainContext *mc = source->mc;
+
+  callback (source, source->fd, event, source->user_data);
+
+  profile_step (mc, mc->stats.callback_time + source->category);
+}
+
+static void
+emit_socket_source (VsxMainContextSource *source,
+                    uint32_t events)
+{
+  VsxMainContext *mc = source->mc;
+  VsxMainContextSocketEvent event;
+  ssize_t got;
+
+  if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && source->want_writable)
+    {
+      source->want_writable = FALSE;
+      event.type = VSX_MAIN_CONTEXT_SOCKET_WRITABLE;
+      emit_socket_event (source, &event);
+    }
+
+  /* Errors and hang-ups are left for recv to report */
+  if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+    return;
+
+  /* The socket is edge-triggered so it has to be read until it would
+     block. The callback might stop receiving or remove the source */
+  while (source->active && !source->dead)
+    {
+      got = recv (source->fd,
+                  mc->recv_buffer,
+                  VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE,
+                  0 /* flags */);
+
+      if (got > 0)
+        {
+          event.type = VSX_MAIN_CONTEXT_SOCKET_DATA;
+          event.data = mc->recv_buffer;
+          event.length = got;
+        }
+      else if (got == 0)
+        {
+          source->active = FALSE;
+          event.type = VSX_MAIN_CONTEXT_SOCKET_EOF;
+        }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      else if (errno == EINTR)
+        continue;
+      else
+        {
+          source->active = FALSE;
+          event.type = VSX_MAIN_CONTEXT_SOCKET_ERROR;
+          event.error = errno;
+        }
+
+      emit_socket_event (source, &event);
+    }
+}
+
+static void
+poll_epoll (VsxMainContext *mc)
+{
+  int timeout = get_timeout (mc);
+  int n_events;
+
+  g_array_set_size (mc->events, mc->n_sources);
+
+  profile_begin_wait (mc);
+
+  n_events = epoll_wait (mc->epoll_fd,
+                         &g_array_index (mc->events,
+                                         struct epoll_event,
+                                         0),
+                         mc->n_sources,
+                         timeout);
+
+  profile_end_wait (mc, n_events);
 
   if (n_events == -1)
     {
@@ -525,30 +1635,18 @@ vsx_main_context_poll (VsxMainContext *mc)
           switch (source->type)
             {
             case VSX_MAIN_CONTEXT_POLL_SOURCE:
-              {
-                VsxMainContextPollCallback callback = source->callback;
-                VsxMainContextPollFlags flags = 0;
-
-                if (event->events & EPOLLOUT)
-                  flags |= VSX_MAIN_CONTEXT_POLL_OUT;
-                if (event->events & (EPOLLIN | EPOLLRDHUP))
-                  flags |= VSX_MAIN_CONTEXT_POLL_IN;
-                if (event->events & EPOLLHUP)
-                  {
-                    /* If the source is polling for read then we'll
-                     * just mark it as ready for reading so that any
-                     * error or EOF will be handled by the read call
-                     * instead of immediately aborting */
-                    if (source->current_flags & VSX_MAIN_CONTEXT_POLL_IN)
-                      flags |= VSX_MAIN_CONTEXT_POLL_IN;
-                    else
-                      flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
-                  }
-                if (event->events & EPOLLERR)
-                  flags |= VSX_MAIN_CONTEXT_POLL_ERROR;
-
-                callback (source, source->fd, flags, source->user_data);
-              }
+              if (!source->dead)
+                emit_poll_source (source, event->events);
+              break;
+
+            case VSX_MAIN_CONTEXT_ACCEPT_SOURCE:
+              if (!source->dead)
+                emit_accept_source (source);
+              break;
+
+            case VSX_MAIN_CONTEXT_SOCKET_SOURCE:
+              if (!source->dead)
+                emit_socket_source (source, event->events);
               break;
 
             case VSX_MAIN_CONTEXT_QUIT_SOURCE:
@@ -560,6 +1658,278 @@ vsx_main_context_poll (VsxMainContext *mc)
 
       check_timer_sources (mc);
     }
+
+  free_dead_sources (mc);
+}
+
+#ifdef USE_IO_URING
+
+static void
+handle_poll_cqe (VsxMainContextSource *source,
+                 const struct io_uring_cqe *cqe,
+                 gboolean more)
+{
+  if (source->dead)
+    return;
+
+  if (cqe->res < 0)
+    {
+      /* The poll request has failed so report it as an error on the
+         source. The request won't be resubmitted */
+      g_warning ("io_uring poll failed: %s", strerror (-cqe->res));
+      emit_poll_source (source, EPOLLERR);
+      return;
+    }
+
+  /* The kernel can end a multishot request at any time, for example
+     if it runs out of memory, so it needs to be resubmitted. This is
+     done before calling the callback so that the callback is free to
+     modify or remove the source */
+  if (!more)
+    submit_poll_add (source);
+
+  emit_poll_source (source, cqe->res);
+}
+
+static void
+handle_accept_cqe (VsxMainContextSource *source,
+                   const struct io_uring_cqe *cqe,
+                   gboolean more)
+{
+  struct sockaddr_storage address;
+  socklen_t address_length = sizeof (address);
+  int fd = cqe->res;
+
+  if (source->dead)
+    {
+      if (fd >= 0)
+        close (fd);
+      return;
+    }
+
+  if (fd >= 0)
+    {
+      if (!more && source->active)
+        submit_accept (source);
+
+      /* If the client has already gone then there is no need to
+         report it */
+      if (getpeername (fd,
+                       (struct sockaddr *) &address,
+                       &address_length) == -1)
+        close (fd);
+      else
+        emit_accepted_connection (source,
+                                  fd,
+                                  (struct sockaddr *) &address,
+                                  address_length,
+                                  0 /* error */);
+    }
+  else
+    {
+      /* A cancelled request is either not wanted anymore or has
+         been resumed since, in which case it is resubmitted below */
+      if (fd != -ECANCELED && !is_transient_accept_error (-fd))
+        emit_accepted_connection (source, -1, NULL, 0, -fd);
+
+      /* The request is resubmitted after the callback so that it
+         can stop accepting when it gets an error */
+      if (!source->dead
+          && source->active
+          && !has_request (source, VSX_MAIN_CONTEXT_REQUEST_MAIN))
+        submit_accept (source);
+    }
+}
+
+static void
+handle_recv_cqe (VsxMainContextSource *source,
+                 const struct io_uring_cqe *cqe,
+                 gboolean more)
+{
+  VsxMainContext *mc = source->mc;
+  VsxMainContextSocketEvent event;
+  int buffer_id = -1;
+
+  if ((cqe->flags & IORING_CQE_F_BUFFER))
+    buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (source->dead)
+    {
+      /* The data is dropped along with the source */
+    }
+  else if (cqe->res > 0 && buffer_id != -1)
+    {
+      if (!more && source->active)
+        submit_recv (source);
+
+      event.type = VSX_MAIN_CONTEXT_SOCKET_DATA;
+      event.data = mc->recv_buffers +
+        buffer_id * VSX_MAIN_CONTEXT_RECV_BUFFER_SIZE;
+      event.length = cqe->res;
+      emit_socket_event (source, &event);
+    }
+  else if (cqe->res == 0)
+    {
+      source->active = FALSE;
+      event.type = VSX_MAIN_CONTEXT_SOCKET_EOF;
+      emit_socket_event (source, &event);
+    }
+  else if (cqe->res == -ECANCELED || cqe->res == -ENOBUFS)
+    {
+      /* The request was either cancelled because receiving was
+         stopped or it ran out of buffers. The buffers from this
+         iteration are given back before the next submission so the
+         request can just be tried again */
+      if (source->active)
+        submit_recv (source);
+      else
+        {
+          event.type = VSX_MAIN_CONTEXT_SOCKET_STOPPED;
+          emit_socket_event (source, &event);
+        }
+    }
+  else
+    {
+      source->active = FALSE;
+      event.type = VSX_MAIN_CONTEXT_SOCKET_ERROR;
+      event.error = cqe->res < 0 ? -cqe->res : EIO;
+      emit_socket_event (source, &event);
+    }
+
+  if (buffer_id != -1)
+    recycle_buffer (mc, buffer_id);
+}
+
+static void
+handle_writable_cqe (VsxMainContextSource *source,
+                     const struct io_uring_cqe *cqe)
+{
+  VsxMainContextSocketEvent event;
+
+  if (source->dead || cqe->res == -ECANCELED)
+    return;
+
+  /* Any errors will be reported by the next write */
+  event.type = VSX_MAIN_CONTEXT_SOCKET_WRITABLE;
+  emit_socket_event (source, &event);
+}
+
+static void
+handle_cqe (VsxMainContext *mc,
+            const struct io_uring_cqe *cqe)
+{
+  void *data = io_uring_cqe_get_data (cqe);
+  gboolean more = !!(cqe->flags & IORING_CQE_F_MORE);
+  VsxMainContextRequestType request_type;
+  VsxMainContextSource *source;
+
+  if (data == mc)
+    {
+      /* This is the result of a poll update. If the poll request
+         had already finished then it will be resubmitted with the
+         new flags so -ENOENT is expected */
+      if (cqe->res < 0 && cqe->res != -ENOENT)
+        g_warning ("io_uring poll update failed: %s", strerror (-cqe->res));
+      return;
+    }
+
+  /* Completions for cancellations have no source */
+  if (data == NULL)
+    return;
+
+  source = (VsxMainContextSource *)
+    ((uintptr_t) data & ~(uintptr_t) VSX_MAIN_CONTEXT_REQUEST_TYPE_MASK);
+  request_type = (uintptr_t) data & VSX_MAIN_CONTEXT_REQUEST_TYPE_MASK;
+
+  /* The request is finished unless the kernel says there is more to
+     come. This is updated before invoking any callbacks so that they
+     see the current state */
+  if (!more)
+    source->requests &= ~(1 << request_type);
+
+  switch (source->type)
+    {
+    case VSX_MAIN_CONTEXT_POLL_SOURCE:
+      handle_poll_cqe (source, cqe, more);
+      break;
+
+    case VSX_MAIN_CONTEXT_ACCEPT_SOURCE:
+      handle_accept_cqe (source, cqe, more);
+      break;
+
+    case VSX_MAIN_CONTEXT_SOCKET_SOURCE:
+      if (request_type == VSX_MAIN_CONTEXT_REQUEST_WRITABLE)
+        handle_writable_cqe (source, cqe);
+      else
+        handle_recv_cqe (source, cqe, more);
+      break;
+
+    case VSX_MAIN_CONTEXT_QUIT_SOURCE:
+    case VSX_MAIN_CONTEXT_TIMER_SOURCE:
+      g_warn_if_reached ();
+      break;
+    }
+}
+
+static void
+poll_io_uring (VsxMainContext *mc)
+{
+  struct __kernel_timespec ts, *tsp = NULL;
+  struct io_uring_cqe *cqe;
+  unsigned int head, n_cqes = 0;
+  int timeout = get_timeout (mc);
+  int ret;
+
+  if (timeout >= 0)
+    {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = timeout % 1000 * 1000000;
+      tsp = &ts;
+    }
+
+  /* This submits all of the requests that were queued since the last
+     iteration and waits for the next completion in a single system
+     call */
+  profile_begin_wait (mc);
+
+  ret = io_uring_submit_and_wait_timeout (&mc->ring, &cqe, 1, tsp, NULL);
+
+  profile_end_wait (mc, io_uring_cq_ready (&mc->ring));
+
+  if (ret < 0 && ret != -ETIME && ret != -EINTR)
+    {
+      g_warning ("io_uring_submit_and_wait_timeout failed: %s",
+                 strerror (-ret));
+      return;
+    }
+
+  io_uring_for_each_cqe (&mc->ring, head, cqe)
+    {
+      handle_cqe (mc, cqe);
+      n_cqes++;
+    }
+
+  io_uring_cq_advance (&mc->ring, n_cqes);
+
+  check_timer_sources (mc);
+
+  free_dead_sources (mc);
+}
+
+#endif /* USE_IO_URING */
+
+void
+vsx_main_context_poll (VsxMainContext *mc)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    poll_io_uring (mc);
+  else
+#endif
+    poll_epoll (mc);
 }
 
 gint64
@@ -593,17 +1963,71 @@ vsx_main_context_free (VsxMainContext *mc)
       vsx_main_context_remove_source (mc->quit_pipe_source);
       close (mc->quit_pipe[0]);
       close (mc->quit_pipe[1]);
+
+      if (mc == vsx_main_context_quit_context)
+        vsx_main_context_quit_context = NULL;
     }
 
   if (mc->n_sources > 0)
     g_warning ("Sources still remain on a main context that is being freed");
 
+#ifdef USE_IO_URING
+  if (mc->use_io_uring)
+    {
+      VsxMainContextSource *source;
+
+      free_buffer_ring (mc);
+      io_uring_queue_exit (&mc->ring);
+
+      /* No more completions can arrive now so all of the sources can
+         be freed */
+      vsx_list_for_each (source, &mc->dead_sources, dead_link)
+        source->requests = 0;
+    }
+  else
+#endif
+    close (mc->epoll_fd);
+
+  free_dead_sources (mc);
+  g_free (mc->recv_buffer);
+
   g_array_free (mc->events, TRUE);
-  close (mc->epoll_fd);
+  if (mc == g_private_get (&vsx_main_context_default))
+    g_private_set (&vsx_main_context_default, NULL);
+
   g_free (mc);
+}
+
+void
+vsx_main_context_set_source_category (VsxMainContextSource *source,
+                                      VsxMainContextCategory category)
+{
+  source->category = category;
+}
+
+const VsxMainContextStats *
+vsx_main_context_get_stats (VsxMainContext *mc)
+{
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
+
+  return &mc->stats;
+}
+
+void
+vsx_main_context_reset_stats (VsxMainContext *mc)
+{
+  int i;
+
+  if (mc == NULL)
+    mc = vsx_main_context_get_default_or_abort ();
 
-  if (mc == vsx_main_context_default)
-    vsx_main_context_default = NULL;
+  vsx_histogram_reset (&mc->stats.wait_time);
+  vsx_histogram_reset (&mc->stats.busy_time);
+  vsx_histogram_reset (&mc->stats.n_events);
+  for (i = 0; i < VSX_MAIN_CONTEXT_N_CATEGORIES; i++)
+    vsx_histogram_reset (mc->stats.callback_time + i);
+  vsx_histogram_reset (&mc->stats.timer_lag);
 }
 
 GQuark
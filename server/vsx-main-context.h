@@ -20,6 +20,9 @@
 #define __VSX_MAIN_CONTEXT_H__
 
 #include <glib.h>
+#include <sys/socket.h>
+
+#include "vsx-histogram.h"
 
 G_BEGIN_DECLS
 
@@ -34,8 +37,42 @@ typedef enum
   VSX_MAIN_CONTEXT_POLL_IN = 1 << 0,
   VSX_MAIN_CONTEXT_POLL_OUT = 1 << 1,
   VSX_MAIN_CONTEXT_POLL_ERROR = 1 << 2,
+  /* If this is set when adding a poll source then the callback will
+     only be invoked when the state of the file descriptor changes.
+     The callback must then read or write until it would block before
+     it can expect to be notified again. The flag can't be changed
+     after the source is added */
+  VSX_MAIN_CONTEXT_POLL_EDGE_TRIGGERED = 1 << 3
 } VsxMainContextPollFlags;
 
+/* Category used to group the time spent in callbacks for the
+   statistics */
+typedef enum
+{
+  VSX_MAIN_CONTEXT_CATEGORY_OTHER,
+  VSX_MAIN_CONTEXT_CATEGORY_ACCEPT,
+  VSX_MAIN_CONTEXT_CATEGORY_CONNECTION,
+  VSX_MAIN_CONTEXT_CATEGORY_TIMER,
+  VSX_MAIN_CONTEXT_CATEGORY_QUIT,
+
+  VSX_MAIN_CONTEXT_N_CATEGORIES
+} VsxMainContextCategory;
+
+typedef struct
+{
+  /* Time in microseconds spent blocking in the kernel */
+  VsxHistogram wait_time;
+  /* Time in microseconds between waking up and blocking again */
+  VsxHistogram busy_time;
+  /* Number of events returned by each wait */
+  VsxHistogram n_events;
+  /* Time in microseconds spent in each callback */
+  VsxHistogram callback_time[VSX_MAIN_CONTEXT_N_CATEGORIES];
+  /* Time in microseconds between when a timer was due and when its
+     callback was invoked */
+  VsxHistogram timer_lag;
+} VsxMainContextStats;
+
 #define VSX_MAIN_CONTEXT_ERROR (vsx_main_context_error_quark ())
 
 typedef struct _VsxMainContext VsxMainContext;
@@ -46,6 +83,53 @@ typedef void (* VsxMainContextPollCallback) (VsxMainContextSource *source,
                                              VsxMainContextPollFlags flags,
                                              void *user_data);
 
+/* Called for each connection accepted on a listening socket. The new
+   socket is non-blocking. If accepting fails then fd is -1 and error
+   is the errno value. Errors caused by a client giving up on its
+   connection are ignored */
+typedef void (* VsxMainContextAcceptCallback) (VsxMainContextSource *source,
+                                               int fd,
+                                               const struct sockaddr *address,
+                                               socklen_t address_length,
+                                               int error,
+                                               void *user_data);
+
+typedef enum
+{
+  /* Data was received from the socket. The data is only valid until
+     the callback returns */
+  VSX_MAIN_CONTEXT_SOCKET_DATA,
+  /* The other end has closed the connection. No more data will be
+     received */
+  VSX_MAIN_CONTEXT_SOCKET_EOF,
+  /* Receiving has finished after vsx_main_context_stop_receiving was
+     called. This is only sent if it couldn't stop straight away */
+  VSX_MAIN_CONTEXT_SOCKET_STOPPED,
+  /* The socket might be writable again after
+     vsx_main_context_wait_writable was called */
+  VSX_MAIN_CONTEXT_SOCKET_WRITABLE,
+  /* Reading from the socket failed. No more data will be received */
+  VSX_MAIN_CONTEXT_SOCKET_ERROR
+} VsxMainContextSocketEventType;
+
+typedef struct
+{
+  VsxMainContextSocketEventType type;
+
+  /* Only used for VSX_MAIN_CONTEXT_SOCKET_DATA */
+  const guint8 *data;
+  size_t length;
+
+  /* The errno value for VSX_MAIN_CONTEXT_SOCKET_ERROR */
+  int error;
+} VsxMainContextSocketEvent;
+
+typedef void (* VsxMainContextSocketCallback)
+     (VsxMainContextSource *source,
+      int fd,
+      const VsxMainContextSocketEvent *event,
+      void *user_data);
+
 typedef void (* VsxMainContextTimerCallback) (VsxMainContextSource *source,
                                               void *user_data);
 
@@ -69,6 +153,49 @@ void
 vsx_main_context_modify_poll (VsxMainContextSource *source,
                               VsxMainContextPollFlags flags);
 
+/* Accepts connections from a listening socket. When io_uring is
+   used this is done with a single multishot request so accepting a
+   connection doesn't need any system calls */
+VsxMainContextSource *
+vsx_main_context_add_accept (VsxMainContext *mc,
+                             int fd,
+                             VsxMainContextAcceptCallback callback,
+                             void *user_data);
+
+/* Temporarily stops accepting connections, for example when the
+   process runs out of file descriptors */
+void
+vsx_main_context_set_accepting (VsxMainContextSource *source,
+                                gboolean accepting);
+
+/* Receives data from a connected non-blocking socket and passes it to
+   the callback as it arrives. When io_uring is used this is done with
+   a multishot receive into buffers shared by the whole context so
+   receiving doesn't need any system calls. Writing is left to the
+   caller, which should assume that the socket is writable until a
+   write would block */
+VsxMainContextSource *
+vsx_main_context_add_socket (VsxMainContext *mc,
+                             int fd,
+                             VsxMainContextSocketCallback callback,
+                             void *user_data);
+
+/* Stops receiving data on a socket source. Data that was already
+   received can still be passed to the callback afterwards. Once
+   vsx_main_context_is_receiving returns FALSE no more data will
+   arrive and the socket can be passed to another context */
+void
+vsx_main_context_stop_receiving (VsxMainContextSource *source);
+
+gboolean
+vsx_main_context_is_receiving (VsxMainContextSource *source);
+
+/* Should be called when a write to a socket source would block. A
+   VSX_MAIN_CONTEXT_SOCKET_WRITABLE event is sent once there is space
+   again */
+void
+vsx_main_context_wait_writable (VsxMainContextSource *source);
+
 VsxMainContextSource *
 vsx_main_context_add_quit (VsxMainContext *mc,
                            VsxMainContextQuitCallback callback,
@@ -76,13 +203,27 @@ vsx_main_context_add_quit (VsxMainContext *mc,
 
 VsxMainContextSource *
 vsx_main_context_add_timer (VsxMainContext *mc,
-                            int minutes,
+                            int milliseconds,
                             VsxMainContextTimerCallback callback,
                             void *user_data);
 
+void
+vsx_main_context_reschedule_timer (VsxMainContextSource *source,
+                                   int milliseconds);
+
 void
 vsx_main_context_remove_source (VsxMainContextSource *source);
 
+void
+vsx_main_context_set_source_category (VsxMainContextSource *source,
+                                      VsxMainContextCategory category);
+
+const VsxMainContextStats *
+vsx_main_context_get_stats (VsxMainContext *mc);
+
+void
+vsx_main_context_reset_stats (VsxMainContext *mc);
+
 void
 vsx_main_context_poll (VsxMainContext *mc);
 
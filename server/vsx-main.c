@@ -30,6 +30,7 @@
 #include <pwd.h>
 
 #include "vsx-server.h"
+#include "vsx-conversation.h"
 #include "vsx-main-context.h"
 #include "vsx-log.h"
 
@@ -39,6 +40,11 @@ static char *option_log_file = NULL;
 static gboolean option_daemonize = FALSE;
 static char *option_user = NULL;
 static char *option_group = NULL;
+static int option_n_workers = 1;
+static int option_backlog = 1024;
+static int option_flush_window = 0;
+static int option_message_history = 256;
+static int option_message_budget = 64 * 1024;
 
 static GOptionEntry
 options[] =
@@ -67,6 +73,30 @@ options[] =
       "group", 'g', 0, G_OPTION_ARG_STRING, &option_group,
       "Run the daemon as GROUP", "GROUP"
     },
+    {
+      "workers", 'w', 0, G_OPTION_ARG_INT, &option_n_workers,
+      "Number of worker threads to handle connections", "N"
+    },
+    {
+      "backlog", 'b', 0, G_OPTION_ARG_INT, &option_backlog,
+      "Maximum number of pending connections on the listening socket",
+      "N"
+    },
+    {
+      "flush-window", 'f', 0, G_OPTION_ARG_INT, &option_flush_window,
+      "Time to collect tile and player changes before sending them "
+      "(default 0, send immediately)", "MS"
+    },
+    {
+      "message-history", 0, 0, G_OPTION_ARG_INT, &option_message_history,
+      "Maximum number of chat messages to keep for each game "
+      "(default 256)", "N"
+    },
+    {
+      "message-budget", 0, 0, G_OPTION_ARG_INT, &option_message_budget,
+      "Number of bytes to use for the chat messages of each game "
+      "(default 65536)", "BYTES"
+    },
     { NULL, 0, 0, 0, NULL, NULL, NULL }
   };
 
@@ -96,6 +126,37 @@ process_arguments (int *argc, char ***argv,
                    "Unknown option '%s'", (* argv)[1]);
       ret = FALSE;
     }
+  else if (ret && option_n_workers < 1)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The number of workers must be at least 1");
+      ret = FALSE;
+    }
+  else if (ret && option_backlog < 1)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The backlog must be at least 1");
+      ret = FALSE;
+    }
+  else if (ret && option_flush_window < 0)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The flush window can't be negative");
+      ret = FALSE;
+    }
+  else if (ret && option_message_history < 1)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The message history must be at least 1");
+      ret = FALSE;
+    }
+  else if (ret && option_message_budget < VSX_CONVERSATION_MIN_MESSAGE_BUDGET)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "The message budget must be at least %i",
+                   VSX_CONVERSATION_MIN_MESSAGE_BUDGET);
+      ret = FALSE;
+    }
 
   return ret;
 }
@@ -117,7 +178,10 @@ create_server (GError **error)
       GSocketAddress *address = g_inet_socket_address_new (inet_address,
                                                            option_listen_port);
 
-      server = vsx_server_new (address, error);
+      server = vsx_server_new (address,
+                               option_n_workers,
+                               option_backlog,
+                               error);
 
       g_object_unref (address);
       g_object_unref (inet_address);
@@ -222,6 +286,10 @@ main (int argc, char **argv)
       return EXIT_FAILURE;
     }
 
+  vsx_conversation_set_default_flush_window (option_flush_window);
+  vsx_conversation_set_history_limits (option_message_history,
+                                       option_message_budget);
+
   mc = vsx_main_context_get_default (&error);
 
   if (mc == NULL)
@@ -63,13 +63,13 @@ real_request_line_received (VsxRequestHandler *handler,
 
       if (self->person == NULL)
         self->response =
-          vsx_string_response_new (VSX_STRING_RESPONSE_NOT_FOUND);
+          vsx_string_response_get (VSX_STRING_RESPONSE_NOT_FOUND);
       else
         {
           if (self->tile_num >= self->person->conversation->n_tiles_in_play)
             {
               self->response =
-                vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+                vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
               self->person = NULL;
             }
           else
@@ -77,7 +77,7 @@ real_request_line_received (VsxRequestHandler *handler,
         }
     }
   else
-    self->response = vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+    self->response = vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
 }
 
 static VsxResponse *
@@ -94,7 +94,7 @@ real_request_finished (VsxRequestHandler *handler)
                                     self->x,
                                     self->y);
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_OK);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_OK);
     }
   else if (self->response)
     return vsx_object_ref (self->response);
@@ -102,7 +102,7 @@ real_request_finished (VsxRequestHandler *handler)
     {
       g_warn_if_reached ();
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
     }
 }
 
@@ -110,15 +110,19 @@ static const VsxRequestHandlerClass *
 vsx_move_tile_handler_get_class (void)
 {
   static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_request_handler_get_class ();
       klass.parent_class.instance_size = sizeof (VsxMoveTileHandler);
+      klass.parent_class.name = "VsxMoveTileHandler";
       klass.parent_class.free = real_free;
 
       klass.request_line_received = real_request_line_received;
       klass.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -45,14 +45,34 @@ real_request_line_received (VsxRequestHandler *handler,
                             const char *query_string)
 {
   VsxNewPersonHandler *self = (VsxNewPersonHandler *) handler;
+  char *encoding_name;
 
   if (method != VSX_REQUEST_METHOD_GET)
     return;
 
-  if (!vsx_arguments_parse ("nn",
-                            query_string,
-                            &self->room_name,
-                            &self->player_name))
+  self->encoding = VSX_FORMAT_ENCODING_JSON;
+
+  /* The encoding is optional so that older clients still work */
+  if (vsx_arguments_parse ("nns",
+                           query_string,
+                           &self->room_name,
+                           &self->player_name,
+                           &encoding_name))
+    {
+      if (!vsx_format_parse_encoding (encoding_name, &self->encoding))
+        {
+          g_free (self->room_name);
+          g_free (self->player_name);
+          self->room_name = NULL;
+          self->player_name = NULL;
+        }
+
+      g_free (encoding_name);
+    }
+  else if (!vsx_arguments_parse ("nn",
+                                 query_string,
+                                 &self->room_name,
+                                 &self->player_name))
     {
       self->room_name = NULL;
       self->player_name = NULL;
@@ -75,7 +95,9 @@ real_request_finished (VsxRequestHandler *handler)
                                                self->room_name);
       person = vsx_person_set_generate_person (handler->person_set,
                                                self->player_name,
-                                               handler->socket_address,
+                                               (const struct sockaddr *)
+                                               &handler->socket_address,
+                                               handler->socket_address_length,
                                                conversation);
 
       if (conversation->n_players == 1)
@@ -88,13 +110,16 @@ real_request_finished (VsxRequestHandler *handler)
                  self->player_name,
                  conversation->id);
 
-      response = vsx_watch_person_response_new (person, person->message_offset);
+      response = vsx_watch_person_response_new (person,
+                                                person->message_offset,
+                                                0, /* last_version */
+                                                self->encoding);
 
       vsx_object_unref (conversation);
       vsx_object_unref (person);
     }
   else
-    response = vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+    response = vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
 
   return response;
 }
@@ -103,15 +128,19 @@ static const VsxRequestHandlerClass *
 vsx_new_person_handler_get_class (void)
 {
   static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_request_handler_get_class ();
       klass.parent_class.instance_size = sizeof (VsxNewPersonHandler);
+      klass.parent_class.name = "VsxNewPersonHandler";
       klass.parent_class.free = real_free;
 
       klass.request_line_received = real_request_line_received;
       klass.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -24,6 +24,7 @@
 #include "vsx-request-handler.h"
 #include "vsx-conversation-set.h"
 #include "vsx-person-set.h"
+#include "vsx-format.h"
 
 G_BEGIN_DECLS
 
@@ -33,6 +34,7 @@ typedef struct
 
   char *room_name;
   char *player_name;
+  VsxFormatEncoding encoding;
 } VsxNewPersonHandler;
 
 VsxRequestHandler *
@@ -23,6 +23,47 @@
 #include <glib.h>
 
 #include "vsx-object.h"
+#include "vsx-slab.h"
+
+struct _VsxObjectSlab
+{
+  VsxSlab slab;
+
+  /* The class that the slab was created for. Subclasses copy the
+     class of their parent so this is used to notice when the slab
+     pointer was inherited */
+  const VsxObjectClass *klass;
+};
+
+/* Protects creating the slabs for the classes */
+static GMutex vsx_object_slab_mutex;
+
+static VsxSlab *
+get_class_slab (const VsxObjectClass *const_klass)
+{
+  VsxObjectClass *klass = (VsxObjectClass *) const_klass;
+  VsxObjectSlab *object_slab = g_atomic_pointer_get (&klass->slab);
+
+  if (G_LIKELY (object_slab && object_slab->klass == klass))
+    return &object_slab->slab;
+
+  g_mutex_lock (&vsx_object_slab_mutex);
+
+  object_slab = klass->slab;
+
+  if (object_slab == NULL || object_slab->klass != klass)
+    {
+      object_slab = g_new0 (VsxObjectSlab, 1);
+      object_slab->slab.name = klass->name;
+      object_slab->slab.size = klass->instance_size;
+      object_slab->klass = klass;
+      g_atomic_pointer_set (&klass->slab, object_slab);
+    }
+
+  g_mutex_unlock (&vsx_object_slab_mutex);
+
+  return &object_slab->slab;
+}
 
 void
 vsx_object_init (void *object)
@@ -36,7 +77,7 @@ void *
 vsx_object_allocate (const void *klass)
 {
   const VsxObjectClass *object_class = klass;
-  VsxObject *obj = g_slice_alloc0 (object_class->instance_size);
+  VsxObject *obj = vsx_slab_alloc0 (get_class_slab (object_class));
 
   obj->klass = klass;
 
@@ -47,20 +88,23 @@ static void
 vsx_object_free (void *object)
 {
   VsxObject *obj = object;
-  const VsxObjectClass *klass = obj->klass;
 
-  g_slice_free1 (klass->instance_size, object);
+  vsx_slab_free (get_class_slab (obj->klass), object);
 }
 
 const VsxObjectClass *
 vsx_object_get_class (void)
 {
   static VsxObjectClass klass;
+  static gsize initialized = 0;
 
-  if (klass.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass.instance_size = sizeof (VsxObject);
+      klass.name = "VsxObject";
       klass.free = vsx_object_free;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -71,7 +115,8 @@ vsx_object_ref (void *object)
 {
   VsxObject *obj = object;
 
-  obj->ref_count++;
+  if (obj->ref_count > 0)
+    obj->ref_count++;
 
   return object;
 }
@@ -81,6 +126,6 @@ vsx_object_unref (void *object)
 {
   VsxObject *obj = object;
 
-  if (--obj->ref_count < 1)
+  if (obj->ref_count > 0 && --obj->ref_count < 1)
     obj->klass->free (obj);
 }
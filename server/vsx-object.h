@@ -23,17 +23,29 @@
 
 G_BEGIN_DECLS
 
+typedef struct _VsxObjectSlab VsxObjectSlab;
+
 typedef struct
 {
   size_t instance_size;
 
+  /* Name of the type used for the allocation statistics */
+  const char *name;
+
   void (* free) (void *object);
+
+  /* Private. The slab used to allocate the instances. This is
+     created the first time an object of this class is allocated */
+  VsxObjectSlab *slab;
 } VsxObjectClass;
 
 typedef struct
 {
   const VsxObjectClass *klass;
 
+  /* Statically allocated objects have a ref_count of zero. They are
+     never freed and referencing them does nothing, so they can be
+     shared between threads */
   unsigned int ref_count;
 } VsxObject;
 
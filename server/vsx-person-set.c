@@ -24,14 +24,21 @@
 
 #include "vsx-person-set.h"
 
-#define VSX_PERSON_SET_REMOVE_SILENT_PEOPLE_INTERVAL 5
+/* Interval time in milliseconds to check for silent people */
+#define VSX_PERSON_SET_REMOVE_SILENT_PEOPLE_INTERVAL (5 * 60 * 1000)
 
 static void
 vsx_person_set_free (void *object)
 {
   VsxPersonSet *self = object;
+  VsxPerson *person, *tmp;
 
-  g_hash_table_destroy (self->hash_table);
+  /* Every person is in the idle list so this drops all of the
+     references held by the set */
+  vsx_list_for_each_safe (person, tmp, &self->idle_people, idle_link)
+    vsx_object_unref (person);
+
+  vsx_person_table_destroy (&self->table);
 
   if (self->people_timer_source)
     vsx_main_context_remove_source (self->people_timer_source);
@@ -43,49 +50,48 @@ static const VsxObjectClass *
 vsx_person_set_get_class (void)
 {
   static VsxObjectClass klass;
+  static gsize initialized = 0;
 
-  if (klass.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_object_get_class ();
       klass.instance_size = sizeof (VsxPersonSet);
+      klass.name = "VsxPersonSet";
       klass.free = vsx_person_set_free;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
 }
 
-static gboolean
-remove_silent_people_cb (gpointer key,
-                         gpointer value,
-                         gpointer user_data)
+static void
+remove_silent_people_timer_cb (VsxMainContextSource *source,
+                               void *user_data)
 {
-  VsxPerson *person = value;
+  VsxPersonSet *set = user_data;
 
-  if (vsx_person_is_silent (person))
+  /* The people are kept in order of when they last made a noise so
+     we only need to look at the head of the list until we find
+     someone who isn't silent */
+  while (!vsx_list_empty (&set->idle_people))
     {
+      VsxPerson *person = vsx_container_of (set->idle_people.next,
+                                            person,
+                                            idle_link);
+
+      if (!vsx_person_is_silent (person))
+        break;
+
       if (person->conversation)
         vsx_person_leave_conversation (person);
 
-      return TRUE;
+      vsx_list_remove (&person->idle_link);
+      vsx_person_table_remove (&set->table, person->id);
+      vsx_object_unref (person);
     }
-  else
-    return FALSE;
-}
 
-static void
-remove_silent_people_timer_cb (VsxMainContextSource *source,
-                               void *user_data)
-{
-  VsxPersonSet *set = user_data;
-
-  /* This is probably relatively expensive because it has to iterate
-     the entire list of people, but it only happens infrequently so
-     hopefully it's not a problem */
-  g_hash_table_foreach_remove (set->hash_table,
-                               remove_silent_people_cb,
-                               NULL);
-
-  if (g_hash_table_size (set->hash_table) == 0)
+  if (set->table.n_entries == 0)
     {
       vsx_main_context_remove_source (source);
       set->people_timer_source = NULL;
@@ -99,14 +105,27 @@ vsx_person_set_new (void)
 
   vsx_object_init (self);
 
-  self->hash_table = g_hash_table_new_full (vsx_person_id_hash,
-                                            vsx_person_id_equal,
-                                            NULL,
-                                            (GDestroyNotify) vsx_object_unref);
+  vsx_person_table_init (&self->table);
+
+  vsx_list_init (&self->idle_people);
+
+  self->n_partitions = 1;
+  self->partition = 0;
 
   return self;
 }
 
+void
+vsx_person_set_set_partition (VsxPersonSet *set,
+                              unsigned int n_partitions,
+                              unsigned int partition)
+{
+  g_return_if_fail (partition < n_partitions);
+
+  set->n_partitions = n_partitions;
+  set->partition = partition;
+}
+
 VsxPerson *
 vsx_person_set_activate_person (VsxPersonSet *set,
                                 VsxPersonId id)
@@ -114,7 +133,13 @@ vsx_person_set_activate_person (VsxPersonSet *set,
   VsxPerson *person = vsx_person_set_get_person (set, id);
 
   if (person)
-    vsx_person_make_noise (person);
+    {
+      vsx_person_make_noise (person);
+
+      /* Move the person to the end of the list to keep it in order */
+      vsx_list_remove (&person->idle_link);
+      vsx_list_insert (set->idle_people.prev, &person->idle_link);
+    }
 
   return person;
 }
@@ -123,13 +148,14 @@ VsxPerson *
 vsx_person_set_get_person (VsxPersonSet *set,
                            VsxPersonId id)
 {
-  return g_hash_table_lookup (set->hash_table, &id);
+  return vsx_person_table_lookup (&set->table, id);
 }
 
 VsxPerson *
 vsx_person_set_generate_person (VsxPersonSet *set,
                                 const char *player_name,
-                                GSocketAddress *address,
+                                const struct sockaddr *address,
+                                socklen_t address_length,
                                 VsxConversation *conversation)
 {
   VsxPerson *person;
@@ -138,12 +164,21 @@ vsx_person_set_generate_person (VsxPersonSet *set,
   /* Keep generating ids until we find one that isn't used. It's
      hopefully pretty unlikely that it will generate a clash */
   do
-    id = vsx_person_generate_id (address);
-  while (vsx_person_set_get_person (set, id));
+    {
+      id = vsx_person_generate_id (address, address_length);
+      /* Move the id into our partition. If this overflows then the
+         remainder will be wrong and we'll just try again */
+      id = id - id % set->n_partitions + set->partition;
+    }
+  while (id % set->n_partitions != set->partition
+         || vsx_person_set_get_person (set, id));
 
   person = vsx_person_new (id, player_name, conversation);
 
-  g_hash_table_insert (set->hash_table, &person->id, vsx_object_ref (person));
+  /* The set keeps a reference to the person until it is removed
+     from the idle list */
+  vsx_person_table_insert (&set->table, vsx_object_ref (person));
+  vsx_list_insert (set->idle_people.prev, &person->idle_link);
 
   if (set->people_timer_source == NULL)
     set->people_timer_source =
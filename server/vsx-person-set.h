@@ -23,6 +23,7 @@
 #include <gio/gio.h>
 
 #include "vsx-person.h"
+#include "vsx-person-table.h"
 #include "vsx-object.h"
 #include "vsx-main-context.h"
 
@@ -32,14 +33,29 @@ typedef struct
 {
   VsxObject parent;
 
-  GHashTable *hash_table;
+  VsxPersonTable table;
+
+  /* List of all the people in the set ordered by the time they last
+     made a noise, so the silent people are always at the head */
+  VsxList idle_people;
 
   VsxMainContextSource *people_timer_source;
+
+  /* Generated ids are always congruent to partition modulo
+     n_partitions. The server uses this to work out which worker owns
+     a person from just the id */
+  unsigned int n_partitions;
+  unsigned int partition;
 } VsxPersonSet;
 
 VsxPersonSet *
 vsx_person_set_new (void);
 
+void
+vsx_person_set_set_partition (VsxPersonSet *set,
+                              unsigned int n_partitions,
+                              unsigned int partition);
+
 VsxPerson *
 vsx_person_set_activate_person (VsxPersonSet *set,
                                 VsxPersonId id);
@@ -51,7 +67,8 @@ vsx_person_set_get_person (VsxPersonSet *set,
 VsxPerson *
 vsx_person_set_generate_person (VsxPersonSet *set,
                                 const char *player_name,
-                                GSocketAddress *address,
+                                const struct sockaddr *address,
+                                socklen_t address_length,
                                 VsxConversation *conversation);
 
 G_END_DECLS
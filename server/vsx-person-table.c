@@ -0,0 +1,281 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "vsx-person-table.h"
+
+/* log2 of the size of the array when the first person is added */
+#define VSX_PERSON_TABLE_MIN_BITS 4
+
+/* Number of entries of the old array to move each time a person is
+ * added while the table is growing. The new array is twice the size
+ * so this needs to be at least 2 for all of the old entries to be
+ * moved before the new array needs to grow too */
+#define VSX_PERSON_TABLE_MIGRATE_STEP 8
+
+/* When a person is removed from the old array while the table is
+ * growing it can't be shifted out because that might move an entry
+ * that hasn't been migrated into the part that has. Instead the
+ * pointer is replaced with this marker which is skipped when
+ * searching. Entries that have been migrated are also marked so
+ * that the old array never has a stale copy of a person. The marker
+ * only ever appears in the old array which is freed once the
+ * migration is complete */
+static const char removed_marker;
+#define VSX_PERSON_TABLE_REMOVED ((VsxPerson *) &removed_marker)
+
+/* The ids are random but the server puts them in partitions based
+ * on the low bits so the home position is taken from the top bits
+ * of the id multiplied by 2⁶⁴/φ */
+static unsigned int
+get_home (VsxPersonId id,
+          unsigned int bits)
+{
+  return (id * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >> (64 - bits);
+}
+
+static unsigned int
+get_distance (const VsxPersonTableEntry *entries,
+              unsigned int bits,
+              unsigned int pos)
+{
+  return (pos - get_home (entries[pos].id, bits)) & ((1u << bits) - 1);
+}
+
+static VsxPersonTableEntry *
+find_entry (VsxPersonTableEntry *entries,
+            unsigned int bits,
+            VsxPersonId id)
+{
+  unsigned int mask = (1u << bits) - 1;
+  unsigned int pos = get_home (id, bits);
+  unsigned int distance;
+
+  for (distance = 0; ; distance++)
+    {
+      VsxPersonTableEntry *entry = entries + pos;
+
+      if (entry->person == NULL)
+        return NULL;
+
+      /* If the id was in the table it would have displaced this
+         entry because it is further from its home position */
+      if (get_distance (entries, bits, pos) < distance)
+        return NULL;
+
+      if (entry->id == id && entry->person != VSX_PERSON_TABLE_REMOVED)
+        return entry;
+
+      pos = (pos + 1) & mask;
+    }
+}
+
+static void
+insert_entry (VsxPersonTableEntry *entries,
+              unsigned int bits,
+              VsxPersonId id,
+              VsxPerson *person)
+{
+  unsigned int mask = (1u << bits) - 1;
+  unsigned int pos = get_home (id, bits);
+  unsigned int distance = 0;
+
+  while (TRUE)
+    {
+      VsxPersonTableEntry *entry = entries + pos;
+      unsigned int entry_distance;
+
+      if (entry->person == NULL)
+        {
+          entry->id = id;
+          entry->person = person;
+          return;
+        }
+
+      entry_distance = get_distance (entries, bits, pos);
+
+      /* Take the place of any entry that is closer to its home
+         position and carry on inserting that one instead */
+      if (entry_distance < distance)
+        {
+          VsxPersonId tmp_id = entry->id;
+          VsxPerson *tmp_person = entry->person;
+
+          entry->id = id;
+          entry->person = person;
+          id = tmp_id;
+          person = tmp_person;
+          distance = entry_distance;
+        }
+
+      pos = (pos + 1) & mask;
+      distance++;
+    }
+}
+
+static void
+remove_entry (VsxPersonTableEntry *entries,
+              unsigned int bits,
+              VsxPersonTableEntry *entry)
+{
+  unsigned int mask = (1u << bits) - 1;
+  unsigned int pos = entry - entries;
+  unsigned int next;
+
+  /* Shift back all of the following entries until one is found that
+     is empty or already in its home position */
+  while (TRUE)
+    {
+      next = (pos + 1) & mask;
+
+      if (entries[next].person == NULL
+          || get_distance (entries, bits, next) == 0)
+        break;
+
+      entries[pos] = entries[next];
+      pos = next;
+    }
+
+  entries[pos].person = NULL;
+}
+
+static void
+migrate_entries (VsxPersonTable *table,
+                 unsigned int n_entries)
+{
+  unsigned int old_size = 1u << table->old_bits;
+
+  for (; n_entries > 0 && table->migrate_pos < old_size; n_entries--)
+    {
+      VsxPersonTableEntry *entry = table->old_entries + table->migrate_pos++;
+
+      if (entry->person && entry->person != VSX_PERSON_TABLE_REMOVED)
+        {
+          insert_entry (table->entries,
+                        table->bits,
+                        entry->id,
+                        entry->person);
+          entry->person = VSX_PERSON_TABLE_REMOVED;
+        }
+    }
+
+  if (table->migrate_pos >= old_size)
+    {
+      g_free (table->old_entries);
+      table->old_entries = NULL;
+    }
+}
+
+static void
+grow (VsxPersonTable *table)
+{
+  /* This shouldn't normally happen because the migration should
+     finish before the new array fills up, but just in case */
+  if (table->old_entries)
+    migrate_entries (table, G_MAXUINT);
+
+  table->old_entries = table->entries;
+  table->old_bits = table->bits;
+  table->migrate_pos = 0;
+
+  table->bits++;
+  table->entries = g_new0 (VsxPersonTableEntry, 1u << table->bits);
+}
+
+void
+vsx_person_table_init (VsxPersonTable *table)
+{
+  table->bits = 0;
+  table->entries = NULL;
+  table->n_entries = 0;
+  table->old_entries = NULL;
+}
+
+void
+vsx_person_table_destroy (VsxPersonTable *table)
+{
+  g_free (table->entries);
+  g_free (table->old_entries);
+}
+
+VsxPerson *
+vsx_person_table_lookup (const VsxPersonTable *table,
+                         VsxPersonId id)
+{
+  VsxPersonTableEntry *entry;
+
+  if (table->entries == NULL)
+    return NULL;
+
+  entry = find_entry (table->entries, table->bits, id);
+
+  if (entry == NULL && table->old_entries)
+    entry = find_entry (table->old_entries, table->old_bits, id);
+
+  return entry ? entry->person : NULL;
+}
+
+void
+vsx_person_table_insert (VsxPersonTable *table,
+                         VsxPerson *person)
+{
+  if (table->entries == NULL)
+    {
+      table->bits = VSX_PERSON_TABLE_MIN_BITS;
+      table->entries = g_new0 (VsxPersonTableEntry, 1u << table->bits);
+    }
+  /* Keep the load factor below 7/8 */
+  else if ((table->n_entries + 1) * 8 > (7u << table->bits))
+    grow (table);
+
+  if (table->old_entries)
+    migrate_entries (table, VSX_PERSON_TABLE_MIGRATE_STEP);
+
+  insert_entry (table->entries, table->bits, person->id, person);
+
+  table->n_entries++;
+}
+
+gboolean
+vsx_person_table_remove (VsxPersonTable *table,
+                         VsxPersonId id)
+{
+  VsxPersonTableEntry *entry;
+
+  if (table->entries == NULL)
+    return FALSE;
+
+  entry = find_entry (table->entries, table->bits, id);
+
+  if (entry)
+    remove_entry (table->entries, table->bits, entry);
+  else if (table->old_entries
+           && (entry = find_entry (table->old_entries,
+                                   table->old_bits,
+                                   id)))
+    entry->person = VSX_PERSON_TABLE_REMOVED;
+  else
+    return FALSE;
+
+  table->n_entries--;
+
+  return TRUE;
+}
@@ -0,0 +1,85 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_PERSON_TABLE_H__
+#define __VSX_PERSON_TABLE_H__
+
+#include <glib.h>
+
+#include "vsx-person.h"
+
+G_BEGIN_DECLS
+
+/* A hash table from person ids to people. The ids are stored inline
+ * next to the pointers in a single array using open addressing with
+ * Robin Hood probing so that a lookup usually only touches one cache
+ * line. Removing a person shifts the following entries back instead
+ * of leaving a tombstone. When the table grows the entries are moved
+ * to the new array a few at a time on each insertion so that no
+ * single request has to pay for copying the whole table. The table
+ * doesn't take a reference on the people. */
+
+typedef struct
+{
+  VsxPersonId id;
+  /* NULL if the entry is empty */
+  VsxPerson *person;
+} VsxPersonTableEntry;
+
+typedef struct
+{
+  /* The size of the array is 1 << bits */
+  unsigned int bits;
+  VsxPersonTableEntry *entries;
+
+  /* Total number of people in the table, including those that
+     haven't been moved out of old_entries yet */
+  unsigned int n_entries;
+
+  /* While the table is growing this is the previous array. All of
+     the entries before migrate_pos have been moved to the new
+     array */
+  unsigned int old_bits;
+  VsxPersonTableEntry *old_entries;
+  unsigned int migrate_pos;
+} VsxPersonTable;
+
+void
+vsx_person_table_init (VsxPersonTable *table);
+
+void
+vsx_person_table_destroy (VsxPersonTable *table);
+
+VsxPerson *
+vsx_person_table_lookup (const VsxPersonTable *table,
+                         VsxPersonId id);
+
+/* There must not already be a person with the same id in the
+   table */
+void
+vsx_person_table_insert (VsxPersonTable *table,
+                         VsxPerson *person);
+
+/* Returns FALSE if the id wasn't in the table */
+gboolean
+vsx_person_table_remove (VsxPersonTable *table,
+                         VsxPersonId id);
+
+G_END_DECLS
+
+#endif /* __VSX_PERSON_TABLE_H__ */
@@ -49,34 +49,24 @@ static const VsxObjectClass *
 vsx_person_get_class (void)
 {
   static VsxObjectClass klass;
+  static gsize initialized = 0;
 
-  if (klass.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_object_get_class ();
       klass.instance_size = sizeof (VsxPerson);
+      klass.name = "VsxPerson";
       klass.free = vsx_person_free;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
 }
 
-gboolean
-vsx_person_id_equal (gconstpointer v1,
-                     gconstpointer v2)
-{
-  return *(const VsxPersonId *) v1 == *(const VsxPersonId *) v2;
-}
-
-guint
-vsx_person_id_hash (gconstpointer v)
-{
-  G_STATIC_ASSERT (sizeof (VsxPersonId) == sizeof (gint64));
-
-  return g_int64_hash (v);
-}
-
 VsxPersonId
-vsx_person_generate_id (GSocketAddress *address)
+vsx_person_generate_id (const struct sockaddr *address,
+                        socklen_t address_length)
 {
   VsxPersonId id = 0;
   int i;
@@ -85,32 +75,22 @@ vsx_person_generate_id (GSocketAddress *address)
   for (i = 0; i < sizeof (id) / sizeof (guint32); i++)
     id |= (VsxPersonId) g_random_int () << (i * sizeof (guint32) * 8);
 
-  if (address)
+  if (address && address_length > 0)
     {
-      gssize native_size = g_socket_address_get_native_size (address);
-      guint8 address_buf[native_size];
+      const guint8 *address_buf = (const guint8 *) address;
+      int address_pos = 0;
+      guint8 *p = (guint8 *) &id;
 
       /* XOR the bytes of the connection address so that even if
          someone can work out the sequence of random numbers it's
          still hard to predict what the next id will be */
 
-      if (g_socket_address_to_native (address,
-                                      address_buf,
-                                      native_size,
-                                      NULL /* error */))
+      for (i = 0; i < sizeof (id); i++)
         {
-          int address_pos = 0;
-          guint8 *p = (guint8 *) &id;
-
-          for (i = 0; i < sizeof (id); i++)
-            {
-              p[i] ^= address_buf[address_pos];
-              if (++address_pos >= native_size)
-                address_pos = 0;
-            }
+          p[i] ^= address_buf[address_pos];
+          if (++address_pos >= address_length)
+            address_pos = 0;
         }
-      else
-        g_warning ("g_socket_address_to_native failed");
     }
 
   return id;
@@ -147,7 +127,7 @@ vsx_person_new (VsxPersonId id,
 
   person->id = id;
   person->conversation = vsx_object_ref (conversation);
-  person->message_offset = conversation->messages->len;
+  person->message_offset = conversation->n_messages;
 
   person->player = vsx_conversation_add_player (conversation, player_name);
 
@@ -21,10 +21,12 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <sys/socket.h>
 
 #include "vsx-conversation.h"
 #include "vsx-player.h"
 #include "vsx-signal.h"
+#include "vsx-list.h"
 
 G_BEGIN_DECLS
 
@@ -42,6 +44,10 @@ typedef struct
 
   gint64 last_noise_time;
 
+  /* Link in the person set's list of people ordered by
+     last_noise_time */
+  VsxList idle_link;
+
   /* When a player joins this number is set to the current number of
    * messages. Any reference to a message number sent from the client
    * is offset by this number so that they can't refer to any messages
@@ -49,15 +55,9 @@ typedef struct
   unsigned int message_offset;
 } VsxPerson;
 
-gboolean
-vsx_person_id_equal (gconstpointer v1,
-                     gconstpointer v2);
-
-guint
-vsx_person_id_hash (gconstpointer v);
-
 VsxPersonId
-vsx_person_generate_id (GSocketAddress *address);
+vsx_person_generate_id (const struct sockaddr *address,
+                        socklen_t address_length);
 
 gboolean
 vsx_person_parse_id (const char *string,
@@ -21,33 +21,31 @@
 #endif
 
 #include <glib.h>
+#include <string.h>
 
 #include "vsx-player.h"
+#include "vsx-format.h"
 
 void
 vsx_player_free (VsxPlayer *player)
 {
+  int i;
+
   g_free (player->name);
-  g_free (player->name_message);
+
+  for (i = 0; i < VSX_FORMAT_N_ENCODINGS; i++)
+    g_free (player->name_message[i]);
 
   g_slice_free (VsxPlayer, player);
 }
 
-VsxPlayer *
-vsx_player_new (const char *player_name,
-                unsigned int num)
+static GString *
+make_json_name_message (const char *player_name,
+                        unsigned int num)
 {
-  VsxPlayer *player = g_slice_new (VsxPlayer);
   GString *buf = g_string_new (NULL);
   const char *p;
 
-  player->name = g_strdup (player_name);
-  player->num = num;
-
-  player->flags = VSX_PLAYER_CONNECTED;
-
-  /* Encode the player name in a message so we can easily send it out
-   * to clients */
   g_string_append_printf (buf,
                           "[\"player-name\", {\"num\": %i, \"name\": \"",
                           num);
@@ -63,8 +61,59 @@ vsx_player_new (const char *player_name,
 
   g_string_append (buf, "\"}]\r\n");
 
-  player->name_message_len = buf->len;
-  player->name_message = g_string_free (buf, FALSE);
+  return buf;
+}
+
+static GString *
+make_binary_name_message (const char *player_name,
+                          unsigned int num)
+{
+  GString *buf = g_string_new (NULL);
+  char start_buf[VSX_FORMAT_MAX_BINARY_EVENT_START_LENGTH];
+  char *start_end;
+  size_t name_length = strlen (player_name);
+
+  start_end = vsx_format_binary_event_start (start_buf,
+                                             VSX_FORMAT_BINARY_PLAYER_NAME,
+                                             name_length + 1);
+  g_string_append_len (buf, start_buf, start_end - start_buf);
+  g_string_append_c (buf, num);
+  g_string_append_len (buf, player_name, name_length);
+
+  return buf;
+}
+
+static void
+set_name_message (VsxPlayer *player,
+                  VsxFormatEncoding encoding,
+                  GString *buf)
+{
+  /* Add the chunk framing */
+  vsx_format_frame_chunk (buf);
+
+  player->name_message_len[encoding] = buf->len;
+  player->name_message[encoding] = g_string_free (buf, FALSE);
+}
+
+VsxPlayer *
+vsx_player_new (const char *player_name,
+                unsigned int num)
+{
+  VsxPlayer *player = g_slice_new (VsxPlayer);
+
+  player->name = g_strdup (player_name);
+  player->num = num;
+
+  player->flags = VSX_PLAYER_CONNECTED;
+
+  /* Encode the player name in a message so we can easily send it out
+   * to clients */
+  set_name_message (player,
+                    VSX_FORMAT_ENCODING_JSON,
+                    make_json_name_message (player_name, num));
+  set_name_message (player,
+                    VSX_FORMAT_ENCODING_BINARY,
+                    make_binary_name_message (player_name, num));
 
   return player;
 }
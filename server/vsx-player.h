@@ -21,6 +21,8 @@
 
 #include <glib.h>
 
+#include "vsx-format.h"
+
 G_BEGIN_DECLS
 
 typedef enum
@@ -38,8 +40,11 @@ typedef struct
 
   char *name;
 
-  gsize name_message_len;
-  char *name_message;
+  /* A "player-name" event in each encoding already wrapped in an
+   * HTTP chunk so that it can be sent to clients without any further
+   * formatting */
+  gsize name_message_len[VSX_FORMAT_N_ENCODINGS];
+  char *name_message[VSX_FORMAT_N_ENCODINGS];
 
   VsxPlayerFlags flags;
 } VsxPlayer;
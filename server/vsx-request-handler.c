@@ -30,9 +30,6 @@ vsx_request_handler_free (void *object)
 {
   VsxRequestHandler *handler = object;
 
-  if (handler->socket_address)
-    g_object_unref (handler->socket_address);
-
   if (handler->person_set)
     vsx_object_unref (handler->person_set);
 
@@ -73,20 +70,22 @@ vsx_request_handler_real_request_finished (VsxRequestHandler *handler)
 {
   /* Default handler assumes this is an unknown resource */
   if (handler->request_method == VSX_REQUEST_METHOD_UNKNOWN)
-    return vsx_string_response_new (VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST);
+    return vsx_string_response_get (VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST);
   else
-    return vsx_string_response_new (VSX_STRING_RESPONSE_NOT_FOUND);
+    return vsx_string_response_get (VSX_STRING_RESPONSE_NOT_FOUND);
 }
 
 const VsxRequestHandlerClass *
 vsx_request_handler_get_class (void)
 {
   static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass.parent_class = *vsx_object_get_class ();
       klass.parent_class.instance_size = sizeof (VsxRequestHandler);
+      klass.parent_class.name = "VsxRequestHandler";
       klass.parent_class.free = vsx_request_handler_free;
 
       klass.request_line_received =
@@ -94,6 +93,8 @@ vsx_request_handler_get_class (void)
       klass.header_received = vsx_request_handler_real_header_received;
       klass.data_received = vsx_request_handler_real_data_received;
       klass.request_finished = vsx_request_handler_real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -21,6 +21,7 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <sys/socket.h>
 
 #include "vsx-response.h"
 #include "vsx-conversation-set.h"
@@ -65,7 +66,10 @@ struct _VsxRequestHandler
 {
   VsxObject parent;
 
-  GSocketAddress *socket_address;
+  /* Address of the client that made the request */
+  struct sockaddr_storage socket_address;
+  socklen_t socket_address_length;
+
   VsxConversationSet *conversation_set;
   VsxPersonSet *person_set;
 
@@ -21,9 +21,18 @@
 #endif
 
 #include <glib.h>
+#include <string.h>
 
 #include "vsx-response.h"
 
+/* Static data shorter than this is copied into the buffer instead
+ * because it's cheaper than making the kernel walk another vec */
+#define VSX_RESPONSE_OUTPUT_MIN_STATIC_LENGTH 32
+
+static void
+vsx_response_real_add_output (VsxResponse *response,
+                              VsxResponseOutput *output);
+
 static gboolean
 vsx_response_real_has_data (VsxResponse *self)
 {
@@ -34,13 +43,18 @@ const VsxResponseClass *
 vsx_response_get_class (void)
 {
   static VsxResponseClass class;
+  static gsize initialized = 0;
 
-  if (class.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       class.parent_class = *vsx_object_get_class ();
       class.parent_class.instance_size = sizeof (VsxResponse);
+      class.parent_class.name = "VsxResponse";
 
+      class.add_output = vsx_response_real_add_output;
       class.has_data = vsx_response_real_has_data;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &class;
@@ -56,17 +70,14 @@ vsx_response_init (void *object)
   vsx_signal_init (&response->changed_signal);
 }
 
-unsigned int
-vsx_response_add_data (VsxResponse *response,
-                       guint8 *buffer,
-                       unsigned int buffer_size)
+void
+vsx_response_add_output (VsxResponse *response,
+                         VsxResponseOutput *output)
 {
   VsxResponseClass *klass =
     (VsxResponseClass *) ((VsxObject *) response)->klass;
 
-  return klass->add_data (response,
-                          buffer,
-                          buffer_size);
+  klass->add_output (response, output);
 }
 
 gboolean
@@ -87,8 +98,155 @@ vsx_response_has_data (VsxResponse *response)
   return klass->has_data (response);
 }
 
+gboolean
+vsx_response_get_static_data (VsxResponse *response,
+                              const guint8 **data,
+                              unsigned int *length)
+{
+  VsxResponseClass *klass =
+    (VsxResponseClass *) ((VsxObject *) response)->klass;
+
+  if (klass->get_static_data == NULL)
+    return FALSE;
+
+  return klass->get_static_data (response, data, length);
+}
+
 void
 vsx_response_changed (VsxResponse *response)
 {
   vsx_signal_emit (&response->changed_signal, response);
 }
+
+void
+vsx_response_output_init (VsxResponseOutput *output,
+                          struct iovec *vecs,
+                          unsigned int max_vecs,
+                          guint8 *buffer,
+                          unsigned int buffer_size)
+{
+  output->vecs = vecs;
+  output->n_vecs = 0;
+  output->max_vecs = max_vecs;
+  output->buffer = buffer;
+  output->buffer_length = 0;
+  output->buffer_size = buffer_size;
+  output->length = 0;
+}
+
+static gboolean
+last_vec_is_in_buffer (const VsxResponseOutput *output)
+{
+  const struct iovec *last;
+
+  if (output->n_vecs <= 0)
+    return FALSE;
+
+  last = output->vecs + output->n_vecs - 1;
+
+  return ((guint8 *) last->iov_base + last->iov_len ==
+          output->buffer + output->buffer_length);
+}
+
+/* Returns the number of bytes that can be appended to the buffer */
+static unsigned int
+get_buffer_space (const VsxResponseOutput *output)
+{
+  /* Data appended to the buffer can only extend the last vec if it
+     is already pointing at the end of the buffer. Otherwise it
+     needs a new one */
+  if (output->n_vecs >= output->max_vecs && !last_vec_is_in_buffer (output))
+    return 0;
+
+  return output->buffer_size - output->buffer_length;
+}
+
+static void
+commit_buffer (VsxResponseOutput *output,
+               unsigned int length)
+{
+  if (length <= 0)
+    return;
+
+  if (last_vec_is_in_buffer (output))
+    output->vecs[output->n_vecs - 1].iov_len += length;
+  else
+    {
+      struct iovec *vec = output->vecs + output->n_vecs++;
+
+      vec->iov_base = output->buffer + output->buffer_length;
+      vec->iov_len = length;
+    }
+
+  output->buffer_length += length;
+  output->length += length;
+}
+
+static void
+vsx_response_real_add_output (VsxResponse *response,
+                              VsxResponseOutput *output)
+{
+  VsxResponseClass *klass =
+    (VsxResponseClass *) ((VsxObject *) response)->klass;
+  unsigned int space = get_buffer_space (output);
+
+  if (space <= 0)
+    return;
+
+  commit_buffer (output,
+                 klass->add_data (response,
+                                  output->buffer + output->buffer_length,
+                                  space));
+}
+
+/* Copies as much of the data as will fit into the buffer and returns
+ * the number of bytes copied */
+unsigned int
+vsx_response_output_add_copy (VsxResponseOutput *output,
+                              const void *data,
+                              unsigned int length)
+{
+  unsigned int to_copy = MIN (length, get_buffer_space (output));
+
+  memcpy (output->buffer + output->buffer_length, data, to_copy);
+  commit_buffer (output, to_copy);
+
+  return to_copy;
+}
+
+/* Adds a reference to data that must stay valid until the response
+ * is destroyed. Returns the number of bytes added which may be less
+ * than length if the data had to be copied and the buffer is full */
+unsigned int
+vsx_response_output_add_static (VsxResponseOutput *output,
+                                const void *data,
+                                unsigned int length)
+{
+  struct iovec *vec;
+
+  if (length < VSX_RESPONSE_OUTPUT_MIN_STATIC_LENGTH
+      || output->n_vecs >= output->max_vecs)
+    return vsx_response_output_add_copy (output, data, length);
+
+  vec = output->vecs + output->n_vecs++;
+  vec->iov_base = (void *) data;
+  vec->iov_len = length;
+
+  output->length += length;
+
+  return length;
+}
+
+/* Returns the number of bytes that can be copied into the output */
+unsigned int
+vsx_response_output_get_buffer_space (const VsxResponseOutput *output)
+{
+  return get_buffer_space (output);
+}
+
+gboolean
+vsx_response_output_is_full (const VsxResponseOutput *output)
+{
+  return (output->n_vecs >= output->max_vecs
+          && get_buffer_space (output) <= 0);
+}
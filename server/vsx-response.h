@@ -20,6 +20,7 @@
 #define __VSX_RESPONSE_H__
 
 #include <glib.h>
+#include <sys/uio.h>
 
 #include "vsx-signal.h"
 #include "vsx-object.h"
@@ -35,15 +36,42 @@ G_BEGIN_DECLS
 
 typedef struct _VsxResponse VsxResponse;
 
+/* A list of byte ranges to be written to the socket with a single
+ * call to sendmsg. Each range either points into the buffer or to
+ * data owned by the response that added it. The response is kept
+ * alive until all of the data has been written. */
+typedef struct
+{
+  struct iovec *vecs;
+  unsigned int n_vecs;
+  unsigned int max_vecs;
+
+  guint8 *buffer;
+  unsigned int buffer_length;
+  unsigned int buffer_size;
+
+  /* Total number of bytes in all of the vecs */
+  unsigned int length;
+} VsxResponseOutput;
+
 typedef struct
 {
   VsxObjectClass parent_class;
 
   /* This should fill the given array with some more data to write and
-     return the number of bytes added. */
+     return the number of bytes added. This is only used by the
+     default implementation of add_output. */
   unsigned int (* add_data) (VsxResponse *response,
                              guint8 *buffer,
                              unsigned int buffer_size);
+  /* This should add some more data to write to the output. Data that
+     stays valid for the lifetime of the response can be added with
+     vsx_response_output_add_static so that it is given to the kernel
+     without being copied. Overriding this is optional and the
+     default implementation copies the data from add_data into the
+     output's buffer */
+  void (* add_output) (VsxResponse *response,
+                       VsxResponseOutput *output);
   /* This should report TRUE if there is data immediately ready for
      writing (eg, we should block for writing on the
      socket. Overriding this is optional and the default
@@ -51,6 +79,15 @@ typedef struct
   gboolean (* has_data) (VsxResponse *response);
   /* This should return TRUE once the response is fully generated */
   gboolean (* is_finished) (VsxResponse *response);
+  /* Responses whose entire contents are a constant buffer can
+     implement this to return it instead of implementing the methods
+     above. The connection then keeps track of how much of the data
+     has been written itself, so a single shared instance can be
+     queued on any number of connections at once. These responses
+     must never emit the changed signal */
+  gboolean (* get_static_data) (VsxResponse *response,
+                                const guint8 **data,
+                                unsigned int *length);
 }  VsxResponseClass;
 
 struct _VsxResponse
@@ -66,10 +103,9 @@ vsx_response_init (void *object);
 const VsxResponseClass *
 vsx_response_get_class (void) G_GNUC_CONST;
 
-unsigned int
-vsx_response_add_data (VsxResponse *response,
-                       guint8 *buffer,
-                       unsigned int buffer_size);
+void
+vsx_response_add_output (VsxResponse *response,
+                         VsxResponseOutput *output);
 
 gboolean
 vsx_response_is_finished (VsxResponse *response);
@@ -77,9 +113,37 @@ vsx_response_is_finished (VsxResponse *response);
 gboolean
 vsx_response_has_data (VsxResponse *response);
 
+gboolean
+vsx_response_get_static_data (VsxResponse *response,
+                              const guint8 **data,
+                              unsigned int *length);
+
 void
 vsx_response_changed (VsxResponse *response);
 
+void
+vsx_response_output_init (VsxResponseOutput *output,
+                          struct iovec *vecs,
+                          unsigned int max_vecs,
+                          guint8 *buffer,
+                          unsigned int buffer_size);
+
+unsigned int
+vsx_response_output_add_copy (VsxResponseOutput *output,
+                              const void *data,
+                              unsigned int length);
+
+unsigned int
+vsx_response_output_add_static (VsxResponseOutput *output,
+                                const void *data,
+                                unsigned int length);
+
+unsigned int
+vsx_response_output_get_buffer_space (const VsxResponseOutput *output);
+
+gboolean
+vsx_response_output_is_full (const VsxResponseOutput *output);
+
 G_END_DECLS
 
 #endif /* __VSX_RESPONSE_H__ */
@@ -65,7 +65,7 @@ set_error (VsxSendMessageHandler *self,
     }
 
   if (self->response == NULL)
-    self->response = vsx_string_response_new (type);
+    self->response = vsx_string_response_get (type);
 }
 
 static void
@@ -243,16 +243,16 @@ real_request_finished (VsxRequestHandler *handler)
   else if (self->is_options_request)
     {
       if (self->had_request_method)
-        return vsx_string_response_new (VSX_STRING_RESPONSE_PREFLIGHT_POST_OK);
+        return vsx_string_response_get (VSX_STRING_RESPONSE_PREFLIGHT_POST_OK);
       else
-        return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+        return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
     }
   else if (self->person)
     {
       if (self->data_iconv == (GIConv) -1
           || !vsx_chunked_iconv_eos (&self->chunked_iconv)
           || self->person->conversation == NULL)
-        return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+        return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
 
       vsx_conversation_add_message (self->person->conversation,
                                     self->person->player->num,
@@ -267,13 +267,13 @@ real_request_finished (VsxRequestHandler *handler)
       g_string_free (self->message_buffer, TRUE);
       self->message_buffer = NULL;
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_OK);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_OK);
     }
   else
     {
       g_warn_if_reached ();
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
     }
 }
 
@@ -281,17 +281,21 @@ static const VsxRequestHandlerClass *
 vsx_send_message_handler_get_class (void)
 {
   static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_request_handler_get_class ();
       klass.parent_class.instance_size = sizeof (VsxSendMessageHandler);
+      klass.parent_class.name = "VsxSendMessageHandler";
       klass.parent_class.free = real_free;
 
       klass.request_line_received = real_request_line_received;
       klass.header_received = real_header_received;
       klass.data_received = real_data_received;
       klass.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
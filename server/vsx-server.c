@@ -23,7 +23,13 @@
 #include <glib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <pthread.h>
 
 #ifdef USE_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -47,10 +53,30 @@
 #include "vsx-start-typing-handler.h"
 #include "vsx-stop-typing-handler.h"
 #include "vsx-keep-alive-handler.h"
+#include "vsx-batch-handler.h"
+#include "vsx-arguments.h"
 #include "vsx-log.h"
+#include "vsx-slab.h"
 
-struct _VsxServer
+/* The server can run multiple workers, each with its own thread, main
+ * context and listening socket. Every conversation and every person
+ * is owned by exactly one worker so that none of the game state needs
+ * any locking. If a request arrives on a worker that doesn't own the
+ * person or room that it refers to then the connection is handed
+ * over to the owner. */
+
+typedef struct
 {
+  VsxServer *server;
+
+  /* Index of this worker. Ids of people generated by this worker are
+     always congruent to this modulo the number of workers */
+  int num;
+
+  /* The thread running the worker. This is NULL for the first worker
+     because it runs in the thread that calls vsx_server_run */
+  GThread *thread;
+
   VsxMainContextSource *server_socket_source;
   GSocket *server_socket;
 
@@ -58,25 +84,99 @@ struct _VsxServer
      error */
   GError *fatal_error;
 
+  /* This becomes TRUE when the worker is asked to quit */
+  gboolean quit;
+
   /* List of open connections */
   VsxList connections;
 
+  /* Lists of connections that have nothing in their response queue,
+     one for each phase of the HTTP parser. Each phase has a fixed
+     timeout so adding connections to the tail keeps the lists
+     ordered by when they will expire and the garbage collector only
+     needs to look at the heads */
+  VsxList idle_connections[VSX_HTTP_PARSER_N_PHASES];
+
+  /* List of connections whose responses have changed during this
+     iteration of the main loop. These are all updated once the
+     events have been dispatched so that multiple changes only cause
+     one write */
+  VsxList dirty_connections;
+
   VsxConversationSet *pending_conversations;
 
   VsxPersonSet *person_set;
 
   VsxMainContextSource *gc_source;
+
+  /* Timer to periodically log the main loop statistics. This is only
+     used if logging is enabled */
+  VsxMainContextSource *stats_source;
+
+  /* Number of connections accepted during the current iteration of
+     the main loop */
+  int n_accepted;
+  /* Number of connections accepted by each iteration that accepted
+     any */
+  VsxHistogram accepts_per_wakeup;
+  /* Number of times the accept queue was found to be full */
+  unsigned int n_accept_queue_full;
+
+  /* Other workers hand over connections by adding them to this
+     queue and then waking the worker up with the eventfd. The other
+     worker never has to wait for this one so two workers handing
+     connections to each other can't block. The queue and the quit
+     flag are protected by the mutex */
+  GMutex handoff_mutex;
+  VsxList handoff_queue;
+  gboolean handoff_quit;
+  int handoff_fd;
+  VsxMainContextSource *handoff_source;
+} VsxServerWorker;
+
+struct _VsxServer
+{
+  int n_workers;
+  VsxServerWorker *workers;
 };
 
+typedef enum
+{
+  /* The request can be handled by any worker */
+  VSX_SERVER_ROUTE_ANY,
+  /* The first argument is a person id */
+  VSX_SERVER_ROUTE_PERSON,
+  /* The first argument is the name of a room */
+  VSX_SERVER_ROUTE_ROOM
+} VsxServerRoute;
+
 #define VSX_SERVER_OUTPUT_BUFFER_SIZE 1024
+/* Maximum number of separate byte ranges to write in one go */
+#define VSX_SERVER_MAX_OUTPUT_VECS 64
 
+/* Space to build the data for the next write to a connection. This
+ * is only attached to a connection while it has data waiting to be
+ * written so that the connections that are just waiting for
+ * something to happen in their conversation don't each need one */
 typedef struct
 {
-  VsxServer *server;
+  struct iovec vecs[VSX_SERVER_MAX_OUTPUT_VECS];
+  guint8 buffer[VSX_SERVER_OUTPUT_BUFFER_SIZE];
+} VsxServerOutput;
+
+typedef struct
+{
+  VsxServerWorker *worker;
 
-  GSocket *client_socket;
+  /* The client socket. GSocket isn't used for the connections so
+     that the hot path doesn't need any allocations for errors */
+  int fd;
   VsxMainContextSource *source;
 
+  /* Address of the client as returned by accept */
+  struct sockaddr_storage peer_address;
+  socklen_t peer_address_length;
+
   /* List node within the list of connections */
   VsxList link;
 
@@ -93,6 +193,21 @@ typedef struct
      input and we're ignoring further data */
   gboolean write_finished;
 
+  /* This is cleared when a write would block and set again when the
+     main context reports that the socket is writable. Received data
+     is delivered by the main context so it doesn't need a flag */
+  gboolean writable;
+
+  /* This is TRUE while the connection is reading and writing. Any
+     changes during that time are picked up before it finishes instead
+     of recursing */
+  gboolean in_io;
+
+  /* Link in the worker's list of dirty connections. dirty is TRUE
+     while the connection is in the list */
+  gboolean dirty;
+  VsxList dirty_link;
+
   /* The current request handler or NULL if we couldn't find an
      appropriate one when the request line was received */
   VsxRequestHandler *current_request_handler;
@@ -100,16 +215,41 @@ typedef struct
   /* Queue of VsxServerQueuedResponses to send to this client */
   VsxList response_queue;
 
+  /* Data waiting to be written or NULL if there is none. The vecs
+     point either into the output's buffer or to data owned by the
+     responses. Nothing more is generated until all of it has been
+     written so that the buffer can be reused */
+  VsxServerOutput *output;
+  unsigned int first_output_vec;
+  unsigned int n_output_vecs;
+  /* Total number of bytes remaining in the output vecs */
   unsigned int output_length;
-  guint8 output_buffer[VSX_SERVER_OUTPUT_BUFFER_SIZE];
+
+  /* VsxServerQueuedResponses that have been removed from the queue
+     but that may still have data referenced by the output vecs. These
+     are freed once the output has been written */
+  VsxList output_responses;
 
   /* IP address of the connection. This is only filled in if logging
      is enabled */
   char *peer_address_string;
 
-  /* Time since the response queue became empty. The connection will
-   * be removed if this stays empty for too long */
-  gint64 no_response_age;
+  /* While the response queue is empty the connection is in the
+   * worker's idle list for the current phase of the HTTP parser and
+   * idle_time is the time that it entered that phase. The connection
+   * will be removed if it stays in the phase for too long */
+  gboolean idle;
+  VsxHttpParserPhase idle_phase;
+  VsxList idle_link;
+  gint64 idle_time;
+
+  /* If a request arrives that is owned by another worker then this
+   * will be set to that worker and the connection will be handed over
+   * as soon as all of the queued responses have been written. The
+   * request line and any data received after it are kept in
+   * migrate_data so that the new worker can parse them again. */
+  VsxServerWorker *migrate_worker;
+  GString *migrate_data;
 } VsxServerConnection;
 
 typedef struct
@@ -118,11 +258,32 @@ typedef struct
   VsxListener response_changed_listener;
   VsxResponse *response;
   VsxServerConnection *connection;
+
+  /* If the response is just a constant buffer then it is written
+     directly from here instead of going through the response's
+     methods. The position is kept here rather than in the response
+     so that the same response can be shared between connections.
+     static_data is NULL for all other responses */
+  const guint8 *static_data;
+  unsigned int static_length;
+  unsigned int static_pos;
 } VsxServerQueuedResponse;
 
-/* Interval time in minutes to run the dead person garbage
-   collector */
-#define VSX_SERVER_GC_TIMEOUT 5
+static VsxSlab
+vsx_server_connection_slab = VSX_SLAB_INIT (VsxServerConnection);
+static VsxSlab
+vsx_server_queued_response_slab = VSX_SLAB_INIT (VsxServerQueuedResponse);
+static VsxSlab
+vsx_server_output_slab = VSX_SLAB_INIT (VsxServerOutput);
+
+/* Interval time in milliseconds to run the dead connection garbage
+   collector. This only looks at the connections that have expired so
+   it can run often */
+#define VSX_SERVER_GC_TIMEOUT (10 * 1000)
+
+/* Interval time in milliseconds between logging the statistics of
+   each worker's main loop */
+#define VSX_SERVER_STATS_INTERVAL (5 * 60 * 1000)
 
 /* Time in microseconds after which a connection with no responses
  * will be considered dead. This is necessary to avoid keeping around
@@ -131,33 +292,130 @@ typedef struct
  * resources. */
 #define VSX_SERVER_NO_RESPONSE_TIMEOUT (5 * 60 * (gint64) 1000000)
 
+/* Time in microseconds that a client with no responses pending has
+ * to send the headers or the body of a request once it has started
+ * it. These are shorter so that clients trickling in a request a few
+ * bytes at a time can't hold on to the connection */
+#define VSX_SERVER_HEADERS_TIMEOUT (30 * (gint64) 1000000)
+#define VSX_SERVER_BODY_TIMEOUT (60 * (gint64) 1000000)
+
+static const gint64
+idle_timeouts[VSX_HTTP_PARSER_N_PHASES] =
+  {
+    [VSX_HTTP_PARSER_PHASE_IDLE] = VSX_SERVER_NO_RESPONSE_TIMEOUT,
+    [VSX_HTTP_PARSER_PHASE_HEADERS] = VSX_SERVER_HEADERS_TIMEOUT,
+    [VSX_HTTP_PARSER_PHASE_BODY] = VSX_SERVER_BODY_TIMEOUT
+  };
+
 static const struct
 {
   const char *url;
   VsxRequestHandler * (* create_handler_func) (void);
+  VsxServerRoute route;
 }
 requests[] =
   {
-    { "/keep_alive", vsx_keep_alive_handler_new },
-    { "/move_tile", vsx_move_tile_handler_new },
-    { "/turn", vsx_turn_handler_new },
-    { "/start_typing", vsx_start_typing_handler_new },
-    { "/stop_typing", vsx_stop_typing_handler_new },
-    { "/send_message", vsx_send_message_handler_new },
-    { "/watch_person", vsx_watch_person_handler_new },
-    { "/new_person", vsx_new_person_handler_new },
-    { "/shout", vsx_shout_handler_new },
-    { "/set_n_tiles", vsx_set_n_tiles_handler_new },
-    { "/leave", vsx_leave_handler_new }
+    { "/keep_alive", vsx_keep_alive_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/move_tile", vsx_move_tile_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/turn", vsx_turn_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/start_typing", vsx_start_typing_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/stop_typing", vsx_stop_typing_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/send_message", vsx_send_message_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/watch_person", vsx_watch_person_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/new_person", vsx_new_person_handler_new, VSX_SERVER_ROUTE_ROOM },
+    { "/shout", vsx_shout_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/set_n_tiles", vsx_set_n_tiles_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/leave", vsx_leave_handler_new, VSX_SERVER_ROUTE_PERSON },
+    { "/batch", vsx_batch_handler_new, VSX_SERVER_ROUTE_PERSON }
   };
 
 static void
-update_poll (VsxServerConnection *connection);
+update_connection (VsxServerConnection *connection);
 
 static void
-vsx_server_remove_connection (VsxServer *server,
+vsx_server_remove_connection (VsxServerWorker *worker,
                               VsxServerConnection *connection);
 
+static VsxServerWorker *
+get_route_worker (VsxServerWorker *worker,
+                  VsxServerRoute route,
+                  const char *query_string)
+{
+  VsxServer *server = worker->server;
+
+  if (server->n_workers <= 1 || query_string == NULL)
+    return worker;
+
+  switch (route)
+    {
+    case VSX_SERVER_ROUTE_ANY:
+      break;
+
+    case VSX_SERVER_ROUTE_PERSON:
+      {
+        char id_buf[sizeof (VsxPersonId) * 2 + 1];
+        const char *end = strchr (query_string, '&');
+        VsxPersonId id;
+
+        if (end == NULL)
+          end = query_string + strlen (query_string);
+
+        /* If the id is invalid then the local handler can report the
+           error */
+        if (end - query_string >= sizeof (id_buf))
+          break;
+
+        memcpy (id_buf, query_string, end - query_string);
+        id_buf[end - query_string] = '\0';
+
+        if (vsx_person_parse_id (id_buf, &id))
+          return server->workers + id % server->n_workers;
+      }
+      break;
+
+    case VSX_SERVER_ROUTE_ROOM:
+      {
+        char *room_name, *player_name, *encoding_name;
+        guint hash;
+
+        /* Only the room name is used for the hash but the encoding
+           is optional so both forms need to be accepted */
+        if (vsx_arguments_parse ("nns",
+                                 query_string,
+                                 &room_name,
+                                 &player_name,
+                                 &encoding_name))
+          g_free (encoding_name);
+        else if (!vsx_arguments_parse ("nn",
+                                       query_string,
+                                       &room_name,
+                                       &player_name))
+          break;
+
+        hash = g_str_hash (room_name);
+
+        g_free (room_name);
+        g_free (player_name);
+
+        return server->workers + hash % server->n_workers;
+      }
+    }
+
+  return worker;
+}
+
+static void
+mark_connection_dirty (VsxServerConnection *connection)
+{
+  VsxServerWorker *worker = connection->worker;
+
+  if (connection->dirty)
+    return;
+
+  vsx_list_insert (worker->dirty_connections.prev, &connection->dirty_link);
+  connection->dirty = TRUE;
+}
+
 static void
 response_changed_cb (VsxListener *listener,
                      void *data)
@@ -165,11 +423,11 @@ response_changed_cb (VsxListener *listener,
   VsxServerQueuedResponse *queued_response =
     vsx_container_of (listener, queued_response, response_changed_listener);
 
-  /* Update the poll if this is the first response in the queue (ie,
-   * the one that is currently being handled) */
+  /* Update the connection if this is the first response in the queue
+   * (ie, the one that is currently being handled) */
   if (&queued_response->link ==
       queued_response->connection->response_queue.next)
-    update_poll (queued_response->connection);
+    mark_connection_dirty (queued_response->connection);
 }
 
 static gboolean
@@ -212,6 +470,27 @@ vsx_server_request_line_received_cb (const char *method_str,
   for (i = 0; i < G_N_ELEMENTS (requests); i++)
     if (!strcmp (url, requests[i].url))
       {
+        VsxServerWorker *owner = get_route_worker (connection->worker,
+                                                   requests[i].route,
+                                                   query_string);
+
+        if (owner != connection->worker)
+          {
+            /* Cancel parsing so that the connection can be handed
+               over to the owner. The request line is rebuilt so that
+               the owner can parse it again */
+            connection->migrate_worker = owner;
+            connection->migrate_data =
+              g_string_new (NULL);
+            g_string_append_printf (connection->migrate_data,
+                                    "%s %s HTTP/1.1\r\n",
+                                    method_str,
+                                    uri);
+            g_free (url_copy);
+
+            return FALSE;
+          }
+
         handler = requests[i].create_handler_func ();
 
         goto got_handler;
@@ -222,12 +501,14 @@ vsx_server_request_line_received_cb (const char *method_str,
   handler = vsx_request_handler_new ();
 
  got_handler:
-  handler->socket_address =
-    g_socket_get_remote_address (connection->client_socket, NULL);
+  memcpy (&handler->socket_address,
+          &connection->peer_address,
+          connection->peer_address_length);
+  handler->socket_address_length = connection->peer_address_length;
   handler->conversation_set =
-    vsx_object_ref (connection->server->pending_conversations);
+    vsx_object_ref (connection->worker->pending_conversations);
   handler->person_set =
-    vsx_object_ref (connection->server->person_set);
+    vsx_object_ref (connection->worker->person_set);
 
   vsx_request_handler_request_line_received (handler, method, query_string);
 
@@ -269,15 +550,25 @@ queue_response (VsxServerConnection *connection,
                 VsxResponse *response)
 {
   VsxServerQueuedResponse *queued_response =
-    g_slice_new (VsxServerQueuedResponse);
+    vsx_slab_alloc (&vsx_server_queued_response_slab);
 
   /* This steals a reference on the response */
   queued_response->response = response;
   queued_response->connection = connection;
+  queued_response->static_pos = 0;
 
-  queued_response->response_changed_listener.notify = response_changed_cb;
-  vsx_signal_add (&response->changed_signal,
-                  &queued_response->response_changed_listener);
+  /* Static responses never change and might be shared with other
+     threads so we mustn't add a listener to them */
+  if (!vsx_response_get_static_data (response,
+                                     &queued_response->static_data,
+                                     &queued_response->static_length))
+    {
+      queued_response->static_data = NULL;
+      queued_response->response_changed_listener.notify =
+        response_changed_cb;
+      vsx_signal_add (&response->changed_signal,
+                      &queued_response->response_changed_listener);
+    }
 
   vsx_list_insert (connection->response_queue.prev,
                    &queued_response->link);
@@ -309,6 +600,74 @@ vsx_server_http_parser_vtable =
     .request_finished = vsx_server_request_finished_cb
   };
 
+static gboolean
+queued_response_has_data (VsxServerQueuedResponse *queued_response)
+{
+  if (queued_response->static_data)
+    return TRUE;
+
+  return vsx_response_has_data (queued_response->response);
+}
+
+static void
+queued_response_add_output (VsxServerQueuedResponse *queued_response,
+                            VsxResponseOutput *output)
+{
+  if (queued_response->static_data)
+    {
+      queued_response->static_pos +=
+        vsx_response_output_add_static (output,
+                                        queued_response->static_data +
+                                        queued_response->static_pos,
+                                        queued_response->static_length -
+                                        queued_response->static_pos);
+    }
+  else
+    {
+      vsx_response_add_output (queued_response->response, output);
+    }
+}
+
+static gboolean
+queued_response_is_finished (VsxServerQueuedResponse *queued_response)
+{
+  if (queued_response->static_data)
+    return queued_response->static_pos >= queued_response->static_length;
+
+  return vsx_response_is_finished (queued_response->response);
+}
+
+static void
+free_queued_response (VsxServerQueuedResponse *queued_response)
+{
+  vsx_object_unref (queued_response->response);
+  vsx_slab_free (&vsx_server_queued_response_slab, queued_response);
+}
+
+static void
+free_output_responses (VsxServerConnection *connection)
+{
+  VsxServerQueuedResponse *queued_response, *tmp;
+
+  vsx_list_for_each_safe (queued_response,
+                          tmp,
+                          &connection->output_responses,
+                          link)
+    free_queued_response (queued_response);
+
+  vsx_list_init (&connection->output_responses);
+}
+
+static void
+release_output (VsxServerConnection *connection)
+{
+  if (connection->output)
+    {
+      vsx_slab_free (&vsx_server_output_slab, connection->output);
+      connection->output = NULL;
+    }
+}
+
 static void
 vsx_server_connection_pop_response (VsxServerConnection *connection)
 {
@@ -320,19 +679,17 @@ vsx_server_connection_pop_response (VsxServerConnection *connection)
                                       queued_response,
                                       link);
 
-  vsx_list_remove (&queued_response->response_changed_listener.link);
-
-  vsx_object_unref (queued_response->response);
+  if (queued_response->static_data == NULL)
+    vsx_list_remove (&queued_response->response_changed_listener.link);
 
   vsx_list_remove (&queued_response->link);
 
-  g_slice_free (VsxServerQueuedResponse, queued_response);
-
-  /* Whenever we end up with an empty response queue will start
-   * counting the time the connection has been idle so that we can
-   * remove it if it gets too old */
-  if (vsx_list_empty (&connection->response_queue))
-    connection->no_response_age = vsx_main_context_get_monotonic_clock (NULL);
+  /* The output vecs might be pointing at data owned by the response
+   * so it has to stay alive until they are written */
+  if (connection->output_length > 0)
+    vsx_list_insert (&connection->output_responses, &queued_response->link);
+  else
+    free_queued_response (queued_response);
 }
 
 static void
@@ -348,6 +705,18 @@ vsx_server_connection_clear_responses (VsxServerConnection *connection)
     }
 }
 
+static void
+cancel_migration (VsxServerConnection *connection)
+{
+  if (connection->migrate_data)
+    {
+      g_string_free (connection->migrate_data, TRUE);
+      connection->migrate_data = NULL;
+    }
+
+  connection->migrate_worker = NULL;
+}
+
 static void
 set_bad_input_with_code (VsxServerConnection *connection,
                          VsxStringResponseType code)
@@ -357,7 +726,16 @@ set_bad_input_with_code (VsxServerConnection *connection,
   /* Replace all of the queued responses with an error response */
   vsx_server_connection_clear_responses (connection);
 
-  response = vsx_string_response_new (code);
+  cancel_migration (connection);
+
+  /* If receiving was stopped for a migration then the end of the
+     stream will never be seen so the connection is closed as soon as
+     the error has been written */
+  if (connection->source
+      && !vsx_main_context_is_receiving (connection->source))
+    connection->read_finished = TRUE;
+
+  response = vsx_string_response_get (code);
 
   queue_response (connection, response);
 
@@ -376,25 +754,105 @@ set_bad_input (VsxServerConnection *connection, GError *error)
 }
 
 static void
-check_dead_connection (VsxServerConnection *connection)
+handle_received_data (VsxServerConnection *connection,
+                      const guint8 *data,
+                      unsigned int length)
 {
-  if (vsx_list_empty (&connection->response_queue)
-      && ((vsx_main_context_get_monotonic_clock (NULL)
-           - connection->no_response_age)
-          >= VSX_SERVER_NO_RESPONSE_TIMEOUT))
+  GError *error = NULL;
+
+  if (connection->had_bad_input)
+    return;
+
+  if (!vsx_http_parser_parse_data (&connection->http_parser,
+                                   data,
+                                   length,
+                                   &error))
     {
-      /* If we've already had bad input then we'll just remove the
-       * connection. This will happen if the client doesn't close its
-       * end of the connection after we finish sending the bad input
-       * message */
-      if (connection->had_bad_input)
-        vsx_server_remove_connection (connection->server, connection);
-      else
+      if (connection->migrate_worker
+          && error->domain == VSX_HTTP_PARSER_ERROR
+          && error->code == VSX_HTTP_PARSER_ERROR_CANCELLED)
         {
-          set_bad_input_with_code (connection,
-                                   VSX_STRING_RESPONSE_REQUEST_TIMEOUT);
-          update_poll (connection);
+          /* Keep the rest of the data for the new owner */
+          unsigned int n_unparsed = connection->http_parser.n_unparsed;
+
+          g_string_append_len (connection->migrate_data,
+                               (const char *) data + length - n_unparsed,
+                               n_unparsed);
+
+          /* Anything received after this is also kept for the new
+             owner. The connection is only handed over once the main
+             context has stopped receiving */
+          vsx_main_context_stop_receiving (connection->source);
         }
+      else
+        set_bad_input (connection, error);
+
+      g_clear_error (&error);
+    }
+}
+
+static void
+remove_idle_connection (VsxServerConnection *connection)
+{
+  if (connection->idle)
+    {
+      vsx_list_remove (&connection->idle_link);
+      connection->idle = FALSE;
+    }
+}
+
+/* Moves the connection to the right idle list whenever its response
+ * queue or the phase of its request changes. The idle time is only
+ * reset when the phase changes so that a client can't keep the
+ * connection alive by sending a request one byte at a time */
+static void
+update_idle_state (VsxServerConnection *connection)
+{
+  VsxServerWorker *worker = connection->worker;
+  VsxHttpParserPhase phase;
+
+  if (!vsx_list_empty (&connection->response_queue))
+    {
+      remove_idle_connection (connection);
+      return;
+    }
+
+  /* The parser isn't used anymore after bad input so the connection
+   * is just waiting to be closed */
+  if (connection->had_bad_input)
+    phase = VSX_HTTP_PARSER_PHASE_IDLE;
+  else
+    phase = vsx_http_parser_get_phase (&connection->http_parser);
+
+  if (connection->idle && connection->idle_phase == phase)
+    return;
+
+  remove_idle_connection (connection);
+
+  connection->idle = TRUE;
+  connection->idle_phase = phase;
+  connection->idle_time = vsx_main_context_get_monotonic_clock (NULL);
+  vsx_list_insert (worker->idle_connections[phase].prev,
+                   &connection->idle_link);
+}
+
+static void
+expire_connection (VsxServerConnection *connection)
+{
+  /* If we've already had bad input then we'll just remove the
+   * connection. This will happen if the client doesn't close its
+   * end of the connection after we finish sending the bad input
+   * message */
+  if (connection->had_bad_input)
+    vsx_server_remove_connection (connection->worker, connection);
+  else
+    {
+      set_bad_input_with_code (connection,
+                               VSX_STRING_RESPONSE_REQUEST_TIMEOUT);
+      /* This takes the connection out of the idle list because it
+       * now has a response queued */
+      update_idle_state (connection);
+      update_connection (connection);
     }
 }
 
@@ -402,255 +860,403 @@ static void
 vsx_server_gc_cb (VsxMainContextSource *source,
                   void *user_data)
 {
-  VsxServer *server = user_data;
-  VsxServerConnection *connection, *tmp;
+  VsxServerWorker *worker = user_data;
+  gint64 now = vsx_main_context_get_monotonic_clock (NULL);
+  VsxServerConnection *connection;
+  VsxList *list;
+  int phase;
+
+  for (phase = 0; phase < VSX_HTTP_PARSER_N_PHASES; phase++)
+    {
+      list = worker->idle_connections + phase;
+
+      /* The lists are in order of expiry so we can stop at the first
+       * connection that hasn't expired. Expiring a connection always
+       * takes it off the head of the list. If it ends up idle again
+       * it is added to the tail with a new time */
+      while (!vsx_list_empty (list))
+        {
+          connection = vsx_container_of (list->next, connection, idle_link);
+
+          if (now - connection->idle_time < idle_timeouts[phase])
+            break;
 
-  vsx_list_for_each_safe (connection, tmp, &server->connections, link)
-    check_dead_connection (connection);
+          expire_connection (connection);
+        }
+    }
 }
 
 static void
-vsx_server_remove_connection (VsxServer *server,
-                              VsxServerConnection *connection)
+vsx_server_connection_free (VsxServerConnection *connection)
 {
   vsx_server_connection_clear_responses (connection);
+  free_output_responses (connection);
+  release_output (connection);
+  cancel_migration (connection);
+  vsx_http_parser_release_buffer (&connection->http_parser);
+
+  close (connection->fd);
+  g_free (connection->peer_address_string);
+  vsx_slab_free (&vsx_server_connection_slab, connection);
+}
 
+static void
+vsx_server_detach_connection (VsxServerWorker *worker,
+                              VsxServerConnection *connection)
+{
   vsx_main_context_remove_source (connection->source);
-  g_object_unref (connection->client_socket);
   vsx_list_remove (&connection->link);
-  g_free (connection->peer_address_string);
-  g_slice_free (VsxServerConnection, connection);
+  remove_idle_connection (connection);
+
+  /* The parser will be initialised again if the connection is
+     attached to another worker */
+  vsx_http_parser_release_buffer (&connection->http_parser);
+
+  if (connection->dirty)
+    {
+      vsx_list_remove (&connection->dirty_link);
+      connection->dirty = FALSE;
+    }
 
-  if (vsx_list_empty (&server->connections))
+  if (vsx_list_empty (&worker->connections))
     {
-      vsx_main_context_remove_source (server->gc_source);
-      server->gc_source = NULL;
+      vsx_main_context_remove_source (worker->gc_source);
+      worker->gc_source = NULL;
     }
 
-  /* Reset the poll on the server socket in case we previously stopped
-     listening because we ran out of file descriptors. This will do
-     nothing if we were already listening */
-  vsx_main_context_modify_poll (server->server_socket_source,
-                                VSX_MAIN_CONTEXT_POLL_IN);
+  /* Start accepting again in case we previously stopped because we
+     ran out of file descriptors. This will do nothing if we were
+     already accepting */
+  vsx_main_context_set_accepting (worker->server_socket_source, TRUE);
 }
 
 static void
-update_poll (VsxServerConnection *connection)
+vsx_server_remove_connection (VsxServerWorker *worker,
+                              VsxServerConnection *connection)
 {
-  VsxMainContextPollFlags flags = 0;
+  vsx_server_detach_connection (worker, connection);
+  vsx_server_connection_free (connection);
+}
 
-  if (!connection->read_finished)
-    flags |= VSX_MAIN_CONTEXT_POLL_IN;
+/* Passing a NULL connection asks the worker to quit */
+static void
+send_handoff_message (VsxServerWorker *worker,
+                      VsxServerConnection *connection)
+{
+  guint64 value = 1;
 
-  /* Shutdown the socket if we've finished writing */
-  if (!connection->write_finished
-      && (connection->read_finished || connection->had_bad_input)
-      && vsx_list_empty (&connection->response_queue)
-      && connection->output_length == 0)
-    {
-      GError *error = NULL;
+  g_mutex_lock (&worker->handoff_mutex);
 
-      if (!g_socket_shutdown (connection->client_socket,
-                              FALSE, /* shutdown_read */
-                              TRUE, /* shutdown_write */
-                              &error))
-        {
-          vsx_log ("shutdown socket failed for %s: %s",
-                   connection->peer_address_string,
-                   error->message);
-          g_clear_error (&error);
-          vsx_server_remove_connection (connection->server, connection);
-          return;
-        }
+  /* The connection is detached so its link isn't in use */
+  if (connection)
+    vsx_list_insert (worker->handoff_queue.prev, &connection->link);
+  else
+    worker->handoff_quit = TRUE;
 
-      connection->write_finished = TRUE;
-    }
+  g_mutex_unlock (&worker->handoff_mutex);
 
-  if (!connection->write_finished)
+  /* The eventfd is non-blocking. Writing to it can only fail if the
+     counter would overflow, in which case the worker is going to
+     wake up anyway */
+  while (write (worker->handoff_fd, &value, sizeof (value)) == -1)
     {
-      if (connection->output_length > 0)
-        flags |= VSX_MAIN_CONTEXT_POLL_OUT;
-      else if (!vsx_list_empty (&connection->response_queue))
+      if (errno != EINTR)
         {
-          VsxServerQueuedResponse *queued_response
-            = vsx_container_of (connection->response_queue.next,
-                                queued_response,
-                                link);
-
-          if (vsx_response_has_data (queued_response->response))
-            flags |= VSX_MAIN_CONTEXT_POLL_OUT;
+          if (errno != EAGAIN)
+            g_warning ("Write to handoff eventfd failed: %s",
+                       strerror (errno));
+          break;
         }
     }
+}
 
-  /* If both ends of the connection are closed then we can abandon
-     this connectin */
-  if (connection->read_finished && connection->write_finished)
-    vsx_server_remove_connection (connection->server, connection);
-  else
-    vsx_main_context_modify_poll (connection->source,
-                                  flags);
+static void
+migrate_connection (VsxServerConnection *connection)
+{
+  VsxServerWorker *worker = connection->worker;
+
+  vsx_server_detach_connection (worker, connection);
+
+  /* After this point the connection belongs to the other worker's
+     thread so we mustn't touch it again */
+  send_handoff_message (connection->migrate_worker, connection);
+}
+
+static gboolean
+connection_wants_write (VsxServerConnection *connection)
+{
+  VsxServerQueuedResponse *queued_response;
+
+  if (connection->write_finished)
+    return FALSE;
+
+  if (connection->output_length > 0)
+    return TRUE;
+
+  if (vsx_list_empty (&connection->response_queue))
+    return FALSE;
+
+  queued_response = vsx_container_of (connection->response_queue.next,
+                                      queued_response,
+                                      link);
+
+  return queued_response_has_data (queued_response);
 }
 
 static void
-vsx_server_connection_poll_cb (VsxMainContextSource *source,
-                               int fd,
-                               VsxMainContextPollFlags flags,
-                               void *user_data)
+fill_output (VsxServerConnection *connection)
 {
-  VsxServerConnection *connection = user_data;
-  VsxServer *server = connection->server;
-  char buf[1024];
-
-  if (flags & VSX_MAIN_CONTEXT_POLL_ERROR)
-    {
-      int value;
-      unsigned int value_len = sizeof (value);
-
-      if (getsockopt (g_socket_get_fd (connection->client_socket),
-                      SOL_SOCKET,
-                      SO_ERROR,
-                      &value,
-                      &value_len) == -1
-          || value_len != sizeof (value)
-          || value == 0)
-        vsx_log ("Unknown error on socket for %s",
-                 connection->peer_address_string);
-      else
-        vsx_log ("Error on socket for %s: %s",
-                 connection->peer_address_string,
-                 strerror (value));
+  VsxResponseOutput output;
 
-      vsx_server_remove_connection (server, connection);
-    }
-  else if (flags & VSX_MAIN_CONTEXT_POLL_IN)
-    {
-      GError *error = NULL;
+  if (connection->output == NULL)
+    connection->output = vsx_slab_alloc (&vsx_server_output_slab);
 
-      gssize got =
-        g_socket_receive (connection->client_socket,
-                          buf,
-                          sizeof (buf),
-                          NULL, /* cancellable */
-                          &error);
+  vsx_response_output_init (&output,
+                            connection->output->vecs,
+                            VSX_SERVER_MAX_OUTPUT_VECS,
+                            connection->output->buffer,
+                            VSX_SERVER_OUTPUT_BUFFER_SIZE);
 
-      if (got == 0)
-        {
-          if (!connection->had_bad_input
-              && !vsx_http_parser_parser_eof (&connection->http_parser,
-                                              &error))
-            {
-              set_bad_input (connection, error);
-              g_clear_error (&error);
-            }
+  /* Try to fill the output as much as possible before initiating a
+     write */
+  while (!vsx_response_output_is_full (&output)
+         && !vsx_list_empty (&connection->response_queue))
+    {
+      VsxServerQueuedResponse *queued_response
+        = vsx_container_of (connection->response_queue.next,
+                            queued_response,
+                            link);
 
-          connection->read_finished = TRUE;
+      if (!queued_response_has_data (queued_response))
+        break;
 
-          update_poll (connection);
-        }
-      else if (got == -1)
-        {
-          if (error->domain != G_IO_ERROR
-              || error->code != G_IO_ERROR_WOULD_BLOCK)
-            {
-              vsx_log ("Error reading from socket for %s: %s",
-                       connection->peer_address_string,
-                       error->message);
-              vsx_server_remove_connection (server, connection);
-            }
+      queued_response_add_output (queued_response, &output);
 
-          g_clear_error (&error);
-        }
-      else
-        {
-          if (!connection->had_bad_input
-              && !vsx_http_parser_parse_data (&connection->http_parser,
-                                              (guint8 *) buf,
-                                              got,
-                                              &error))
-            {
-              set_bad_input (connection, error);
-              g_clear_error (&error);
-            }
+      connection->n_output_vecs = output.n_vecs;
+      connection->output_length = output.length;
 
-          update_poll (connection);
-        }
+      /* If the response is now finished then remove it from the queue */
+      if (queued_response_is_finished (queued_response))
+        vsx_server_connection_pop_response (connection);
+      /* If the output wasn't big enough to fit a chunk in then the
+         response might not fill it so we should give up until the
+         output is emptied */
+      else
+        break;
     }
-  else if (flags & VSX_MAIN_CONTEXT_POLL_OUT)
-    {
-      GError *error = NULL;
-      gssize wrote;
+}
 
-      /* Try to fill the output buffer as much as possible before
-         initiating a write */
-      while (connection->output_length < VSX_SERVER_OUTPUT_BUFFER_SIZE
-             && !vsx_list_empty (&connection->response_queue))
-        {
-          VsxServerQueuedResponse *queued_response
-            = vsx_container_of (connection->response_queue.next,
-                                queued_response,
-                                link);
-          VsxResponse *response = queued_response->response;
-          unsigned int added;
-
-          if (!vsx_response_has_data (response))
-            break;
+static void
+consume_output (VsxServerConnection *connection,
+                size_t wrote)
+{
+  connection->output_length -= wrote;
 
-          added =
-            vsx_response_add_data (response,
-                                   connection->output_buffer
-                                   + connection->output_length,
-                                   VSX_SERVER_OUTPUT_BUFFER_SIZE
-                                   - connection->output_length);
-
-          connection->output_length += added;
-
-          /* If the response is now finished then remove it from the queue */
-          if (vsx_response_is_finished (response))
-            vsx_server_connection_pop_response (connection);
-          /* If the buffer wasn't big enough to fit a chunk in then
-             the response might not will the buffer so we should give
-             up until the buffer is emptied */
-          else
-            break;
-        }
+  if (connection->output_length <= 0)
+    {
+      connection->first_output_vec = 0;
+      connection->n_output_vecs = 0;
+      free_output_responses (connection);
+      release_output (connection);
+      return;
+    }
 
-      if ((wrote = g_socket_send (connection->client_socket,
-                                  (const gchar *) connection->output_buffer,
-                                  connection->output_length,
-                                  NULL,
-                                  &error)) == -1)
-        {
-          if (error->domain != G_IO_ERROR
-              || error->code != G_IO_ERROR_WOULD_BLOCK)
-            {
-              g_print ("Error writing to socket for %s: %s",
-                       connection->peer_address_string,
-                       error->message);
-              vsx_server_remove_connection (server, connection);
-            }
+  while (wrote > 0)
+    {
+      struct iovec *vec =
+        connection->output->vecs + connection->first_output_vec;
 
-          g_clear_error (&error);
+      if (wrote >= vec->iov_len)
+        {
+          wrote -= vec->iov_len;
+          connection->first_output_vec++;
         }
       else
         {
-          /* Move any remaining data in the output buffer to the front */
-          memmove (connection->output_buffer,
-                   connection->output_buffer + wrote,
-                   connection->output_length - wrote);
-          connection->output_length -= wrote;
-
-          update_poll (connection);
+          vec->iov_base = (guint8 *) vec->iov_base + wrote;
+          vec->iov_len -= wrote;
+          break;
         }
     }
 }
 
-static char *
-get_address_string (GSocketAddress *address,
-                    gboolean include_port)
+/* Returns FALSE if the connection was removed */
+static gboolean
+write_to_connection (VsxServerConnection *connection)
 {
-  char *address_string = NULL;
+  struct msghdr msg;
+  ssize_t wrote;
 
-  if (address)
+  if (connection->output_length <= 0)
+    fill_output (connection);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = connection->output->vecs + connection->first_output_vec;
+  msg.msg_iovlen = connection->n_output_vecs - connection->first_output_vec;
+
+  /* MSG_NOSIGNAL is used so that we get EPIPE instead of SIGPIPE
+     if the client has gone away */
+  if ((wrote = sendmsg (connection->fd, &msg, MSG_NOSIGNAL)) == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+          /* The main context will tell us when there is space to
+             write */
+          connection->writable = FALSE;
+          vsx_main_context_wait_writable (connection->source);
+        }
+      else if (errno != EINTR)
+        {
+          vsx_log ("Error writing to socket for %s: %s",
+                   connection->peer_address_string,
+                   strerror (errno));
+          vsx_server_remove_connection (connection->worker, connection);
+          return FALSE;
+        }
+    }
+  else
+    consume_output (connection, wrote);
+
+  return TRUE;
+}
+
+static void
+update_connection_state (VsxServerConnection *connection)
+{
+  if (connection->migrate_worker)
+    {
+      /* Hand the connection over as soon as all of the responses for
+       * the requests that we did handle have been written. With
+       * io_uring some data can still arrive after receiving was
+       * stopped so this also waits until the main context has
+       * finished with the socket */
+      if (vsx_list_empty (&connection->response_queue)
+          && connection->output_length == 0
+          && !vsx_main_context_is_receiving (connection->source))
+        {
+          migrate_connection (connection);
+          return;
+        }
+    }
+
+  /* Shutdown the socket if we've finished writing */
+  if (!connection->write_finished
+      && (connection->read_finished || connection->had_bad_input)
+      && vsx_list_empty (&connection->response_queue)
+      && connection->output_length == 0)
+    {
+      if (shutdown (connection->fd, SHUT_WR) == -1)
+        {
+          vsx_log ("shutdown socket failed for %s: %s",
+                   connection->peer_address_string,
+                   strerror (errno));
+          vsx_server_remove_connection (connection->worker, connection);
+          return;
+        }
+
+      connection->write_finished = TRUE;
+    }
+
+  /* If both ends of the connection are closed then we can abandon
+     this connectin */
+  if (connection->read_finished && connection->write_finished)
+    {
+      vsx_server_remove_connection (connection->worker, connection);
+      return;
+    }
+
+  update_idle_state (connection);
+}
+
+/* Writes until either the socket would block or there is nothing
+ * left to write. Received data is handled as soon as the main context
+ * reports it so only writing needs to be retried here */
+static void
+update_connection (VsxServerConnection *connection)
+{
+  /* If the connection is already being serviced further up the stack
+   * then it will notice the change before it finishes */
+  if (connection->in_io)
+    return;
+
+  connection->in_io = TRUE;
+
+  while (connection->writable && connection_wants_write (connection))
+    {
+      if (!write_to_connection (connection))
+        return;
+    }
+
+  connection->in_io = FALSE;
+
+  update_connection_state (connection);
+}
+
+static void
+vsx_server_connection_socket_cb (VsxMainContextSource *source,
+                                 int fd,
+                                 const VsxMainContextSocketEvent *event,
+                                 void *user_data)
+{
+  VsxServerConnection *connection = user_data;
+  GError *error = NULL;
+
+  switch (event->type)
+    {
+    case VSX_MAIN_CONTEXT_SOCKET_DATA:
+      /* If the connection is being handed over then the data
+         belongs to the new owner */
+      if (connection->migrate_worker)
+        g_string_append_len (connection->migrate_data,
+                             (const char *) event->data,
+                             event->length);
+      else
+        handle_received_data (connection, event->data, event->length);
+      break;
+
+    case VSX_MAIN_CONTEXT_SOCKET_EOF:
+      /* The new owner will see the end of the stream again when it
+         starts receiving */
+      if (connection->migrate_worker)
+        break;
+
+      if (!connection->had_bad_input
+          && !vsx_http_parser_parser_eof (&connection->http_parser,
+                                          &error))
+        {
+          set_bad_input (connection, error);
+          g_clear_error (&error);
+        }
+
+      connection->read_finished = TRUE;
+      break;
+
+    case VSX_MAIN_CONTEXT_SOCKET_ERROR:
+      vsx_log ("Error on socket for %s: %s",
+               connection->peer_address_string,
+               strerror (event->error));
+      vsx_server_remove_connection (connection->worker, connection);
+      return;
+
+    case VSX_MAIN_CONTEXT_SOCKET_WRITABLE:
+      connection->writable = TRUE;
+      break;
+
+    case VSX_MAIN_CONTEXT_SOCKET_STOPPED:
+      /* This can let a pending migration go ahead */
+      break;
+    }
+
+  update_connection (connection);
+}
+
+static char *
+get_address_string (GSocketAddress *address,
+                    gboolean include_port)
+{
+  char *address_string = NULL;
+
+  if (address)
     {
       if (G_IS_INET_SOCKET_ADDRESS (address))
         {
@@ -682,140 +1288,296 @@ get_address_string (GSocketAddress *address,
 }
 
 static char *
-get_peer_address_string (GSocket *client_socket)
+get_peer_address_string (VsxServerConnection *connection)
 {
-  GSocketAddress *address = g_socket_get_remote_address (client_socket, NULL);
+  GSocketAddress *address =
+    g_socket_address_new_from_native (&connection->peer_address,
+                                      connection->peer_address_length);
 
   return get_address_string (address, FALSE /* include_port */);
 }
 
 static void
-vsx_server_pending_connection_cb (VsxMainContextSource *source,
-                                  int fd,
-                                  VsxMainContextPollFlags flags,
-                                  void *user_data)
+vsx_server_attach_connection (VsxServerWorker *worker,
+                              VsxServerConnection *connection)
 {
-  VsxServer *server = user_data;
-  GSocket *client_socket;
-  GError *error = NULL;
+  connection->worker = worker;
+  /* A new socket has space to write. If not, the first write will
+     find out */
+  connection->writable = TRUE;
+  connection->in_io = FALSE;
+  connection->dirty = FALSE;
+  connection->idle = FALSE;
+  connection->source =
+    vsx_main_context_add_socket (NULL /* default context */,
+                                 connection->fd,
+                                 vsx_server_connection_socket_cb,
+                                 connection);
+  vsx_main_context_set_source_category (connection->source,
+                                        VSX_MAIN_CONTEXT_CATEGORY_CONNECTION);
+  vsx_list_insert (&worker->connections, &connection->link);
+
+  vsx_http_parser_init (&connection->http_parser,
+                        &vsx_server_http_parser_vtable,
+                        connection);
+
+  update_idle_state (connection);
+
+  if (worker->gc_source == NULL)
+    worker->gc_source =
+      vsx_main_context_add_timer (NULL, /* default context */
+                                  VSX_SERVER_GC_TIMEOUT,
+                                  vsx_server_gc_cb,
+                                  worker);
+}
 
-  client_socket = g_socket_accept (server->server_socket,
-                                   NULL,
-                                   &error);
+static void
+add_accepted_connection (VsxServerWorker *worker,
+                         int client_fd,
+                         const struct sockaddr *peer_address,
+                         socklen_t peer_address_length)
+{
+  VsxServerConnection *connection;
 
-  if (client_socket == NULL)
-    {
-      /* Ignore WOULD_BLOCK errors */
-      if (error->domain == G_IO_ERROR
-          && error->code == G_IO_ERROR_WOULD_BLOCK)
-        g_clear_error (&error);
-      else if (error->domain == G_IO_ERROR
-               && error->code == G_IO_ERROR_TOO_MANY_OPEN_FILES)
-        {
-          vsx_log ("Too many open files to accept connection");
+  connection = vsx_slab_alloc (&vsx_server_connection_slab);
 
-          /* Stop listening for new connections until someone disconnects */
-          vsx_main_context_modify_poll (server->server_socket_source,
-                                        0);
-          g_clear_error (&error);
-        }
-      else
-        /* This will cause vsx_server_run to return */
-        server->fatal_error = error;
+  connection->fd = client_fd;
+  memcpy (&connection->peer_address, peer_address, peer_address_length);
+  connection->peer_address_length = peer_address_length;
+
+  connection->current_request_handler = NULL;
+  vsx_list_init (&connection->response_queue);
+
+  connection->had_bad_input = FALSE;
+  connection->read_finished = FALSE;
+  connection->write_finished = FALSE;
+
+  connection->first_output_vec = 0;
+  connection->n_output_vecs = 0;
+  connection->output_length = 0;
+  connection->output = NULL;
+  vsx_list_init (&connection->output_responses);
+
+  connection->migrate_worker = NULL;
+  connection->migrate_data = NULL;
+
+  /* If logging is available then we'll want to store the peer
+     address as a string so we've got something to refer to */
+  if (vsx_log_available ())
+    {
+      connection->peer_address_string
+        = get_peer_address_string (connection);
+      vsx_log ("Accepted connection from %s",
+               connection->peer_address_string);
     }
   else
+    connection->peer_address_string = NULL;
+
+  vsx_server_attach_connection (worker, connection);
+}
+
+static void
+check_accept_queue (VsxServerWorker *worker)
+{
+  struct tcp_info info;
+  socklen_t info_length = sizeof (info);
+
+  /* For a listening socket Linux reports the current length of the
+   * accept queue in tcpi_unacked and the backlog in tcpi_sacked. If
+   * the queue is already full when we wake up then the kernel has
+   * probably had to drop connections. This fails harmlessly for
+   * sockets that aren't TCP */
+  if (getsockopt (g_socket_get_fd (worker->server_socket),
+                  IPPROTO_TCP,
+                  TCP_INFO,
+                  &info,
+                  &info_length) == 0 &&
+      info_length >= sizeof (info) &&
+      info.tcpi_sacked > 0 &&
+      info.tcpi_unacked >= info.tcpi_sacked)
+    worker->n_accept_queue_full++;
+}
+
+/* The main context accepts a batch of connections each time the
+ * listening socket is ready and calls this for each one */
+static void
+vsx_server_accept_cb (VsxMainContextSource *source,
+                      int fd,
+                      const struct sockaddr *address,
+                      socklen_t address_length,
+                      int error,
+                      void *user_data)
+{
+  VsxServerWorker *worker = user_data;
+
+  if (fd == -1)
     {
-      VsxServerConnection *connection;
+      if (error == EMFILE || error == ENFILE)
+        vsx_log ("Too many open files to accept connection");
+      else
+        {
+          /* This will cause vsx_server_run to return */
+          g_set_error (&worker->fatal_error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (error),
+                       "Error accepting connection: %s",
+                       strerror (error));
+        }
 
-      g_socket_set_blocking (client_socket, FALSE);
+      /* Stop accepting new connections until someone disconnects */
+      vsx_main_context_set_accepting (source, FALSE);
 
-      connection = g_slice_new (VsxServerConnection);
+      return;
+    }
 
-      connection->server = server;
-      connection->client_socket = client_socket;
-      connection->source =
-        vsx_main_context_add_poll (NULL /* default context */,
-                                   g_socket_get_fd (client_socket),
-                                   VSX_MAIN_CONTEXT_POLL_IN,
-                                   vsx_server_connection_poll_cb,
-                                   connection);
-      vsx_list_insert (&server->connections, &connection->link);
+  /* Only bother checking the queue if someone is going to look at
+     the result. It is checked once per iteration before the first
+     connection is taken off it */
+  if (worker->n_accepted == 0 && worker->stats_source)
+    check_accept_queue (worker);
 
-      vsx_http_parser_init (&connection->http_parser,
-                            &vsx_server_http_parser_vtable,
-                            connection);
+  worker->n_accepted++;
 
-      connection->current_request_handler = NULL;
-      vsx_list_init (&connection->response_queue);
+  add_accepted_connection (worker, fd, address, address_length);
+}
 
-      connection->had_bad_input = FALSE;
-      connection->read_finished = FALSE;
-      connection->write_finished = FALSE;
+static void
+receive_handoff_connection (VsxServerWorker *worker,
+                            VsxServerConnection *connection)
+{
+  GString *migrate_data;
 
-      connection->output_length = 0;
+  migrate_data = connection->migrate_data;
+  connection->migrate_data = NULL;
+  connection->migrate_worker = NULL;
 
-      /* If logging is available then we'll want to store the peer
-         address as a string so we've got something to refer to */
-      if (vsx_log_available ())
-        {
-          connection->peer_address_string
-            = get_peer_address_string (client_socket);
-          vsx_log ("Accepted connection from %s",
-                   connection->peer_address_string);
-        }
-      else
-        connection->peer_address_string = NULL;
+  vsx_server_attach_connection (worker, connection);
+
+  /* Parse the part of the request that the previous worker had
+     already read */
+  connection->in_io = TRUE;
+  handle_received_data (connection,
+                        (const guint8 *) migrate_data->str,
+                        migrate_data->len);
+  connection->in_io = FALSE;
+
+  g_string_free (migrate_data, TRUE);
+
+  update_connection (connection);
+}
+
+static void
+vsx_server_handoff_cb (VsxMainContextSource *source,
+                       int fd,
+                       VsxMainContextPollFlags flags,
+                       void *user_data)
+{
+  VsxServerWorker *worker = user_data;
+  VsxServerConnection *connection, *tmp;
+  VsxList queue;
+  guint64 value;
 
-      connection->no_response_age = vsx_main_context_get_monotonic_clock (NULL);
+  /* The eventfd is reset before taking the queue so that a wakeup
+     for a connection added after this point isn't lost */
+  if (read (worker->handoff_fd, &value, sizeof (value)) == -1
+      && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    g_warning ("Read from handoff eventfd failed: %s", strerror (errno));
 
-      if (server->gc_source == NULL)
-        server->gc_source =
-          vsx_main_context_add_timer (NULL, /* default context */
-                                      VSX_SERVER_GC_TIMEOUT,
-                                      vsx_server_gc_cb,
-                                      server);
+  vsx_list_init (&queue);
+
+  g_mutex_lock (&worker->handoff_mutex);
+
+  vsx_list_insert_list (&queue, &worker->handoff_queue);
+  vsx_list_init (&worker->handoff_queue);
+
+  if (worker->handoff_quit)
+    {
+      worker->handoff_quit = FALSE;
+      worker->quit = TRUE;
+    }
+
+  g_mutex_unlock (&worker->handoff_mutex);
+
+  vsx_list_for_each_safe (connection, tmp, &queue, link)
+    {
+      vsx_list_remove (&connection->link);
+      receive_handoff_connection (worker, connection);
     }
 }
 
-static GSocket *
-create_server_socket (GSocketAddress *address,
-                      GError **error)
+static gboolean
+set_reuse_port (GSocket *socket,
+                GError **error)
 {
-  GSocket *socket;
+  int value = 1;
+
+  if (setsockopt (g_socket_get_fd (socket),
+                  SOL_SOCKET,
+                  SO_REUSEPORT,
+                  &value,
+                  sizeof (value)) == -1)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Error setting SO_REUSEPORT: %s",
+                   strerror (errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
 
 #ifdef USE_SYSTEMD
-  {
-    int nfds = sd_listen_fds (TRUE /* unset_environment */);
 
-    if (nfds < 0)
-      {
-        g_set_error (error,
-                     G_FILE_ERROR,
-                     g_file_error_from_errno (-nfds),
-                     "Error getting systemd fds: %s",
-                     strerror (-nfds));
-        return NULL;
-      }
-    else if (nfds > 1)
-      {
-        g_set_error (error,
-                     G_FILE_ERROR,
-                     G_FILE_ERROR_BADF,
-                     "Received too many file descriptors from systemd");
-        return NULL;
-      }
-    else if (nfds == 1)
-      {
-        socket = g_socket_new_from_fd (SD_LISTEN_FDS_START, error);
+static gboolean
+get_systemd_socket (GSocket **socket_out,
+                    GError **error)
+{
+  int nfds = sd_listen_fds (TRUE /* unset_environment */);
 
-        if (socket)
-          g_socket_set_blocking (socket, FALSE);
+  *socket_out = NULL;
+
+  if (nfds < 0)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (-nfds),
+                   "Error getting systemd fds: %s",
+                   strerror (-nfds));
+      return FALSE;
+    }
+  else if (nfds > 1)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_BADF,
+                   "Received too many file descriptors from systemd");
+      return FALSE;
+    }
+  else if (nfds == 1)
+    {
+      *socket_out = g_socket_new_from_fd (SD_LISTEN_FDS_START, error);
+
+      if (*socket_out == NULL)
+        return FALSE;
+
+      g_socket_set_blocking (*socket_out, FALSE);
+    }
+
+  return TRUE;
+}
 
-        return socket;
-      }
-  }
 #endif /* USE_SYSTEMD */
 
+static GSocket *
+create_server_socket (GSocketAddress *address,
+                      gboolean reuse_port,
+                      int backlog,
+                      GError **error)
+{
+  GSocket *socket;
+
   socket = g_socket_new (g_socket_address_get_family (address),
                          G_SOCKET_TYPE_STREAM,
                          G_SOCKET_PROTOCOL_DEFAULT,
@@ -825,8 +1587,10 @@ create_server_socket (GSocketAddress *address,
     return NULL;
 
   g_socket_set_blocking (socket, FALSE);
+  g_socket_set_listen_backlog (socket, backlog);
 
-  if (!g_socket_bind (socket, address, TRUE, error) ||
+  if ((reuse_port && !set_reuse_port (socket, error)) ||
+      !g_socket_bind (socket, address, TRUE, error) ||
       !g_socket_listen (socket, error))
     {
       g_object_unref (socket);
@@ -836,38 +1600,352 @@ create_server_socket (GSocketAddress *address,
   return socket;
 }
 
+static void
+log_histogram (VsxServerWorker *worker,
+               const char *name,
+               const VsxHistogram *histogram)
+{
+  GString *buf;
+
+  if (histogram->count == 0)
+    return;
+
+  buf = g_string_new (NULL);
+  vsx_histogram_append_summary (histogram, buf);
+  vsx_log ("Worker %i %s: %s", worker->num, name, buf->str);
+  g_string_free (buf, TRUE);
+}
+
+static void
+log_slab_cb (const char *name,
+             size_t size,
+             int n_live,
+             int peak,
+             void *user_data)
+{
+  vsx_log ("%s: %i live (%" G_GSIZE_FORMAT " bytes), peak %i",
+           name,
+           n_live,
+           n_live * size,
+           peak);
+}
+
+static void
+vsx_server_stats_cb (VsxMainContextSource *source,
+                     void *user_data)
+{
+  static const char * const category_names[] =
+    {
+      "other callback time (us)",
+      "accept callback time (us)",
+      "connection callback time (us)",
+      "timer callback time (us)",
+      "quit callback time (us)"
+    };
+  VsxServerWorker *worker = user_data;
+  const VsxMainContextStats *stats =
+    vsx_main_context_get_stats (NULL /* default context */);
+  int i;
+
+  G_STATIC_ASSERT (G_N_ELEMENTS (category_names) ==
+                   VSX_MAIN_CONTEXT_N_CATEGORIES);
+
+  log_histogram (worker, "wait time (us)", &stats->wait_time);
+  log_histogram (worker, "busy time (us)", &stats->busy_time);
+  log_histogram (worker, "events per wait", &stats->n_events);
+
+  for (i = 0; i < VSX_MAIN_CONTEXT_N_CATEGORIES; i++)
+    log_histogram (worker, category_names[i], stats->callback_time + i);
+
+  log_histogram (worker, "timer lag (us)", &stats->timer_lag);
+
+  log_histogram (worker,
+                 "connections accepted per wakeup",
+                 &worker->accepts_per_wakeup);
+
+  if (worker->n_accept_queue_full > 0)
+    vsx_log ("Worker %i found the accept queue full %u times",
+             worker->num,
+             worker->n_accept_queue_full);
+
+  /* The allocation counts are shared between all of the workers so
+     only the first one logs them */
+  if (worker->num == 0)
+    vsx_slab_foreach (log_slab_cb, NULL);
+
+  vsx_main_context_reset_stats (NULL /* default context */);
+  vsx_histogram_reset (&worker->accepts_per_wakeup);
+  worker->n_accept_queue_full = 0;
+}
+
+static void
+vsx_server_worker_start (VsxServerWorker *worker)
+{
+  VsxServer *server = worker->server;
+  int i;
+
+  worker->person_set = vsx_person_set_new ();
+  vsx_person_set_set_partition (worker->person_set,
+                                server->n_workers,
+                                worker->num);
+
+  worker->pending_conversations = vsx_conversation_set_new ();
+
+  vsx_list_init (&worker->connections);
+  vsx_list_init (&worker->dirty_connections);
+
+  for (i = 0; i < VSX_HTTP_PARSER_N_PHASES; i++)
+    vsx_list_init (worker->idle_connections + i);
+
+  worker->n_accepted = 0;
+
+  worker->server_socket_source =
+    vsx_main_context_add_accept (NULL /* default context */,
+                                 g_socket_get_fd (worker->server_socket),
+                                 vsx_server_accept_cb,
+                                 worker);
+  vsx_main_context_set_source_category (worker->server_socket_source,
+                                        VSX_MAIN_CONTEXT_CATEGORY_ACCEPT);
+
+  worker->handoff_source =
+    vsx_main_context_add_poll (NULL /* default context */,
+                               worker->handoff_fd,
+                               VSX_MAIN_CONTEXT_POLL_IN,
+                               vsx_server_handoff_cb,
+                               worker);
+
+  if (vsx_log_available ())
+    worker->stats_source =
+      vsx_main_context_add_timer (NULL, /* default context */
+                                  VSX_SERVER_STATS_INTERVAL,
+                                  vsx_server_stats_cb,
+                                  worker);
+  else
+    worker->stats_source = NULL;
+}
+
+static void
+vsx_server_worker_stop (VsxServerWorker *worker)
+{
+  while (!vsx_list_empty (&worker->connections))
+    {
+      VsxServerConnection *connection =
+        vsx_container_of (worker->connections.next, connection, link);
+      vsx_server_remove_connection (worker, connection);
+    }
+
+  vsx_object_unref (worker->person_set);
+  worker->person_set = NULL;
+
+  vsx_object_unref (worker->pending_conversations);
+  worker->pending_conversations = NULL;
+
+  vsx_main_context_remove_source (worker->server_socket_source);
+  worker->server_socket_source = NULL;
+
+  vsx_main_context_remove_source (worker->handoff_source);
+  worker->handoff_source = NULL;
+
+  if (worker->stats_source)
+    {
+      vsx_main_context_remove_source (worker->stats_source);
+      worker->stats_source = NULL;
+    }
+}
+
+static void
+flush_dirty_connections (VsxServerWorker *worker)
+{
+  VsxServerConnection *connection;
+
+  /* Updating a connection can cause other connections to become
+   * dirty so this keeps going until the list is empty */
+  while (!vsx_list_empty (&worker->dirty_connections))
+    {
+      connection = vsx_container_of (worker->dirty_connections.next,
+                                     connection,
+                                     dirty_link);
+      vsx_list_remove (&connection->dirty_link);
+      connection->dirty = FALSE;
+
+      update_connection (connection);
+    }
+}
+
+static void
+vsx_server_worker_iterate (VsxServerWorker *worker)
+{
+  vsx_main_context_poll (NULL /* default context */);
+  flush_dirty_connections (worker);
+
+  if (worker->n_accepted > 0)
+    {
+      vsx_histogram_record (&worker->accepts_per_wakeup,
+                            worker->n_accepted);
+      worker->n_accepted = 0;
+    }
+}
+
+static void
+vsx_server_worker_run (VsxServerWorker *worker)
+{
+  while (!worker->quit && !worker->fatal_error)
+    vsx_server_worker_iterate (worker);
+}
+
+static void
+block_quit_signals (void)
+{
+  sigset_t sigset;
+
+  sigemptyset (&sigset);
+  sigaddset (&sigset, SIGINT);
+  sigaddset (&sigset, SIGTERM);
+
+  if (pthread_sigmask (SIG_BLOCK, &sigset, NULL) == -1)
+    g_warning ("pthread_sigmask failed: %s", strerror (errno));
+}
+
+static gpointer
+vsx_server_worker_thread_func (gpointer user_data)
+{
+  VsxServerWorker *worker = user_data;
+  VsxMainContext *mc;
+
+  /* The quit signals are only handled by the thread running the
+     first worker */
+  block_quit_signals ();
+
+  /* This creates a new default context for this thread */
+  mc = vsx_main_context_get_default (&worker->fatal_error);
+
+  if (mc)
+    {
+      vsx_server_worker_start (worker);
+      vsx_server_worker_run (worker);
+      vsx_server_worker_stop (worker);
+
+      vsx_main_context_free (mc);
+    }
+
+  /* If we've stopped because of an error then make the first worker
+     quit so that vsx_server_run can report it */
+  if (worker->fatal_error)
+    send_handoff_message (worker->server->workers, NULL);
+
+  return NULL;
+}
+
+static void
+free_pending_handoffs (VsxServerWorker *worker)
+{
+  VsxServerConnection *connection, *tmp;
+
+  vsx_list_for_each_safe (connection, tmp, &worker->handoff_queue, link)
+    {
+      vsx_list_remove (&connection->link);
+      vsx_server_connection_free (connection);
+    }
+}
+
 VsxServer *
 vsx_server_new (GSocketAddress *address,
+                int n_workers,
+                int backlog,
                 GError **error)
 {
   VsxServer *server;
-  GSocket *socket;
+  GSocket *systemd_socket = NULL;
+  int i;
 
   g_return_val_if_fail (G_IS_SOCKET_ADDRESS (address), NULL);
+  g_return_val_if_fail (n_workers >= 1, NULL);
+  g_return_val_if_fail (backlog >= 1, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  socket = create_server_socket (address, error);
-
-  if (socket == NULL)
+#ifdef USE_SYSTEMD
+  if (!get_systemd_socket (&systemd_socket, error))
     return NULL;
+#endif
 
   server = g_new0 (VsxServer, 1);
+  server->n_workers = n_workers;
+  server->workers = g_new0 (VsxServerWorker, n_workers);
 
-  server->server_socket = socket;
-  server->person_set = vsx_person_set_new ();
+  /* This is done for all of the workers first so that the error
+     path can clean them all up */
+  for (i = 0; i < n_workers; i++)
+    {
+      VsxServerWorker *worker = server->workers + i;
 
-  server->pending_conversations = vsx_conversation_set_new ();
+      worker->server = server;
+      worker->num = i;
+      g_mutex_init (&worker->handoff_mutex);
+      vsx_list_init (&worker->handoff_queue);
+      worker->handoff_fd = -1;
+    }
 
-  server->server_socket_source =
-    vsx_main_context_add_poll (NULL /* default context */,
-                               g_socket_get_fd (socket),
-                               VSX_MAIN_CONTEXT_POLL_IN,
-                               vsx_server_pending_connection_cb,
-                               server);
+  for (i = 0; i < n_workers; i++)
+    {
+      VsxServerWorker *worker = server->workers + i;
+
+      /* If systemd gave us a socket then all of the workers share it,
+         otherwise each worker gets its own socket bound to the same
+         port with SO_REUSEPORT so that the kernel balances the
+         connections. The systemd socket keeps the backlog from its
+         unit file */
+      if (systemd_socket)
+        worker->server_socket = g_object_ref (systemd_socket);
+      else
+        worker->server_socket = create_server_socket (address,
+                                                      n_workers > 1,
+                                                      backlog,
+                                                      error);
+
+      if (worker->server_socket == NULL)
+        goto error;
+
+      worker->handoff_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      if (worker->handoff_fd == -1)
+        {
+          g_set_error (error,
+                       G_FILE_ERROR,
+                       g_file_error_from_errno (errno),
+                       "Error creating handoff eventfd: %s",
+                       strerror (errno));
+          goto error;
+        }
+    }
+
+  if (systemd_socket)
+    g_object_unref (systemd_socket);
 
-  vsx_list_init (&server->connections);
+  /* The other workers are started in their own threads by
+     vsx_server_run */
+  vsx_server_worker_start (server->workers);
 
   return server;
+
+ error:
+  if (systemd_socket)
+    g_object_unref (systemd_socket);
+
+  for (i = 0; i < n_workers; i++)
+    {
+      VsxServerWorker *worker = server->workers + i;
+
+      if (worker->server_socket)
+        g_object_unref (worker->server_socket);
+      if (worker->handoff_fd != -1)
+        close (worker->handoff_fd);
+      g_mutex_clear (&worker->handoff_mutex);
+    }
+
+  g_free (server->workers);
+  g_free (server);
+
+  return NULL;
 }
 
 static void
@@ -885,65 +1963,120 @@ static void
 log_server_listening (VsxServer *server)
 {
   GSocketAddress *address =
-    g_socket_get_local_address (server->server_socket, NULL);
+    g_socket_get_local_address (server->workers[0].server_socket, NULL);
   char *address_string = get_address_string (address, TRUE /* include_port */);
 
-  vsx_log ("Server listening on %s", address_string);
+  if (server->n_workers > 1)
+    vsx_log ("Server listening on %s with %i workers",
+             address_string,
+             server->n_workers);
+  else
+    vsx_log ("Server listening on %s", address_string);
 
   g_free (address_string);
 }
 
+static void
+stop_worker_threads (VsxServer *server)
+{
+  int i;
+
+  for (i = 1; i < server->n_workers; i++)
+    {
+      VsxServerWorker *worker = server->workers + i;
+
+      if (worker->thread == NULL)
+        continue;
+
+      send_handoff_message (worker, NULL);
+      g_thread_join (worker->thread);
+      worker->thread = NULL;
+    }
+}
+
 gboolean
 vsx_server_run (VsxServer *server,
                 GError **error)
 {
+  VsxServerWorker *first_worker = server->workers;
   VsxMainContextSource *quit_source;
   gboolean quit_received = FALSE;
+  int i;
 
   /* We have to make the quit source here instead of during
      vsx_server_new because if we are daemonized then the process will
      be different by the time we reach here so the signalfd needs to
-     be created in the new process */
+     be created in the new process. The same goes for the worker
+     threads */
   quit_source = vsx_main_context_add_quit (NULL /* default context */,
                                            vsx_server_quit_cb,
                                            &quit_received);
 
   log_server_listening (server);
 
-  do
-    vsx_main_context_poll (NULL /* default context */);
-  while (!quit_received && !server->fatal_error);
+  for (i = 1; i < server->n_workers; i++)
+    {
+      VsxServerWorker *worker = server->workers + i;
+
+      worker->quit = FALSE;
+      worker->thread = g_thread_try_new ("vsx-worker",
+                                         vsx_server_worker_thread_func,
+                                         worker,
+                                         &first_worker->fatal_error);
+
+      if (worker->thread == NULL)
+        break;
+    }
+
+  first_worker->quit = FALSE;
+
+  while (!quit_received && !first_worker->quit && !first_worker->fatal_error)
+    vsx_server_worker_iterate (first_worker);
 
   vsx_main_context_remove_source (quit_source);
 
-  if (server->fatal_error)
+  stop_worker_threads (server);
+
+  for (i = 0; i < server->n_workers; i++)
     {
-      g_propagate_error (error, server->fatal_error);
-      server->fatal_error = NULL;
+      VsxServerWorker *worker = server->workers + i;
 
-      return FALSE;
+      if (worker->fatal_error)
+        {
+          g_propagate_error (error, worker->fatal_error);
+          worker->fatal_error = NULL;
+
+          return FALSE;
+        }
     }
-  else
-    return TRUE;
+
+  return TRUE;
 }
 
 void
 vsx_server_free (VsxServer *server)
 {
-  while (!vsx_list_empty (&server->connections))
+  int i;
+
+  vsx_server_worker_stop (server->workers);
+
+  for (i = 0; i < server->n_workers; i++)
     {
-      VsxServerConnection *connection =
-        vsx_container_of (server->connections.next, connection, link);
-      vsx_server_remove_connection (server, connection);
-    }
+      VsxServerWorker *worker = server->workers + i;
 
-  vsx_object_unref (server->person_set);
+      /* Any connections that were handed over after the worker
+         stopped are still sitting in the queue */
+      free_pending_handoffs (worker);
 
-  vsx_object_unref (server->pending_conversations);
+      close (worker->handoff_fd);
+      g_mutex_clear (&worker->handoff_mutex);
 
-  vsx_main_context_remove_source (server->server_socket_source);
+      g_object_unref (worker->server_socket);
 
-  g_object_unref (server->server_socket);
+      if (worker->fatal_error)
+        g_error_free (worker->fatal_error);
+    }
 
+  g_free (server->workers);
   g_free (server);
 }
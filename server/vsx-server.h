@@ -28,6 +28,8 @@ typedef struct _VsxServer VsxServer;
 
 VsxServer *
 vsx_server_new (GSocketAddress *address,
+                int n_workers,
+                int backlog,
                 GError **error);
 
 gboolean
@@ -55,12 +55,12 @@ real_request_line_received (VsxRequestHandler *handler,
 
       if (self->person == NULL)
         self->response =
-          vsx_string_response_new (VSX_STRING_RESPONSE_NOT_FOUND);
+          vsx_string_response_get (VSX_STRING_RESPONSE_NOT_FOUND);
       else
         vsx_object_ref (self->person);
     }
   else
-    self->response = vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+    self->response = vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
 }
 
 static VsxResponse *
@@ -75,7 +75,7 @@ real_request_finished (VsxRequestHandler *handler)
 
       klass->do_request (self, self->person);
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_OK);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_OK);
     }
   else if (self->response)
     return vsx_object_ref (self->response);
@@ -83,7 +83,7 @@ real_request_finished (VsxRequestHandler *handler)
     {
       g_warn_if_reached ();
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
     }
 }
 
@@ -92,15 +92,19 @@ vsx_simple_handler_get_class (void)
 {
   static VsxSimpleHandlerClass klass;
   static VsxObjectClass *object_class = (VsxObjectClass *) &klass;
+  static gsize initialized = 0;
 
-  if (object_class->free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass.parent_class = *vsx_request_handler_get_class ();
       object_class->instance_size = sizeof (VsxSimpleHandler);
+      object_class->name = "VsxSimpleHandler";
       object_class->free = real_free;
 
       klass.parent_class.request_line_received = real_request_line_received;
       klass.parent_class.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -0,0 +1,241 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "vsx-slab.h"
+#include "vsx-list.h"
+
+/* Maximum number of bytes worth of objects that each thread will
+ * keep in the free list of one slab. Anything freed after that goes
+ * straight back to malloc so that a burst of connections doesn't
+ * hold on to the memory forever */
+#define VSX_SLAB_MAX_CACHE_SIZE (1024 * 1024)
+
+typedef struct
+{
+  /* Singly-linked list of freed objects. The first pointer in each
+     object points to the next one */
+  void *free_list;
+  size_t n_free;
+
+  /* Number of objects allocated by this thread minus the number it
+     has freed. This can be negative if objects are freed by a
+     different thread. It is only written by the owning thread */
+  int n_live;
+} VsxSlabCache;
+
+typedef struct
+{
+  int n_caches;
+  VsxSlabCache *caches;
+
+  /* Link in the list of all threads so that the counts can be added
+     up */
+  VsxList link;
+} VsxSlabThreadData;
+
+static void
+free_thread_data (void *data);
+
+static GPrivate vsx_slab_thread_data = G_PRIVATE_INIT (free_thread_data);
+
+/* Protects the list of slabs, the assignment of the indices and the
+   list of threads. The array of caches for a thread is only resized
+   while holding it */
+static GMutex vsx_slab_mutex;
+static VsxSlab *vsx_slab_list = NULL;
+static int vsx_slab_n_slabs = 0;
+static VsxList vsx_slab_threads = { &vsx_slab_threads, &vsx_slab_threads };
+
+static void
+free_thread_data (void *data)
+{
+  VsxSlabThreadData *thread_data = data;
+  VsxSlab *slab;
+  int i;
+
+  g_mutex_lock (&vsx_slab_mutex);
+
+  vsx_list_remove (&thread_data->link);
+
+  /* Objects allocated by this thread might still be alive so its
+     count is moved into the slab */
+  for (slab = vsx_slab_list; slab; slab = slab->next)
+    {
+      if (slab->index <= thread_data->n_caches)
+        slab->n_live += thread_data->caches[slab->index - 1].n_live;
+    }
+
+  g_mutex_unlock (&vsx_slab_mutex);
+
+  for (i = 0; i < thread_data->n_caches; i++)
+    {
+      void *object, *next;
+
+      for (object = thread_data->caches[i].free_list; object; object = next)
+        {
+          next = *(void **) object;
+          g_free (object);
+        }
+    }
+
+  g_free (thread_data->caches);
+  g_free (thread_data);
+}
+
+static int
+register_slab (VsxSlab *slab)
+{
+  int index;
+
+  g_mutex_lock (&vsx_slab_mutex);
+
+  index = slab->index;
+
+  if (index == 0)
+    {
+      slab->next = vsx_slab_list;
+      vsx_slab_list = slab;
+      index = ++vsx_slab_n_slabs;
+      g_atomic_int_set (&slab->index, index);
+    }
+
+  g_mutex_unlock (&vsx_slab_mutex);
+
+  return index;
+}
+
+static VsxSlabCache *
+get_cache (VsxSlab *slab)
+{
+  VsxSlabThreadData *thread_data = g_private_get (&vsx_slab_thread_data);
+  int index = g_atomic_int_get (&slab->index);
+
+  if (G_UNLIKELY (index == 0))
+    index = register_slab (slab);
+
+  if (G_UNLIKELY (thread_data == NULL))
+    {
+      thread_data = g_new0 (VsxSlabThreadData, 1);
+      g_private_set (&vsx_slab_thread_data, thread_data);
+
+      g_mutex_lock (&vsx_slab_mutex);
+      vsx_list_insert (&vsx_slab_threads, &thread_data->link);
+      g_mutex_unlock (&vsx_slab_mutex);
+    }
+
+  if (G_UNLIKELY (thread_data->n_caches < index))
+    {
+      g_mutex_lock (&vsx_slab_mutex);
+      thread_data->caches = g_renew (VsxSlabCache,
+                                     thread_data->caches,
+                                     index);
+      memset (thread_data->caches + thread_data->n_caches,
+              0,
+              sizeof (VsxSlabCache) * (index - thread_data->n_caches));
+      thread_data->n_caches = index;
+      g_mutex_unlock (&vsx_slab_mutex);
+    }
+
+  return thread_data->caches + index - 1;
+}
+
+void *
+vsx_slab_alloc (VsxSlab *slab)
+{
+  VsxSlabCache *cache = get_cache (slab);
+  void *object;
+
+  if (cache->free_list)
+    {
+      object = cache->free_list;
+      cache->free_list = *(void **) object;
+      cache->n_free--;
+    }
+  else
+    {
+      g_assert (slab->size >= sizeof (void *));
+      object = g_malloc (slab->size);
+    }
+
+  cache->n_live++;
+
+  return object;
+}
+
+void *
+vsx_slab_alloc0 (VsxSlab *slab)
+{
+  void *object = vsx_slab_alloc (slab);
+
+  memset (object, 0, slab->size);
+
+  return object;
+}
+
+void
+vsx_slab_free (VsxSlab *slab,
+               void *object)
+{
+  VsxSlabCache *cache = get_cache (slab);
+
+  cache->n_live--;
+
+  if ((cache->n_free + 1) * slab->size > VSX_SLAB_MAX_CACHE_SIZE)
+    g_free (object);
+  else
+    {
+      *(void **) object = cache->free_list;
+      cache->free_list = object;
+      cache->n_free++;
+    }
+}
+
+void
+vsx_slab_foreach (VsxSlabCallback callback,
+                  void *user_data)
+{
+  VsxSlabThreadData *thread_data;
+  VsxSlab *slab;
+  int n_live;
+
+  g_mutex_lock (&vsx_slab_mutex);
+
+  for (slab = vsx_slab_list; slab; slab = slab->next)
+    {
+      n_live = slab->n_live;
+
+      vsx_list_for_each (thread_data, &vsx_slab_threads, link)
+        {
+          if (slab->index <= thread_data->n_caches)
+            n_live += thread_data->caches[slab->index - 1].n_live;
+        }
+
+      if (n_live > slab->peak)
+        slab->peak = n_live;
+
+      callback (slab->name, slab->size, n_live, slab->peak, user_data);
+    }
+
+  g_mutex_unlock (&vsx_slab_mutex);
+}
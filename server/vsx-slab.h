@@ -0,0 +1,88 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_SLAB_H__
+#define __VSX_SLAB_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An allocator for objects of a fixed size. Freed objects are kept
+ * on a free list for each thread so that allocating them again
+ * doesn't need to go through malloc and doesn't need any locking. An
+ * object can be freed from a different thread than the one that
+ * allocated it in which case it ends up in the cache of the freeing
+ * thread. Each thread keeps a count of the live objects in each slab
+ * so that the memory used by each type can be logged without the
+ * threads having to share a counter. */
+
+typedef struct _VsxSlab VsxSlab;
+
+struct _VsxSlab
+{
+  const char *name;
+  size_t size;
+
+  /* The rest of the members are private */
+
+  /* Position of the slab's cache in each thread's array plus one, or
+     zero if the slab hasn't been used yet */
+  int index;
+
+  /* Number of objects left allocated by threads that have exited
+     and the most live objects seen by vsx_slab_foreach. These are
+     protected by a mutex */
+  int n_live;
+  int peak;
+
+  /* Link in the list of all slabs that have been used */
+  VsxSlab *next;
+};
+
+/* Can be used to statically initialise a slab for a type */
+#define VSX_SLAB_INIT(type) { .name = #type, .size = sizeof (type) }
+
+typedef void
+(* VsxSlabCallback) (const char *name,
+                     size_t size,
+                     int n_live,
+                     int peak,
+                     void *user_data);
+
+void *
+vsx_slab_alloc (VsxSlab *slab);
+
+void *
+vsx_slab_alloc0 (VsxSlab *slab);
+
+void
+vsx_slab_free (VsxSlab *slab,
+               void *object);
+
+/* Calls the callback with the statistics for every slab that has
+   been used in any thread. The counts of the other threads are read
+   while they might be changing so the totals are only approximate.
+   The peak is the highest total seen by any call to this function */
+void
+vsx_slab_foreach (VsxSlabCallback callback,
+                  void *user_data);
+
+G_END_DECLS
+
+#endif /* __VSX_SLAB_H__ */
@@ -37,12 +37,15 @@ static const VsxSimpleHandlerClass *
 vsx_start_typing_handler_get_class (void)
 {
   static VsxSimpleHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (((VsxObjectClass *) &klass)->free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_simple_handler_get_class ();
 
       klass.do_request = real_do_request;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -77,106 +77,68 @@ ok_response[] =
   "\r\n"
   "OK\r\n";
 
-static void
-get_message (VsxStringResponseType type,
-             const char **message_buffer,
-             unsigned int *message_length)
-{
-  switch (type)
+static gboolean
+vsx_string_response_get_static_data (VsxResponse *response,
+                                     const guint8 **data,
+                                     unsigned int *length);
+
+static const VsxResponseClass
+string_response_class =
+  {
+    .parent_class =
     {
-    case VSX_STRING_RESPONSE_BAD_REQUEST:
-      *message_buffer = bad_request_response;
-      *message_length = sizeof (bad_request_response) - 1;
-      return;
-
-    case VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST:
-      *message_buffer = unsupported_request_response;
-      *message_length = sizeof (unsupported_request_response) - 1;
-      return;
-
-    case VSX_STRING_RESPONSE_NOT_FOUND:
-      *message_buffer = not_found_response;
-      *message_length = sizeof (not_found_response) - 1;
-      return;
-
-    case VSX_STRING_RESPONSE_PREFLIGHT_POST_OK:
-      *message_buffer = preflight_post_ok;
-      *message_length = sizeof (preflight_post_ok) - 1;
-      return;
-
-    case VSX_STRING_RESPONSE_REQUEST_TIMEOUT:
-      *message_buffer = request_timeout;
-      *message_length = sizeof (request_timeout) - 1;
-      return;
-
-    case VSX_STRING_RESPONSE_OK:
-      *message_buffer = ok_response;
-      *message_length = sizeof (ok_response) - 1;
-      return;
-    }
-
-  g_assert_not_reached ();
-}
-
-static unsigned int
-vsx_string_response_add_data (VsxResponse *response,
-                              guint8 *data,
-                              unsigned int length)
-{
-  VsxStringResponse *self = (VsxStringResponse *) response;
-  const char *message_buffer;
-  unsigned int message_length;
-  unsigned int to_write;
-
-  get_message (self->type, &message_buffer, &message_length);
-
-  to_write = MIN (length, message_length - self->output_pos);
-  memcpy (data, message_buffer + self->output_pos, to_write);
-
-  self->output_pos += to_write;
-
-  return to_write;
-}
+      .instance_size = sizeof (VsxStringResponse),
+      .name = "VsxStringResponse",
+      /* The instances are never freed */
+      .free = NULL
+    },
+    .get_static_data = vsx_string_response_get_static_data
+  };
+
+#define STRING_RESPONSE(message)                                        \
+  {                                                                     \
+    .parent = { .parent = { .klass = &string_response_class.parent_class, \
+                            .ref_count = 0 } },                         \
+    .data = (message),                                                  \
+    .length = sizeof (message) - 1                                      \
+  }
+
+static const VsxStringResponse
+string_responses[] =
+  {
+    [VSX_STRING_RESPONSE_BAD_REQUEST] =
+    STRING_RESPONSE (bad_request_response),
+    [VSX_STRING_RESPONSE_UNSUPPORTED_REQUEST] =
+    STRING_RESPONSE (unsupported_request_response),
+    [VSX_STRING_RESPONSE_NOT_FOUND] =
+    STRING_RESPONSE (not_found_response),
+    [VSX_STRING_RESPONSE_REQUEST_TIMEOUT] =
+    STRING_RESPONSE (request_timeout),
+    [VSX_STRING_RESPONSE_PREFLIGHT_POST_OK] =
+    STRING_RESPONSE (preflight_post_ok),
+    [VSX_STRING_RESPONSE_OK] =
+    STRING_RESPONSE (ok_response)
+  };
 
 static gboolean
-vsx_string_response_is_finished (VsxResponse *response)
+vsx_string_response_get_static_data (VsxResponse *response,
+                                     const guint8 **data,
+                                     unsigned int *length)
 {
   VsxStringResponse *self = (VsxStringResponse *) response;
-  const char *message_buffer;
-  unsigned int message_length;
 
-  get_message (self->type, &message_buffer, &message_length);
+  *data = (const guint8 *) self->data;
+  *length = self->length;
 
-  return self->output_pos >= message_length;
-}
-
-static VsxResponseClass *
-vsx_string_response_get_class (void)
-{
-  static VsxResponseClass klass;
-
-  if (klass.parent_class.free == NULL)
-    {
-      klass = *vsx_response_get_class ();
-
-      klass.parent_class.instance_size = sizeof (VsxStringResponse);
-
-      klass.add_data = vsx_string_response_add_data;
-      klass.is_finished = vsx_string_response_is_finished;
-    }
-
-  return &klass;
+  return TRUE;
 }
 
 VsxResponse *
-vsx_string_response_new (VsxStringResponseType type)
+vsx_string_response_get (VsxStringResponseType type)
 {
-  VsxStringResponse *self =
-    vsx_object_allocate (vsx_string_response_get_class ());
-
-  vsx_response_init (self);
-
-  self->type = type;
+  g_return_val_if_fail (type < G_N_ELEMENTS (string_responses), NULL);
 
-  return (VsxResponse *) self;
+  /* The instances are never modified. The reference counting skips
+     them because their ref_count is zero */
+  return (VsxResponse *) &string_responses[type];
 }
@@ -33,17 +33,20 @@ typedef enum
   VSX_STRING_RESPONSE_OK
 } VsxStringResponseType;
 
+/* The string responses are shared, statically allocated instances so
+   getting one doesn't allocate anything. They can still be passed to
+   vsx_object_ref and vsx_object_unref as normal */
+
 typedef struct
 {
   VsxResponse parent;
 
-  VsxStringResponseType type;
-
-  unsigned int output_pos;
+  const char *data;
+  unsigned int length;
 } VsxStringResponse;
 
 VsxResponse *
-vsx_string_response_new (VsxStringResponseType type);
+vsx_string_response_get (VsxStringResponseType type);
 
 G_END_DECLS
 
@@ -0,0 +1,154 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "vsx-tile-grid.h"
+
+/* Converts a coordinate to a cell number before wrapping it. The
+   coordinates are offset so that negative numbers don't need any
+   special handling. Coordinates passed to the grid come from 16-bit
+   integers, possibly with a tile size added or subtracted, so they
+   can't go below this */
+#define VSX_TILE_GRID_COORD_OFFSET 65536
+
+G_STATIC_ASSERT ((1 << VSX_TILE_GRID_CELL_SHIFT) >= VSX_TILE_SIZE);
+G_STATIC_ASSERT ((VSX_TILE_GRID_SIZE & (VSX_TILE_GRID_SIZE - 1)) == 0);
+
+static unsigned int
+get_cell_coord (int coord)
+{
+  return ((unsigned int) (coord + VSX_TILE_GRID_COORD_OFFSET) >>
+          VSX_TILE_GRID_CELL_SHIFT);
+}
+
+static unsigned int
+get_cell (unsigned int cell_x,
+          unsigned int cell_y)
+{
+  return ((cell_y & (VSX_TILE_GRID_SIZE - 1)) * VSX_TILE_GRID_SIZE +
+          (cell_x & (VSX_TILE_GRID_SIZE - 1)));
+}
+
+static unsigned int
+get_tile_cell (const VsxTile *tile)
+{
+  return get_cell (get_cell_coord (tile->x), get_cell_coord (tile->y));
+}
+
+void
+vsx_tile_grid_init (VsxTileGrid *grid)
+{
+  /* Setting all of the bytes to 0xff makes every cell -1 */
+  memset (grid->cells, 0xff, sizeof grid->cells);
+}
+
+static void
+link_tile (VsxTileGrid *grid,
+           int tile_num,
+           unsigned int cell)
+{
+  int head = grid->cells[cell];
+
+  grid->next[tile_num] = head;
+  grid->prev[tile_num] = -1;
+
+  if (head != -1)
+    grid->prev[head] = tile_num;
+
+  grid->cells[cell] = tile_num;
+  grid->tile_cells[tile_num] = cell;
+}
+
+static void
+unlink_tile (VsxTileGrid *grid,
+             int tile_num)
+{
+  int next = grid->next[tile_num];
+  int prev = grid->prev[tile_num];
+
+  if (prev == -1)
+    grid->cells[grid->tile_cells[tile_num]] = next;
+  else
+    grid->next[prev] = next;
+
+  if (next != -1)
+    grid->prev[next] = prev;
+}
+
+void
+vsx_tile_grid_add (VsxTileGrid *grid,
+                   const VsxTile *tiles,
+                   int tile_num)
+{
+  link_tile (grid, tile_num, get_tile_cell (tiles + tile_num));
+}
+
+void
+vsx_tile_grid_update (VsxTileGrid *grid,
+                      const VsxTile *tiles,
+                      int tile_num)
+{
+  unsigned int cell = get_tile_cell (tiles + tile_num);
+
+  if (cell == grid->tile_cells[tile_num])
+    return;
+
+  unlink_tile (grid, tile_num);
+  link_tile (grid, tile_num, cell);
+}
+
+gboolean
+vsx_tile_grid_is_free (const VsxTileGrid *grid,
+                       const VsxTile *tiles,
+                       int x,
+                       int y)
+{
+  unsigned int min_x = get_cell_coord (x - VSX_TILE_SIZE + 1);
+  unsigned int max_x = get_cell_coord (x + VSX_TILE_SIZE - 1);
+  unsigned int min_y = get_cell_coord (y - VSX_TILE_SIZE + 1);
+  unsigned int max_y = get_cell_coord (y + VSX_TILE_SIZE - 1);
+  unsigned int cell_x, cell_y;
+  int tile_num;
+
+  /* Any tile that overlaps the position must have its top-left
+   * corner within a tile's width of it so it can only be in one of
+   * these cells */
+  for (cell_y = min_y; cell_y <= max_y; cell_y++)
+    for (cell_x = min_x; cell_x <= max_x; cell_x++)
+      {
+        for (tile_num = grid->cells[get_cell (cell_x, cell_y)];
+             tile_num != -1;
+             tile_num = grid->next[tile_num])
+          {
+            const VsxTile *tile = tiles + tile_num;
+
+            if (x + VSX_TILE_SIZE > tile->x &&
+                x < tile->x + VSX_TILE_SIZE &&
+                y + VSX_TILE_SIZE > tile->y &&
+                y < tile->y + VSX_TILE_SIZE)
+              return FALSE;
+          }
+      }
+
+  return TRUE;
+}
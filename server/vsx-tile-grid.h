@@ -0,0 +1,84 @@
+/*
+ * Verda Ŝtelo - An anagram game in Esperanto for the web
+ * Copyright (C) 2013  Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VSX_TILE_GRID_H__
+#define __VSX_TILE_GRID_H__
+
+#include <glib.h>
+
+#include "vsx-tile.h"
+#include "vsx-tile-data.h"
+
+G_BEGIN_DECLS
+
+/* A spatial index of the tiles that are in play so that checking
+ * whether a position is free doesn't have to look at every tile.
+ * Each tile is put in the cell containing its top-left corner. The
+ * cells are big enough that a tile can only overlap tiles in the
+ * cells around its own. The grid wraps around so that it can cover
+ * the whole range of coordinates with a fixed number of cells. Tiles
+ * far apart might end up sharing a cell but that only costs an extra
+ * comparison. The grid is big enough that this won't happen within
+ * the area where the tiles are normally placed. */
+
+/* log2 of the width of a cell. This must be at least
+   VSX_TILE_SIZE */
+#define VSX_TILE_GRID_CELL_SHIFT 5
+/* Number of cells along each side. This must be a power of two */
+#define VSX_TILE_GRID_SIZE 32
+
+typedef struct
+{
+  /* The first tile in each cell or -1 if the cell is empty */
+  gint16 cells[VSX_TILE_GRID_SIZE * VSX_TILE_GRID_SIZE];
+
+  /* Doubly-linked list of tiles in the same cell */
+  gint16 next[VSX_TILE_DATA_N_TILES];
+  gint16 prev[VSX_TILE_DATA_N_TILES];
+
+  /* The cell that each tile is in */
+  guint16 tile_cells[VSX_TILE_DATA_N_TILES];
+} VsxTileGrid;
+
+void
+vsx_tile_grid_init (VsxTileGrid *grid);
+
+/* Adds a tile that wasn't in the grid before at its current
+   position */
+void
+vsx_tile_grid_add (VsxTileGrid *grid,
+                   const VsxTile *tiles,
+                   int tile_num);
+
+/* Must be called after the position of a tile in the grid changes */
+void
+vsx_tile_grid_update (VsxTileGrid *grid,
+                      const VsxTile *tiles,
+                      int tile_num);
+
+/* Returns TRUE if a tile at the given position wouldn't overlap any
+   tile in the grid */
+gboolean
+vsx_tile_grid_is_free (const VsxTileGrid *grid,
+                       const VsxTile *tiles,
+                       int x,
+                       int y);
+
+G_END_DECLS
+
+#endif /* __VSX_TILE_GRID_H__ */
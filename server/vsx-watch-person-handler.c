@@ -38,6 +38,44 @@ real_free (void *object)
   vsx_request_handler_get_class ()->parent_class.free (object);
 }
 
+static gboolean
+parse_arguments (const char *query_string,
+                 VsxPersonId *id,
+                 int *last_message,
+                 int *last_version,
+                 VsxFormatEncoding *encoding)
+{
+  char *encoding_name;
+  gboolean ret;
+
+  /* The last version and the encoding are optional so that older
+   * clients still work */
+  *last_version = 0;
+  *encoding = VSX_FORMAT_ENCODING_JSON;
+
+  if (vsx_arguments_parse ("piis",
+                           query_string,
+                           id,
+                           last_message,
+                           last_version,
+                           &encoding_name))
+    {
+      ret = vsx_format_parse_encoding (encoding_name, encoding);
+      g_free (encoding_name);
+      return ret;
+    }
+
+  return (vsx_arguments_parse ("pii",
+                               query_string,
+                               id,
+                               last_message,
+                               last_version) ||
+          vsx_arguments_parse ("pi",
+                               query_string,
+                               id,
+                               last_message));
+}
+
 static void
 real_request_line_received (VsxRequestHandler *handler,
                             VsxRequestMethod method,
@@ -46,34 +84,41 @@ real_request_line_received (VsxRequestHandler *handler,
   VsxWatchPersonHandler *self = (VsxWatchPersonHandler *) handler;
   VsxPersonId id;
   int last_message;
+  int last_version;
+  VsxFormatEncoding encoding;
 
   if (method == VSX_REQUEST_METHOD_GET
-      && vsx_arguments_parse ("pi",
-                              query_string,
-                              &id,
-                              &last_message))
+      && parse_arguments (query_string,
+                          &id,
+                          &last_message,
+                          &last_version,
+                          &encoding))
     {
-      VsxPerson *person = vsx_person_set_get_person (handler->person_set, id);
+      VsxPerson *person =
+        vsx_person_set_activate_person (handler->person_set, id);
 
       if (person == NULL)
         self->response
-          = vsx_string_response_new (VSX_STRING_RESPONSE_NOT_FOUND);
+          = vsx_string_response_get (VSX_STRING_RESPONSE_NOT_FOUND);
       else if (last_message < 0 ||
-               last_message > (person->conversation->messages->len -
-                               person->message_offset))
+               last_message > (person->conversation->n_messages -
+                               person->message_offset) ||
+               last_version < 0 ||
+               last_version > person->conversation->version)
         self->response
-          = vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+          = vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
       else
         {
-          vsx_person_make_noise (person);
           self->response =
             vsx_watch_person_response_new (person,
                                            last_message +
-                                           person->message_offset);
+                                           person->message_offset,
+                                           last_version,
+                                           encoding);
         }
     }
   else
-    self->response = vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+    self->response = vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
 }
 
 static VsxResponse *
@@ -87,7 +132,7 @@ real_request_finished (VsxRequestHandler *handler)
     {
       g_warn_if_reached ();
 
-      return vsx_string_response_new (VSX_STRING_RESPONSE_BAD_REQUEST);
+      return vsx_string_response_get (VSX_STRING_RESPONSE_BAD_REQUEST);
     }
 }
 
@@ -95,15 +140,19 @@ static const VsxRequestHandlerClass *
 vsx_watch_person_handler_get_class (void)
 {
   static VsxRequestHandlerClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_request_handler_get_class ();
       klass.parent_class.instance_size = sizeof (VsxWatchPersonHandler);
+      klass.parent_class.name = "VsxWatchPersonHandler";
       klass.parent_class.free = real_free;
 
       klass.request_line_received = real_request_line_received;
       klass.request_finished = real_request_finished;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -21,10 +21,10 @@
 #endif
 
 #include <string.h>
-#include <stdio.h>
 
 #include "vsx-watch-person-response.h"
 #include "vsx-main-context.h"
+#include "vsx-format.h"
 
 /* Interval in microseconds between keep-alive messages */
 #define VSX_WATCH_PERSON_RESPONSE_KEEP_ALIVE_INTERVAL 60000000 /* 1 minute */
@@ -62,18 +62,40 @@ header_message[] =
   "fino kaj nun povas komenci la veraj datumoj. Ĝuu!\"]\r\n"
   "\r\n";
 
+/* Clients that can read the binary encoding don't need the padding */
+static guint8
+binary_header_message[] =
+  "HTTP/1.1 200 OK\r\n"
+  VSX_RESPONSE_COMMON_HEADERS
+  VSX_RESPONSE_DISABLE_CACHE_HEADERS
+  "Content-Type: application/octet-stream\r\n"
+  "Transfer-Encoding: chunked\r\n"
+  "\r\n";
+
 static guint8
 keep_alive_message[] =
   "10\r\n"
   "[\"keep-alive\"]\r\n"
   "\r\n";
 
+static guint8
+binary_keep_alive_message[] =
+  "2\r\n"
+  "\x07\x00"
+  "\r\n";
+
 static guint8
 sync_message[] =
   "a\r\n"
   "[\"sync\"]\r\n"
   "\r\n";
 
+static guint8
+binary_sync_message[] =
+  "2\r\n"
+  "\x08\x00"
+  "\r\n";
+
 static guint8
 end_message[] =
   "9\r\n"
@@ -82,92 +104,240 @@ end_message[] =
   "0\r\n"
   "\r\n";
 
+static guint8
+binary_end_message[] =
+  "2\r\n"
+  "\x09\x00"
+  "\r\n"
+  "0\r\n"
+  "\r\n";
+
 typedef struct
 {
-  guint8 *data;
+  const guint8 *data;
   unsigned int length;
-} WriteMessageData;
-
+} StaticMessage;
+
+#define STATIC_MESSAGE(message) { (message), sizeof (message) - 1 }
+
+/* The fixed messages for each encoding */
+static const StaticMessage
+header_messages[VSX_FORMAT_N_ENCODINGS] =
+  {
+    STATIC_MESSAGE (header_message),
+    STATIC_MESSAGE (binary_header_message)
+  };
+
+static const StaticMessage
+keep_alive_messages[VSX_FORMAT_N_ENCODINGS] =
+  {
+    STATIC_MESSAGE (keep_alive_message),
+    STATIC_MESSAGE (binary_keep_alive_message)
+  };
+
+static const StaticMessage
+sync_messages[VSX_FORMAT_N_ENCODINGS] =
+  {
+    STATIC_MESSAGE (sync_message),
+    STATIC_MESSAGE (binary_sync_message)
+  };
+
+static const StaticMessage
+end_messages[VSX_FORMAT_N_ENCODINGS] =
+  {
+    STATIC_MESSAGE (end_message),
+    STATIC_MESSAGE (binary_end_message)
+  };
+
+/* Writes a message that will stay valid for the lifetime of the
+ * response. This is added by reference so it won't be copied */
 static gboolean
 write_message (VsxWatchPersonResponse *self,
-               WriteMessageData *message_data,
+               VsxResponseOutput *output,
                const guint8 *message,
                unsigned int message_length)
 {
-  unsigned int to_write = MIN (message_data->length,
-                               message_length - self->message_pos);
-
-  memcpy (message_data->data, message + self->message_pos, to_write);
-  message_data->data += to_write;
-  message_data->length -= to_write;
-  self->message_pos += to_write;
+  self->message_pos +=
+    vsx_response_output_add_static (output,
+                                    message + self->message_pos,
+                                    message_length - self->message_pos);
 
-  /* Some time (half a second) is subtracted from the last write time
-   * so that if we are woken up exactly at the right interval then it
-   * won't skip until the next interval due to the small amount of
-   * time time it takes to write the message */
-  self->last_write_time =
-    vsx_main_context_get_monotonic_clock (NULL) - 500000;
+  self->last_write_time = vsx_main_context_get_monotonic_clock (NULL);
 
   return self->message_pos >= message_length;
 }
 
-#define write_static_message(self, message_data, message) \
-  write_message (self, message_data, message, sizeof (message) - 1)
+/* Copies data that might be gone by the next time the response is
+ * written. If it doesn't all fit in the output then it is kept in
+ * message_copy and the rest is written by write_rest_of_copy.
+ * Returns TRUE if it was all written */
+static gboolean
+write_copied_data (VsxWatchPersonResponse *self,
+                   VsxResponseOutput *output,
+                   const guint8 *data,
+                   unsigned int length)
+{
+  unsigned int copied = vsx_response_output_add_copy (output, data, length);
+
+  if (copied >= length)
+    return TRUE;
+
+  if (self->message_copy == NULL)
+    self->message_copy = g_byte_array_new ();
+
+  g_byte_array_append (self->message_copy, data, length);
+
+  self->message_pos = copied;
+
+  return FALSE;
+}
+
+static gboolean
+has_copied_data (VsxWatchPersonResponse *self)
+{
+  return self->message_copy && self->message_copy->len > 0;
+}
+
+/* Returns TRUE once everything left from write_copied_data has been
+   written */
+static gboolean
+write_rest_of_copy (VsxWatchPersonResponse *self,
+                    VsxResponseOutput *output)
+{
+  self->message_pos +=
+    vsx_response_output_add_copy (output,
+                                  self->message_copy->data +
+                                  self->message_pos,
+                                  self->message_copy->len -
+                                  self->message_pos);
+
+  if (self->message_pos < self->message_copy->len)
+    return FALSE;
+
+  g_byte_array_set_size (self->message_copy, 0);
+
+  return TRUE;
+}
+
+static gboolean
+write_history_message (VsxWatchPersonResponse *self,
+                       VsxResponseOutput *output)
+{
+  const guint8 *data;
+  unsigned int length;
+
+  self->last_write_time = vsx_main_context_get_monotonic_clock (NULL);
+
+  if (has_copied_data (self))
+    return write_rest_of_copy (self, output);
+
+  /* The message is already framed as a chunk */
+  vsx_conversation_get_message (self->person->conversation,
+                                self->message_num,
+                                self->encoding,
+                                &data,
+                                &length);
+
+  return write_copied_data (self, output, data, length);
+}
+
+#define write_static_message(self, output, messages)     \
+  write_message (self,                                  \
+                 output,                                \
+                 (messages)[(self)->encoding].data,     \
+                 (messages)[(self)->encoding].length)
 
 static gboolean
 write_chunked_message (VsxWatchPersonResponse *self,
-                       WriteMessageData *message_data,
+                       VsxResponseOutput *output,
                        const guint8 *message,
                        unsigned int message_length)
 {
-  char length_buf[8 + 2 + 1];
-  unsigned int to_write;
+  char length_buf[VSX_FORMAT_MAX_CHUNK_HEADER_LENGTH];
   int length_length;
 
-  length_length = sprintf (length_buf, "%x\r\n", message_length);
+  length_length = (vsx_format_chunk_header (length_buf, message_length) -
+                   length_buf);
 
   if (self->message_pos < length_length)
     {
-      to_write = MIN (message_data->length, length_length - self->message_pos);
-      memcpy (message_data->data, length_buf + self->message_pos, to_write);
-      message_data->length -= to_write;
-      message_data->data += to_write;
-      self->message_pos += to_write;
+      self->message_pos +=
+        vsx_response_output_add_copy (output,
+                                      length_buf + self->message_pos,
+                                      length_length - self->message_pos);
 
-      if (message_data->length <= 0)
+      if (self->message_pos < length_length)
         return FALSE;
     }
 
   if (self->message_pos - length_length < message_length)
     {
-      to_write = MIN (message_data->length,
-                      message_length + length_length - self->message_pos);
+      self->message_pos +=
+        vsx_response_output_add_copy (output,
+                                      message +
+                                      self->message_pos -
+                                      length_length,
+                                      message_length +
+                                      length_length -
+                                      self->message_pos);
+
+      if (self->message_pos - length_length < message_length)
+        return FALSE;
+    }
+
+  self->message_pos +=
+    vsx_response_output_add_copy (output,
+                                  "\r\n" +
+                                  self->message_pos -
+                                  length_length -
+                                  message_length,
+                                  message_length + length_length + 2 -
+                                  self->message_pos);
 
-      memcpy (message_data->data,
-              message + self->message_pos - length_length,
-              to_write);
+  return self->message_pos >= length_length + message_length + 2;
+}
 
-      message_data->length -= to_write;
-      message_data->data += to_write;
-      self->message_pos += to_write;
+/* Queues everything that has changed since the given version of the
+ * conversation. If the version is zero the client doesn't have
+ * anything yet so the whole state is queued */
+static void
+queue_initial_state (VsxWatchPersonResponse *self,
+                     unsigned int since_version)
+{
+  VsxConversation *conversation = self->person->conversation;
+  int i;
 
-      if (message_data->length <= 0)
-        return FALSE;
-    }
+  G_STATIC_ASSERT (VSX_TILE_DATA_N_TILES <= VSX_SUMMARY_FLAGS_MAX_SIZE);
+  G_STATIC_ASSERT (VSX_CONVERSATION_MAX_PLAYERS <=
+                   VSX_SUMMARY_FLAGS_MAX_SIZE);
 
-  to_write = MIN (message_data->length,
-                  message_length + length_length + 2 - self->message_pos);
+  self->sent_version = since_version;
 
-  memcpy (message_data->data,
-          "\r\n" + self->message_pos - length_length - message_length,
-          to_write);
+  /* The number of tiles has a default value so it won't have a
+   * version if no one has changed it */
+  self->pending_n_tiles = (since_version == 0 ||
+                           conversation->n_tiles_version > since_version);
 
-  message_data->length -= to_write;
-  message_data->data += to_write;
-  self->message_pos += to_write;
+  /* Players are only ever added to the end so the names that the
+   * client already has are all at the start */
+  for (self->named_players = 0;
+       self->named_players < conversation->n_players &&
+         (conversation->player_name_versions[self->named_players] <=
+          since_version);
+       self->named_players++);
+  self->n_snapshot_players = conversation->n_players;
 
-  return self->message_pos >= length_length + message_length + 2;
+  for (i = 0; i < conversation->n_players; i++)
+    {
+      if (conversation->player_versions[i] > since_version)
+        VSX_SUMMARY_FLAGS_SET (self->dirty_players, i, TRUE);
+    }
+
+  for (i = 0; i < conversation->n_tiles_in_play; i++)
+    {
+      if (conversation->tile_versions[i] > since_version)
+        VSX_SUMMARY_FLAGS_SET (self->dirty_tiles, i, TRUE);
+    }
 }
 
 static gboolean
@@ -175,7 +345,6 @@ has_pending_data (VsxWatchPersonResponse *self,
                   VsxWatchPersonResponseState *new_state)
 {
   VsxConversation *conversation = self->person->conversation;
-  int i;
 
   if (self->pending_n_tiles)
     {
@@ -183,38 +352,48 @@ has_pending_data (VsxWatchPersonResponse *self,
       return TRUE;
     }
 
-  if (self->named_players < conversation->n_players)
+  if (self->named_players < self->n_snapshot_players)
     {
       *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_NAME;
       return TRUE;
     }
 
-  for (i = 0; i < G_N_ELEMENTS (self->dirty_players); i++)
-    if (self->dirty_players[i])
-      {
-        *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_PLAYER;
-        return TRUE;
-      }
+  if (VSX_SUMMARY_FLAGS_COUNT (self->dirty_players) > 0)
+    {
+      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_PLAYER;
+      return TRUE;
+    }
 
-  if (self->pending_shout != -1)
+  if (VSX_SUMMARY_FLAGS_COUNT (self->dirty_tiles) > 0)
     {
-      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_SHOUT;
+      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_TILE;
       return TRUE;
     }
 
-  for (i = 0; i < G_N_ELEMENTS (self->dirty_tiles); i++)
-    if (self->dirty_tiles[i])
-      {
-        *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_TILE;
-        return TRUE;
-      }
+  if (vsx_conversation_log_has_data (conversation, &self->log_reader))
+    {
+      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_LOG;
+      return TRUE;
+    }
 
-  if (self->message_num < conversation->messages->len)
+  if (self->message_num < conversation->first_message)
+    {
+      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES_TRUNCATED;
+      return TRUE;
+    }
+
+  if (self->message_num < conversation->n_messages)
     {
       *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES;
       return TRUE;
     }
 
+  if (self->sent_version != conversation->version)
+    {
+      *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_VERSION;
+      return TRUE;
+    }
+
   if (!vsx_player_is_connected (self->person->player))
     {
       *new_state = VSX_WATCH_PERSON_RESPONSE_WRITING_END;
@@ -237,45 +416,39 @@ has_pending_data (VsxWatchPersonResponse *self,
   return FALSE;
 }
 
-static unsigned int
-vsx_watch_person_response_add_data (VsxResponse *response,
-                                    guint8 *data_in,
-                                    unsigned int length_in)
+static void
+vsx_watch_person_response_add_output (VsxResponse *response,
+                                      VsxResponseOutput *output)
 {
   VsxWatchPersonResponse *self = (VsxWatchPersonResponse *) response;
-  WriteMessageData message_data;
-
-  message_data.data = data_in;
-  message_data.length = length_in;
 
   while (TRUE)
     switch (self->state)
       {
       case VSX_WATCH_PERSON_RESPONSE_WRITING_HTTP_HEADER:
         {
-          if (write_static_message (self, &message_data, header_message))
+          if (write_static_message (self, output, header_messages))
             {
               self->message_pos = 0;
               self->state = VSX_WATCH_PERSON_RESPONSE_WRITING_HEADER;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_HEADER:
         {
-          char buf[60];
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
           int length;
 
-          length = sprintf (buf,
-                            "[\"header\", {\"num\": %i, "
-                            "\"id\": \"%016" G_GINT64_MODIFIER "X\"}]\r\n",
-                            self->person->player->num,
-                            self->person->id);
+          length = (self->encoder->header_event (buf,
+                                                 self->person->player->num,
+                                                 self->person->id) -
+                    buf);
 
           if (write_chunked_message (self,
-                                     &message_data,
+                                     output,
                                      (const guint8 *) buf,
                                      length))
             {
@@ -283,7 +456,7 @@ vsx_watch_person_response_add_data (VsxResponse *response,
               self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
@@ -297,14 +470,14 @@ vsx_watch_person_response_add_data (VsxResponse *response,
               self->state = new_state;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_N_TILES:
         {
           VsxConversation *conversation = self->person->conversation;
-          char buf[15 + 10 + 1];
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
           int length;
 
           /* Decide how many tiles to write if we haven't started
@@ -316,16 +489,16 @@ vsx_watch_person_response_add_data (VsxResponse *response,
               /* We want to immediately reset the pending tiles flag
                * so that if it changes again while we are writing then
                * we will end up sending another message */
-              if (message_data.length > 0)
+              if (vsx_response_output_get_buffer_space (output) > 0)
                 self->pending_n_tiles = FALSE;
             }
 
-          length = sprintf (buf,
-                            "[\"n-tiles\", %i]\r\n",
-                            self->dirty.n_tiles);
+          length = (self->encoder->n_tiles_event (buf,
+                                                  self->dirty.n_tiles) -
+                    buf);
 
           if (write_chunked_message (self,
-                                     &message_data,
+                                     output,
                                      (const guint8 *) buf,
                                      length))
             {
@@ -333,7 +506,7 @@ vsx_watch_person_response_add_data (VsxResponse *response,
               self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
@@ -342,25 +515,26 @@ vsx_watch_person_response_add_data (VsxResponse *response,
           VsxPlayer *player =
             self->person->conversation->players[self->named_players];
 
-          if (write_chunked_message (self,
-                                     &message_data,
-                                     (const guint8 *) player->name_message,
-                                     player->name_message_len))
+          /* The name is already framed as a chunk */
+          if (write_message (self,
+                             output,
+                             (const guint8 *)
+                             player->name_message[self->encoding],
+                             player->name_message_len[self->encoding]))
             {
               self->message_pos = 0;
-              if (++self->named_players
-                  >= self->person->conversation->n_players)
+              if (++self->named_players >= self->n_snapshot_players)
                 self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_PLAYER:
         {
           VsxPlayer *player;
-          char buf[71];
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
           int length;
 
           /* Decide which player to update if we haven't started
@@ -368,7 +542,7 @@ vsx_watch_person_response_add_data (VsxResponse *response,
           if (self->message_pos == 0)
             {
               self->dirty.player.num =
-                vsx_flags_find_first_bit (self->dirty_players);
+                VSX_SUMMARY_FLAGS_FIND_FIRST_BIT (self->dirty_players);
 
               player =
                 self->person->conversation->players[self->dirty.player.num];
@@ -378,60 +552,37 @@ vsx_watch_person_response_add_data (VsxResponse *response,
                * so that it changes again while we are still in this
                * state then we will end up sending another message
                * with the new state */
-              if (message_data.length > 0)
-                  VSX_FLAGS_SET (self->dirty_players,
-                                 self->dirty.player.num,
-                                 FALSE);
+              if (vsx_response_output_get_buffer_space (output) > 0)
+                VSX_SUMMARY_FLAGS_SET (self->dirty_players,
+                                       self->dirty.player.num,
+                                       FALSE);
             }
           else
             player =
               self->person->conversation->players[self->dirty.player.num];
 
-          length = sprintf (buf,
-                            "[\"player\", {\"num\": %u, \"flags\": %i}]\r\n",
-                            self->dirty.player.num,
-                            self->dirty.player.flags);
-
-          if (write_chunked_message (self,
-                                     &message_data,
-                                     (const guint8 *) buf,
-                                     length))
-            {
-              self->message_pos = 0;
-              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
-            }
-          else
-            goto done;
-        }
-        break;
-
-      case VSX_WATCH_PERSON_RESPONSE_WRITING_SHOUT:
-        {
-          char buf[24];
-          int length;
-
-          length = sprintf (buf,
-                            "[\"shout\", %u]\r\n",
-                            self->pending_shout);
+          length = (self->encoder->player_event (buf,
+                                                 self->dirty.player.num,
+                                                 self->dirty.player.flags) -
+                    buf);
 
           if (write_chunked_message (self,
-                                     &message_data,
+                                     output,
                                      (const guint8 *) buf,
                                      length))
             {
               self->message_pos = 0;
               self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
-              self->pending_shout = -1;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_TILE:
         {
           const VsxTile *tile;
-          char buf[61 + 10 + 6 + 6 + VSX_TILE_MAX_LETTER_BYTES + 6 + 1];
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
           int length;
 
           /* Decide which tile to update if we haven't started
@@ -439,7 +590,7 @@ vsx_watch_person_response_add_data (VsxResponse *response,
           if (self->message_pos == 0)
             {
               self->dirty.tile.num =
-                vsx_flags_find_first_bit (self->dirty_tiles);
+                VSX_SUMMARY_FLAGS_FIND_FIRST_BIT (self->dirty_tiles);
 
               tile =
                 self->person->conversation->tiles + self->dirty.tile.num;
@@ -451,28 +602,25 @@ vsx_watch_person_response_add_data (VsxResponse *response,
                * so that it changes again while we are still in this
                * state then we will end up sending another message
                * with the new state */
-              if (message_data.length > 0)
-                  VSX_FLAGS_SET (self->dirty_tiles,
-                                 self->dirty.tile.num,
-                                 FALSE);
+              if (vsx_response_output_get_buffer_space (output) > 0)
+                VSX_SUMMARY_FLAGS_SET (self->dirty_tiles,
+                                       self->dirty.tile.num,
+                                       FALSE);
             }
           else
             tile =
               self->person->conversation->tiles + self->dirty.tile.num;
 
-          length = sprintf (buf,
-                            "[\"tile\", {\"num\": %u, "
-                            "\"x\": %i, \"y\": %i, "
-                            "\"letter\": \"%s\", "
-                            "\"player\": %i}]\r\n",
-                            self->dirty.tile.num,
-                            self->dirty.tile.x,
-                            self->dirty.tile.y,
-                            tile->letter,
-                            self->dirty.tile.last_player);
+          length = (self->encoder->tile_event (buf,
+                                               self->dirty.tile.num,
+                                               self->dirty.tile.x,
+                                               self->dirty.tile.y,
+                                               tile->letter,
+                                               self->dirty.tile.last_player) -
+                    buf);
 
           if (write_chunked_message (self,
-                                     &message_data,
+                                     output,
                                      (const guint8 *) buf,
                                      length))
             {
@@ -480,72 +628,175 @@ vsx_watch_person_response_add_data (VsxResponse *response,
               self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
-      case VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES:
+      case VSX_WATCH_PERSON_RESPONSE_WRITING_LOG:
+        {
+          VsxConversation *conversation = self->person->conversation;
+          const guint8 *data;
+          unsigned int length;
+
+          /* Finish writing an event that was too big for the output */
+          if (has_copied_data (self))
+            {
+              if (!write_rest_of_copy (self, output))
+                return;
+
+              self->message_pos = 0;
+              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+              break;
+            }
+
+          if (!vsx_conversation_read_log (conversation,
+                                          &self->log_reader,
+                                          vsx_response_output_get_buffer_space
+                                          (output),
+                                          &data,
+                                          &length))
+            {
+              /* We fell too far behind and the events were discarded
+               * so everything since the last version that we reported
+               * needs to be sent again */
+              queue_initial_state (self, self->sent_version);
+              vsx_conversation_reset_log_reader (conversation,
+                                                 &self->log_reader);
+              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+              break;
+            }
+
+          if (length <= 0)
+            return;
+
+          /* The events are already serialized so they just need to
+           * be copied. They can't be referenced because the log
+           * might be moved before the output is written. A single
+           * event can be bigger than the space in the output, such
+           * as when a flush window collects lots of changes, so
+           * whatever doesn't fit is kept to be written next time */
+          self->log_reader.pos += length;
+
+          if (!write_copied_data (self, output, data, length))
+            return;
+
+          self->message_pos = 0;
+          self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+        }
+        break;
+
+      case VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES_TRUNCATED:
         {
           VsxConversation *conversation = self->person->conversation;
-          VsxConversationMessage *message;
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
+          int length;
 
-          message = &g_array_index (conversation->messages,
-                                    VsxConversationMessage,
-                                    self->message_num);
+          /* Some of the messages that the client hasn't seen have
+           * been discarded so we tell it the number of the next
+           * message that it will get instead */
+          if (self->message_pos == 0)
+            self->message_num = conversation->first_message;
+
+          length = (self->encoder->messages_truncated_event
+                    (buf,
+                     self->message_num - self->person->message_offset) -
+                    buf);
 
           if (write_chunked_message (self,
-                                     &message_data,
-                                     (const guint8 *) message->text,
-                                     message->length))
+                                     output,
+                                     (const guint8 *) buf,
+                                     length))
+            {
+              self->message_pos = 0;
+              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+            }
+          else
+            return;
+        }
+        break;
+
+      case VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES:
+        {
+          if (write_history_message (self, output))
             {
               self->message_pos = 0;
               self->message_num++;
+              /* Go back to checking the state because the next
+               * message might have been discarded by the time we
+               * get to it */
+              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+            }
+          else
+            return;
+        }
+        break;
 
-              if (self->message_num >=
-                  self->person->conversation->messages->len)
-                self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
+      case VSX_WATCH_PERSON_RESPONSE_WRITING_VERSION:
+        {
+          VsxConversation *conversation = self->person->conversation;
+          char buf[VSX_FORMAT_MAX_EVENT_LENGTH];
+          int length;
+
+          /* Everything up to the current version has been sent by
+           * the time we get here so we can report it */
+          if (self->message_pos == 0)
+            {
+              self->dirty.version = conversation->version;
+
+              if (vsx_response_output_get_buffer_space (output) > 0)
+                self->sent_version = self->dirty.version;
+            }
+
+          length = (self->encoder->version_event (buf,
+                                                  self->dirty.version) -
+                    buf);
+
+          if (write_chunked_message (self,
+                                     output,
+                                     (const guint8 *) buf,
+                                     length))
+            {
+              self->message_pos = 0;
+              self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_KEEP_ALIVE:
         {
-          if (write_static_message (self, &message_data, keep_alive_message))
+          if (write_static_message (self, output, keep_alive_messages))
             self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_SYNC:
         {
-          if (write_static_message (self, &message_data, sync_message))
+          if (write_static_message (self, output, sync_messages))
             {
               self->sync_sent = TRUE;
               self->state = VSX_WATCH_PERSON_RESPONSE_AWAITING_DATA;
             }
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_WRITING_END:
         {
-          if (write_static_message (self, &message_data, end_message))
+          if (write_static_message (self, output, end_messages))
             self->state = VSX_WATCH_PERSON_RESPONSE_DONE;
           else
-            goto done;
+            return;
         }
         break;
 
       case VSX_WATCH_PERSON_RESPONSE_DONE:
-        goto done;
+        return;
       }
-
- done:
-  return message_data.data - data_in;
 }
 
 static gboolean
@@ -576,10 +827,12 @@ vsx_watch_person_response_has_data (VsxResponse *response)
 
     case VSX_WATCH_PERSON_RESPONSE_WRITING_N_TILES:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_PLAYER:
-    case VSX_WATCH_PERSON_RESPONSE_WRITING_SHOUT:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_TILE:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_NAME:
+    case VSX_WATCH_PERSON_RESPONSE_WRITING_LOG:
+    case VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES_TRUNCATED:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES:
+    case VSX_WATCH_PERSON_RESPONSE_WRITING_VERSION:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_KEEP_ALIVE:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_SYNC:
     case VSX_WATCH_PERSON_RESPONSE_WRITING_END:
@@ -602,11 +855,16 @@ vsx_watch_person_response_free (void *object)
   if (self->person)
     {
       vsx_list_remove (&self->conversation_changed_listener.link);
+      vsx_conversation_remove_log_reader (self->person->conversation,
+                                          &self->log_reader);
       vsx_object_unref (self->person);
     }
 
   vsx_main_context_remove_source (self->keep_alive_timer);
 
+  if (self->message_copy)
+    g_byte_array_free (self->message_copy, TRUE);
+
   vsx_response_get_class ()->parent_class.free (object);
 }
 
@@ -614,17 +872,21 @@ static VsxResponseClass *
 vsx_watch_person_response_get_class (void)
 {
   static VsxResponseClass klass;
+  static gsize initialized = 0;
 
-  if (klass.parent_class.free == NULL)
+  if (g_once_init_enter (&initialized))
     {
       klass = *vsx_response_get_class ();
 
       klass.parent_class.instance_size = sizeof (VsxWatchPersonResponse);
+      klass.parent_class.name = "VsxWatchPersonResponse";
       klass.parent_class.free = vsx_watch_person_response_free;
 
-      klass.add_data = vsx_watch_person_response_add_data;
+      klass.add_output = vsx_watch_person_response_add_output;
       klass.is_finished = vsx_watch_person_response_is_finished;
       klass.has_data = vsx_watch_person_response_has_data;
+
+      g_once_init_leave (&initialized, 1);
     }
 
   return &klass;
@@ -638,31 +900,15 @@ conversation_changed_cb (VsxListener *listener,
     vsx_container_of (listener, response, conversation_changed_listener);
   VsxConversationChangedData *data = user_data;
 
-  switch (data->type)
-    {
-    case VSX_CONVERSATION_N_TILES_CHANGED:
-      response->pending_n_tiles = TRUE;
-      break;
-
-    case VSX_CONVERSATION_PLAYER_CHANGED:
-      VSX_FLAGS_SET (response->dirty_players, data->num, TRUE);
-      break;
-
-    case VSX_CONVERSATION_TILE_CHANGED:
-      VSX_FLAGS_SET (response->dirty_tiles, data->num, TRUE);
-      break;
-
-    case VSX_CONVERSATION_STATE_CHANGED:
-    case VSX_CONVERSATION_MESSAGE_ADDED:
-      break;
-
-    case VSX_CONVERSATION_SHOUTED:
-      if (response->state == VSX_WATCH_PERSON_RESPONSE_WRITING_SHOUT)
-        return;
-      response->pending_shout = data->num;
-      break;
-    }
+  /* If the change is being held back for the flush window then there
+   * is nothing new to send until the window closes */
+  if (data->conversation->flush_source &&
+      (data->type == VSX_CONVERSATION_PLAYER_CHANGED ||
+       data->type == VSX_CONVERSATION_TILE_CHANGED ||
+       data->type == VSX_CONVERSATION_N_TILES_CHANGED))
+    return;
 
+  /* The details of the change will be in the log */
   vsx_response_changed ((VsxResponse *) response);
 }
 
@@ -671,15 +917,24 @@ keep_alive_timer_cb (VsxMainContextSource *source,
                      void *user_data)
 {
   VsxWatchPersonResponse *self = user_data;
+  gint64 elapsed = (vsx_main_context_get_monotonic_clock (NULL) -
+                    self->last_write_time);
 
-  if (vsx_main_context_get_monotonic_clock (NULL) -
-      self->last_write_time >= VSX_WATCH_PERSON_RESPONSE_KEEP_ALIVE_INTERVAL)
+  if (elapsed >= VSX_WATCH_PERSON_RESPONSE_KEEP_ALIVE_INTERVAL)
     vsx_response_changed ((VsxResponse *) self);
+  else
+    /* Something has been written since the timer was scheduled so
+     * wait until exactly one interval after the last write */
+    vsx_main_context_reschedule_timer (source,
+                                       (VSX_WATCH_PERSON_RESPONSE_KEEP_ALIVE_INTERVAL -
+                                        elapsed + 999) / 1000);
 }
 
 VsxResponse *
 vsx_watch_person_response_new (VsxPerson *person,
-                               int last_message)
+                               int last_message,
+                               unsigned int last_version,
+                               VsxFormatEncoding encoding)
 {
   VsxWatchPersonResponse *self =
     vsx_object_allocate (vsx_watch_person_response_get_class ());
@@ -688,21 +943,20 @@ vsx_watch_person_response_new (VsxPerson *person,
 
   self->person = vsx_object_ref (person);
   self->message_num = last_message;
-  self->pending_shout = -1;
-  self->pending_n_tiles = TRUE;
+  self->encoding = encoding;
+  self->encoder = vsx_format_encoders + encoding;
 
   self->last_write_time = vsx_main_context_get_monotonic_clock (NULL);
   self->keep_alive_timer =
     vsx_main_context_add_timer (NULL, /* default context */
                                 VSX_WATCH_PERSON_RESPONSE_KEEP_ALIVE_INTERVAL /
-                                60000000,
+                                1000,
                                 keep_alive_timer_cb,
                                 self);
 
-  vsx_flags_set_range (self->dirty_players,
-                       person->conversation->n_players);
-  vsx_flags_set_range (self->dirty_tiles,
-                       person->conversation->n_tiles_in_play);
+  queue_initial_state (self, last_version);
+  self->log_reader.encoding = encoding;
+  vsx_conversation_add_log_reader (person->conversation, &self->log_reader);
 
   self->conversation_changed_listener.notify = conversation_changed_cb;
   vsx_signal_add (&person->conversation->changed_signal,
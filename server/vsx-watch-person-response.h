@@ -23,6 +23,7 @@
 #include "vsx-person.h"
 #include "vsx-flags.h"
 #include "vsx-main-context.h"
+#include "vsx-format.h"
 
 G_BEGIN_DECLS
 
@@ -34,9 +35,11 @@ typedef enum
   VSX_WATCH_PERSON_RESPONSE_WRITING_N_TILES,
   VSX_WATCH_PERSON_RESPONSE_WRITING_NAME,
   VSX_WATCH_PERSON_RESPONSE_WRITING_PLAYER,
-  VSX_WATCH_PERSON_RESPONSE_WRITING_SHOUT,
   VSX_WATCH_PERSON_RESPONSE_WRITING_TILE,
+  VSX_WATCH_PERSON_RESPONSE_WRITING_LOG,
+  VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES_TRUNCATED,
   VSX_WATCH_PERSON_RESPONSE_WRITING_MESSAGES,
+  VSX_WATCH_PERSON_RESPONSE_WRITING_VERSION,
   VSX_WATCH_PERSON_RESPONSE_WRITING_SYNC,
   VSX_WATCH_PERSON_RESPONSE_WRITING_END,
   VSX_WATCH_PERSON_RESPONSE_WRITING_KEEP_ALIVE,
@@ -50,15 +53,33 @@ typedef struct
 
   VsxPerson *person;
 
+  /* How the events are written. The same encoding is used for the
+     log reader */
+  VsxFormatEncoding encoding;
+  const VsxFormatEncoder *encoder;
+
   VsxListener conversation_changed_listener;
 
+  /* Position in the conversation's shared event log. Changes that
+     happen after the response is created are sent from there */
+  VsxConversationLogReader log_reader;
+
   VsxWatchPersonResponseState state;
 
   unsigned int message_num;
   unsigned int message_pos;
 
+  /* Copy of the rest of a chat message that didn't fit in the output
+     in one go. The conversation might discard the message from its
+     history before we get a chance to write the rest. This is
+     created the first time it is needed */
+  GByteArray *message_copy;
+
   /* Number of players that we've sent a "player-name" event for */
   unsigned int named_players;
+  /* Number of players that we need to send a "player-name" event
+     for. Any players that join later will be in the log */
+  unsigned int n_snapshot_players;
 
   union
   {
@@ -81,20 +102,28 @@ typedef struct
       gint16 x, y;
       gint16 last_player;
     } tile;
+
+    /* The conversation version that we are reporting */
+    unsigned int version;
   } dirty;
 
+  /* The last conversation version that we've told the client about.
+     Once everything up to this version has been sent the client can
+     pass it back when it reconnects to only receive later changes */
+  unsigned int sent_version;
+
+  /* The initial state is sent by the response itself and then
+     anything else comes from the log. These are only set when the
+     response is created or if it loses its place in the log */
+
   /* Bit mask of players whose state needs updating */
-  unsigned long dirty_players
-  [VSX_FLAGS_N_LONGS_FOR_SIZE (VSX_CONVERSATION_MAX_PLAYERS)];
+  VSX_SUMMARY_FLAGS (VSX_CONVERSATION_MAX_PLAYERS) dirty_players;
 
   /* Bit mask of tiles that need updating */
-  unsigned long dirty_tiles
-  [VSX_FLAGS_N_LONGS_FOR_SIZE (VSX_TILE_DATA_N_TILES)];
+  VSX_SUMMARY_FLAGS (VSX_TILE_DATA_N_TILES) dirty_tiles;
 
   gboolean last_typing_state;
 
-  int pending_shout;
-
   gboolean pending_n_tiles;
 
   gboolean sync_sent;
@@ -105,7 +134,9 @@ typedef struct
 
 VsxResponse *
 vsx_watch_person_response_new (VsxPerson *person,
-                               int last_message);
+                               int last_message,
+                               unsigned int last_version,
+                               VsxFormatEncoding encoding);
 
 G_END_DECLS
 
@@ -85,6 +85,8 @@ function ChatSession (playerName)
   this.personId = null;
   this.personNumber = null;
   this.messageNumber = 0;
+  this.stateVersion = 0;
+  this.binaryEncoding = false;
   this.messageQueue = [];
   this.sentTypingState = false;
   this.unreadMessages = 0;
@@ -543,6 +545,24 @@ ChatSession.prototype.handleShout = function (data)
   this.playSound ("shout-sound");
 };
 
+ChatSession.prototype.handleVersion = function (data)
+{
+  if (typeof (data) != "number")
+    this.setError ("@BAD_DATA@");
+
+  this.stateVersion = data;
+};
+
+ChatSession.prototype.handleMessagesTruncated = function (data)
+{
+  if (typeof (data) != "number")
+    this.setError ("@BAD_DATA@");
+
+  /* Some messages were dropped from the server's history before we
+   * got them so carry on counting from the next one */
+  this.messageNumber = data;
+};
+
 ChatSession.prototype.handleSync = function ()
 {
   this.syncReceived = true;
@@ -588,16 +608,165 @@ ChatSession.prototype.processMessage = function (message)
     this.handleShout (message[1]);
     break;
 
+  case "version":
+    this.handleVersion (message[1]);
+    break;
+
+  case "messages-truncated":
+    this.handleMessagesTruncated (message[1]);
+    break;
+
   case "sync":
     this.handleSync ();
     break;
   }
 };
 
+/* Event types in the binary encoding. See doc/protocol.txt */
+var BINARY_EVENT_NAMES = [
+  "header", "n-tiles", "player-name", "player", "tile", "message",
+  "shout", "keep-alive", "sync", "end", "version", "messages-truncated"
+];
+
+function hexByte (b)
+{
+  return (b < 16 ? "0" : "") + b.toString (16).toUpperCase ();
+}
+
+/* Converts a binary event to the same array that would be received
+ * for the JSON encoding. The bytes are in the low 8 bits of each
+ * character of the string */
+function decodeBinaryEvent (type, text, pos, length)
+{
+  function byteAt (offset)
+  {
+    return text.charCodeAt (pos + offset) & 0xff;
+  }
+
+  function int16At (offset)
+  {
+    var value = byteAt (offset) | (byteAt (offset + 1) << 8);
+    return value >= 0x8000 ? value - 0x10000 : value;
+  }
+
+  function stringAt (offset)
+  {
+    var bytes = "";
+    for (var i = offset; i < length; i++)
+      bytes += String.fromCharCode (byteAt (i));
+    return decodeURIComponent (escape (bytes));
+  }
+
+  var name = BINARY_EVENT_NAMES[type];
+
+  switch (name)
+  {
+  case "header":
+    var id = "";
+    for (var i = 8; i >= 1; i--)
+      id += hexByte (byteAt (i));
+    return [name, { "num": byteAt (0), "id": id }];
+
+  case "n-tiles":
+  case "shout":
+    return [name, byteAt (0)];
+
+  case "player-name":
+    return [name, { "num": byteAt (0), "name": stringAt (1) }];
+
+  case "player":
+    return [name, { "num": byteAt (0), "flags": byteAt (1) }];
+
+  case "tile":
+    var player = byteAt (5);
+    var letter = byteAt (6) | (byteAt (7) << 8) | (byteAt (8) << 16);
+    if (letter >= 0x10000)
+    {
+      letter -= 0x10000;
+      letter = String.fromCharCode (0xd800 + (letter >> 10),
+                                    0xdc00 + (letter & 0x3ff));
+    }
+    else
+      letter = String.fromCharCode (letter);
+    return [name, { "num": byteAt (0),
+                    "x": int16At (1),
+                    "y": int16At (3),
+                    "letter": letter,
+                    "player": player == 0xff ? -1 : player }];
+
+  case "message":
+    return [name, { "person": byteAt (0), "text": stringAt (1) }];
+
+  case "version":
+  case "messages-truncated":
+    return [name, ((byteAt (0) | (byteAt (1) << 8) | (byteAt (2) << 16)) +
+                   byteAt (3) * 0x1000000)];
+
+  case "keep-alive":
+  case "sync":
+  case "end":
+    return [name];
+  }
+
+  /* Unknown event */
+  return null;
+}
+
+ChatSession.prototype.checkBinaryData = function ()
+{
+  var responseText = this.watchAjax.responseText;
+
+  if (!responseText)
+    return;
+
+  while (true)
+  {
+    var pos = this.watchPosition;
+
+    if (pos >= responseText.length)
+      break;
+
+    var type = responseText.charCodeAt (pos++) & 0xff;
+
+    /* The payload length is stored 7 bits at a time with the top bit
+     * set on every byte except the last */
+    var length = 0;
+    var shift = 0;
+    var b;
+
+    do
+    {
+      if (pos >= responseText.length)
+        return;
+      b = responseText.charCodeAt (pos++) & 0xff;
+      length += (b & 0x7f) * Math.pow (2, shift);
+      shift += 7;
+    } while ((b & 0x80));
+
+    if (pos + length > responseText.length)
+      break;
+
+    var message = decodeBinaryEvent (type, responseText, pos, length);
+
+    if (message)
+      this.processMessage (message);
+
+    this.watchPosition = pos + length;
+
+    this.lastDataTime = new Date ();
+  }
+};
+
 ChatSession.prototype.checkData = function ()
 {
   var responseText = this.watchAjax.responseText;
 
+  if (this.binaryEncoding)
+  {
+    this.checkBinaryData ();
+    return;
+  }
+
   if (responseText)
     while (this.watchPosition < responseText.length)
     {
@@ -711,22 +880,30 @@ ChatSession.prototype.startWatchAjax = function ()
 {
   var method;
 
-  if (this.personId)
-    method = "watch_person?" + this.personId + "&" + this.messageNumber;
-
-  else
-    method = ("new_person?" + encodeURIComponent (this.roomName) + "&" +
-              encodeURIComponent (this.playerName));
-
   this.clearWatchAjax ();
 
   this.watchPosition = 0;
 
   this.watchAjax = getAjaxObject ();
 
+  /* The binary encoding is smaller but we can only read it if the
+   * browser lets us get at the raw bytes of the response */
+  this.binaryEncoding = !!this.watchAjax.overrideMimeType;
+  var encoding = this.binaryEncoding ? "binary" : "json";
+
+  if (this.personId)
+    method = ("watch_person?" + this.personId + "&" + this.messageNumber +
+              "&" + this.stateVersion + "&" + encoding);
+
+  else
+    method = ("new_person?" + encodeURIComponent (this.roomName) + "&" +
+              encodeURIComponent (this.playerName) + "&" + encoding);
+
   this.watchAjax.onreadystatechange = this.watchReadyStateChangeCb.bind (this);
 
   this.watchAjax.open ("GET", this.getUrl (method));
+  if (this.binaryEncoding)
+    this.watchAjax.overrideMimeType ("text/plain; charset=x-user-defined");
   this.watchAjax.send (null);
 
   this.lastDataTime = new Date ();
@@ -755,6 +932,42 @@ ChatSession.prototype.sendMessageReadyStateChangeCb = function ()
   }
 };
 
+/* Commands that can be sent together in a single /batch request */
+var BATCH_COMMANDS = {
+  "move_tile": true,
+  "turn": true,
+  "shout": true,
+  "set_n_tiles": true,
+  "keep_alive": true
+};
+
+function isBatchCommand (message)
+{
+  return BATCH_COMMANDS.hasOwnProperty (message[0]);
+}
+
+ChatSession.prototype.sendBatch = function ()
+{
+  var lines = [];
+
+  /* Take all of the commands from the front of the queue up to the
+   * next chat message so that the order is kept */
+  while (this.messageQueue.length > 0 &&
+         isBatchCommand (this.messageQueue[0]))
+    lines.push (this.messageQueue.shift ().join ("&"));
+
+  this.sendMessageAjax = getAjaxObject ();
+  this.sendMessageAjax.onreadystatechange =
+    this.sendMessageReadyStateChangeCb.bind (this);
+  this.sendMessageAjax.open ("POST",
+                             this.getUrl ("batch?" + this.personId));
+  this.sendMessageAjax.setRequestHeader ("Content-Type",
+                                         "text/plain; charset=UTF-8");
+  this.sendMessageAjax.send (lines.join ("\n"));
+
+  this.resetKeepAlive ();
+};
+
 ChatSession.prototype.sendNextMessage = function ()
 {
   if (this.sendMessageAjax)
@@ -786,6 +999,16 @@ ChatSession.prototype.sendNextMessage = function ()
     return;
   }
 
+  /* If more than one command has built up while waiting for the
+   * last request then they are all sent at once */
+  if (this.messageQueue.length > 1 &&
+      isBatchCommand (this.messageQueue[0]) &&
+      isBatchCommand (this.messageQueue[1]))
+  {
+    this.sendBatch ();
+    return;
+  }
+
   var message = this.messageQueue.shift ();
 
   this.sendMessageAjax = getAjaxObject ();